@@ -0,0 +1,291 @@
+/*
+ * libopenemv - a library to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "openemv/bcd.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BCD_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ * All kernels work on fields widened to 8 bytes, with zero bytes in
+ * front so that the most significant digits come first in memory, as
+ * on the card. Widened fields are kept as loaded from memory, in host
+ * byte order.
+ */
+static inline uint64_t bcd_mask(size_t len)
+{
+	uint64_t mask = ~0ULL;
+	unsigned char *m = (unsigned char *)&mask;
+
+	memset(m, 0, 8 - len);
+
+	return mask;
+}
+
+static inline uint64_t bcd_widen(const unsigned char *p, size_t len)
+{
+	uint64_t v = 0;
+
+	memcpy((unsigned char *)&v + 8 - len, p, len);
+
+	return v;
+}
+
+/*
+ * Field i of a batch. When there are at least 8 bytes of the buffer up
+ * to the end of the field, a single unaligned load ending there is used
+ * and the bytes in front of the field are masked off.
+ */
+static inline uint64_t bcd_gather(const unsigned char *buf, size_t stride, size_t len, size_t i)
+{
+	const unsigned char *p = buf + i * stride;
+	uint64_t v;
+
+	if (i * stride + len < 8)
+		return bcd_widen(p, len);
+
+	memcpy(&v, p + len - 8, 8);
+
+	return len == 8 ? v : v & bcd_mask(len);
+}
+
+/* Sixteen digits at once, within a 64-bit register */
+static bool bcd_decode64(uint64_t v, uint64_t *value)
+{
+	/* A nibble is above 9 when bit 3 is set along with bit 2 or 1 */
+	if ((v & 0x8888888888888888ULL) & ((v << 1) | (v << 2)))
+		return false;
+
+	/* hi * 16 + lo - 6 * hi: every byte becomes 0..99 */
+	v -= ((v >> 4) & 0x0f0f0f0f0f0f0f0fULL) * 6;
+	/* Pairs of bytes into 0..9999 */
+	v = ((v >> 8) & 0x00ff00ff00ff00ffULL) * 100 + (v & 0x00ff00ff00ff00ffULL);
+	/* Pairs of 16-bit words into 0..99999999 */
+	v = ((v >> 16) & 0x0000ffff0000ffffULL) * 10000 + (v & 0x0000ffff0000ffffULL);
+
+	*value = (v >> 32) * 100000000 + (v & 0xffffffff);
+
+	return true;
+}
+
+/* Memory order to a number with the first byte most significant */
+static inline uint64_t bcd_be64(uint64_t v)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	return __builtin_bswap64(v);
+#else
+	return v;
+#endif
+}
+
+bool bcd_decode(const unsigned char *buf, size_t len, uint64_t *value)
+{
+	uint64_t hi;
+
+	if (len > BCD_MAX_LEN)
+		return false;
+
+	if (len <= 8)
+		return bcd_decode64(bcd_be64(bcd_widen(buf, len)), value);
+
+	/* Nine bytes: two leading digits, then sixteen */
+	if (!bcd_decode64(buf[0], &hi) || !bcd_decode64(bcd_be64(bcd_widen(buf + 1, 8)), value))
+		return false;
+
+	*value += hi * 10000000000000000ULL;
+
+	return true;
+}
+
+static size_t bcd_decode_batch_scalar(const unsigned char *buf, size_t stride, size_t len,
+		size_t count, uint64_t *values, bool *valid)
+{
+	size_t i, ok = 0;
+
+	for (i = 0; i < count; i++) {
+		bool v;
+
+		if (len <= 8)
+			v = bcd_decode64(bcd_be64(bcd_gather(buf, stride, len, i)), &values[i]);
+		else
+			v = bcd_decode(buf + i * stride, len, &values[i]);
+
+		if (!v)
+			values[i] = 0;
+		if (valid)
+			valid[i] = v;
+		ok += v;
+	}
+
+	return ok;
+}
+
+#ifdef BCD_X86
+/*
+ * The same steps as bcd_decode64() on several fields per register:
+ * bytes are reduced to 0..99, maddubs/madd combine neighbours into
+ * 16 and 32-bit values and mul_epu32 finishes each 64-bit lane.
+ */
+__attribute__((target("ssse3")))
+static size_t bcd_decode_batch_ssse3(const unsigned char *buf, size_t stride, size_t len,
+		size_t count, uint64_t *values, bool *valid)
+{
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	const __m128i nine = _mm_set1_epi8(9);
+	const __m128i six = _mm_set1_epi16(6);
+	const __m128i w100 = _mm_set1_epi16(0x0164);	/* bytes 100, 1 */
+	const __m128i w10000 = _mm_set1_epi32(0x00012710);	/* words 10000, 1 */
+	const __m128i w1e8 = _mm_set1_epi64x(100000000);
+	size_t i, j, ok = 0;
+
+	for (i = 0; i + 2 <= count; i += 2) {
+		__m128i v, hi, lo, bad;
+		unsigned mask;
+
+		v = _mm_set_epi64x(bcd_gather(buf, stride, len, i + 1),
+				bcd_gather(buf, stride, len, i));
+
+		hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+		lo = _mm_and_si128(v, nibble);
+		bad = _mm_or_si128(_mm_cmpgt_epi8(hi, nine), _mm_cmpgt_epi8(lo, nine));
+		mask = _mm_movemask_epi8(bad);
+
+		/* 6 * hi never exceeds a byte, so a 16-bit multiply will do */
+		v = _mm_sub_epi8(v, _mm_mullo_epi16(hi, six));
+
+		v = _mm_maddubs_epi16(v, w100);
+		v = _mm_madd_epi16(v, w10000);
+		v = _mm_add_epi64(_mm_mul_epu32(v, w1e8), _mm_srli_epi64(v, 32));
+
+		_mm_storeu_si128((__m128i *)(values + i), v);
+
+		for (j = 0; j < 2; j++) {
+			bool v_ok = !(mask & (0xff << (8 * j)));
+
+			if (!v_ok)
+				values[i + j] = 0;
+			if (valid)
+				valid[i + j] = v_ok;
+			ok += v_ok;
+		}
+	}
+
+	return ok + bcd_decode_batch_scalar(buf + i * stride, stride, len, count - i,
+			values + i, valid ? valid + i : NULL);
+}
+
+__attribute__((target("avx2")))
+static size_t bcd_decode_batch_avx2(const unsigned char *buf, size_t stride, size_t len,
+		size_t count, uint64_t *values, bool *valid)
+{
+	const __m256i nibble = _mm256_set1_epi8(0x0f);
+	const __m256i nine = _mm256_set1_epi8(9);
+	const __m256i six = _mm256_set1_epi16(6);
+	const __m256i w100 = _mm256_set1_epi16(0x0164);
+	const __m256i w10000 = _mm256_set1_epi32(0x00012710);
+	const __m256i w1e8 = _mm256_set1_epi64x(100000000);
+	size_t i, j, ok = 0;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		__m256i v, hi, lo, bad;
+		unsigned mask;
+
+		v = _mm256_set_epi64x(bcd_gather(buf, stride, len, i + 3),
+				bcd_gather(buf, stride, len, i + 2),
+				bcd_gather(buf, stride, len, i + 1),
+				bcd_gather(buf, stride, len, i));
+
+		hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+		lo = _mm256_and_si256(v, nibble);
+		bad = _mm256_or_si256(_mm256_cmpgt_epi8(hi, nine), _mm256_cmpgt_epi8(lo, nine));
+		mask = _mm256_movemask_epi8(bad);
+
+		v = _mm256_sub_epi8(v, _mm256_mullo_epi16(hi, six));
+
+		v = _mm256_maddubs_epi16(v, w100);
+		v = _mm256_madd_epi16(v, w10000);
+		v = _mm256_add_epi64(_mm256_mul_epu32(v, w1e8), _mm256_srli_epi64(v, 32));
+
+		_mm256_storeu_si256((__m256i *)(values + i), v);
+
+		for (j = 0; j < 4; j++) {
+			bool v_ok = !(mask & (0xffu << (8 * j)));
+
+			if (!v_ok)
+				values[i + j] = 0;
+			if (valid)
+				valid[i + j] = v_ok;
+			ok += v_ok;
+		}
+	}
+
+	return ok + bcd_decode_batch_scalar(buf + i * stride, stride, len, count - i,
+			values + i, valid ? valid + i : NULL);
+}
+#endif
+
+typedef size_t (*bcd_batch_fn)(const unsigned char *buf, size_t stride, size_t len,
+		size_t count, uint64_t *values, bool *valid);
+
+/* NULL picks the fastest kernel on each call */
+static bcd_batch_fn bcd_decode_batch_forced;
+
+bool bcd_decode_batch_init(const char *impl)
+{
+	bcd_batch_fn fn = bcd_decode_batch_scalar;
+
+	if (!strcmp(impl, "auto"))
+		fn = NULL;
+	else if (strcmp(impl, "c") && strcmp(impl, "ssse3") && strcmp(impl, "avx2"))
+		return false;
+#ifdef BCD_X86
+	/* Forcing a kernel the CPU lacks gets the portable one */
+	else if (!strcmp(impl, "ssse3") && __builtin_cpu_supports("ssse3"))
+		fn = bcd_decode_batch_ssse3;
+	else if (!strcmp(impl, "avx2") && __builtin_cpu_supports("avx2"))
+		fn = bcd_decode_batch_avx2;
+#endif
+
+	bcd_decode_batch_forced = fn;
+
+	return true;
+}
+
+size_t bcd_decode_batch(const unsigned char *buf, size_t stride, size_t len,
+		size_t count, uint64_t *values, bool *valid)
+{
+	if (bcd_decode_batch_forced && len <= 8)
+		return bcd_decode_batch_forced(buf, stride, len, count, values, valid);
+
+#ifdef BCD_X86
+	/* The vector kernels cover the common fields of up to 16 digits */
+	if (len <= 8) {
+		if (__builtin_cpu_supports("avx2"))
+			return bcd_decode_batch_avx2(buf, stride, len, count, values, valid);
+		if (__builtin_cpu_supports("ssse3"))
+			return bcd_decode_batch_ssse3(buf, stride, len, count, values, valid);
+	}
+#endif
+
+	return bcd_decode_batch_scalar(buf, stride, len, count, values, valid);
+}
@@ -19,6 +19,7 @@
 
 #include "openemv/config.h"
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -41,6 +42,7 @@ static void openemv_config_error(const config_t *config)
 #endif
 
 static config_t *_openemv_config;
+static pthread_once_t openemv_config_once = PTHREAD_ONCE_INIT;
 
 static void openemv_init_config(void)
 {
@@ -71,11 +73,22 @@ const char *openemv_config_get_def(const char *path, const char *def)
 {
 	const char *value = def;
 
-	if (!_openemv_config)
-		openemv_init_config();
+	pthread_once(&openemv_config_once, openemv_init_config);
 
 	if (_openemv_config)
 		config_lookup_string(_openemv_config, path, &value);
 
 	return value;
 }
+
+int openemv_config_get_int(const char *path, int def)
+{
+	int value = def;
+
+	pthread_once(&openemv_config_once, openemv_init_config);
+
+	if (_openemv_config)
+		config_lookup_int(_openemv_config, path, &value);
+
+	return value;
+}
@@ -21,39 +21,142 @@
 #include "openemv/crypto.h"
 #include "crypto_backend.h"
 
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 
 static struct crypto_backend *crypto_backend;
+static struct crypto_hash *(*crypto_hash_backend_open)(enum crypto_algo_hash hash);
 
-static bool crypto_init(void)
+static struct crypto_hash *crypto_hash_native_open(enum crypto_algo_hash hash)
 {
-	const char *driver;
+	if (hash == HASH_SHA_1)
+		return crypto_sha1_open();
+
+	return crypto_backend->hash_open(hash);
+}
 
-	if (crypto_backend)
+/* Hashes come from the driver unless the built-in SHA-1 is asked for */
+static bool crypto_hash_init(void)
+{
+	const char *hash = openemv_config_get_def("crypto.hash", "driver");
+
+	if (!strcmp(hash, "driver")) {
+		crypto_hash_backend_open = crypto_backend->hash_open;
 		return true;
+	}
+
+	if (!crypto_sha1_init(hash))
+		return false;
+
+	crypto_hash_backend_open = crypto_hash_native_open;
+
+	return true;
+}
+
+static pthread_once_t crypto_init_once_control = PTHREAD_ONCE_INIT;
+
+static void crypto_init_once(void)
+{
+	struct crypto_backend *backend = NULL;
+	const char *driver;
 
 	driver = openemv_config_get_def("crypto.driver", DEFAULT_CRYPTO);
 	if (!driver)
-		return false;
+		return;
 	else if (!strcmp(driver, "libgcrypt"))
-		crypto_backend = crypto_libgcrypt_init();
+		backend = crypto_libgcrypt_init();
 	else if (!strcmp(driver, "nettle"))
-		crypto_backend = crypto_nettle_init();
+		backend = crypto_nettle_init();
+	else if (!strcmp(driver, "openssl"))
+		backend = crypto_openssl_init();
+	else if (!strcmp(driver, "auto"))
+		backend = crypto_probe_init();
+
+	if (!backend)
+		return;
+
+	crypto_backend = backend;
+	if (!crypto_hash_init())
+		crypto_backend = NULL;
+}
 
-	if (!crypto_backend)
-		return false;
+/* The first caller sets the backend up, for all threads */
+static bool crypto_init(void)
+{
+	pthread_once(&crypto_init_once_control, crypto_init_once);
 
-	return true;
+	return crypto_backend != NULL;
+}
+
+/* Contexts kept per thread for each hash algorithm */
+#define CRYPTO_HASH_POOL_SIZE 4
+#define CRYPTO_HASH_ALGOS (HASH_SHA_1 + 1)
+
+struct crypto_hash_pool {
+	unsigned count[CRYPTO_HASH_ALGOS];
+	struct crypto_hash *ch[CRYPTO_HASH_ALGOS][CRYPTO_HASH_POOL_SIZE];
+};
+
+static pthread_once_t crypto_hash_pool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t crypto_hash_pool_key;
+static bool crypto_hash_pool_ok;
+
+/* Thread exit */
+static void crypto_hash_pool_free(void *data)
+{
+	struct crypto_hash_pool *pool = data;
+	unsigned i, j;
+
+	for (i = 0; i < CRYPTO_HASH_ALGOS; i++)
+		for (j = 0; j < pool->count[i]; j++)
+			pool->ch[i][j]->close(pool->ch[i][j]);
+
+	free(pool);
+}
+
+static void crypto_hash_pool_init_once(void)
+{
+	crypto_hash_pool_ok = !pthread_key_create(&crypto_hash_pool_key, crypto_hash_pool_free);
+}
+
+static struct crypto_hash_pool *crypto_hash_pool_get(bool create)
+{
+	struct crypto_hash_pool *pool;
+
+	pthread_once(&crypto_hash_pool_once, crypto_hash_pool_init_once);
+	if (!crypto_hash_pool_ok)
+		return NULL;
+
+	pool = pthread_getspecific(crypto_hash_pool_key);
+	if (pool || !create)
+		return pool;
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return NULL;
+
+	if (pthread_setspecific(crypto_hash_pool_key, pool)) {
+		free(pool);
+		return NULL;
+	}
+
+	return pool;
 }
 
 struct crypto_hash *crypto_hash_open(enum crypto_algo_hash hash)
 {
+	struct crypto_hash_pool *pool;
 	struct crypto_hash *ch;
 
 	if (!crypto_init())
 		return NULL;
 
-	ch = crypto_backend->hash_open(hash);
+	pool = crypto_hash_pool_get(false);
+	if (pool && hash < CRYPTO_HASH_ALGOS && pool->count[hash])
+		return pool->ch[hash][--pool->count[hash]];
+
+	ch = crypto_hash_backend_open(hash);
 	if (ch)
 		ch->algo = hash;
 
@@ -62,14 +165,43 @@ struct crypto_hash *crypto_hash_open(enum crypto_algo_hash hash)
 
 void crypto_hash_close(struct crypto_hash *ch)
 {
+	struct crypto_hash_pool *pool;
+
+	if (ch->algo < CRYPTO_HASH_ALGOS) {
+		pool = crypto_hash_pool_get(true);
+		if (pool && pool->count[ch->algo] < CRYPTO_HASH_POOL_SIZE) {
+			ch->reset(ch);
+			pool->ch[ch->algo][pool->count[ch->algo]++] = ch;
+			return;
+		}
+	}
+
 	ch->close(ch);
 }
 
+void crypto_hash_reset(struct crypto_hash *ch)
+{
+	ch->reset(ch);
+}
+
 void crypto_hash_write(struct crypto_hash *ch, const unsigned char *buf, size_t len)
 {
 	ch->write(ch, buf, len);
 }
 
+void crypto_hash_writev(struct crypto_hash *ch, const struct iovec *iov, int n)
+{
+	int i;
+
+	if (ch->writev) {
+		ch->writev(ch, iov, n);
+		return;
+	}
+
+	for (i = 0; i < n; i++)
+		ch->write(ch, iov[i].iov_base, iov[i].iov_len);
+}
+
 unsigned char *crypto_hash_read(struct crypto_hash *ch)
 {
 	return ch->read(ch);
@@ -80,6 +212,44 @@ size_t crypto_hash_get_size(const struct crypto_hash *ch)
 	return ch->get_size(ch);
 }
 
+bool crypto_hash_many(enum crypto_algo_hash hash, const unsigned char *const *bufs, const size_t *lens, size_t n, unsigned char *digests)
+{
+	struct crypto_hash *ch;
+	size_t i, size;
+
+	if (!crypto_init())
+		return false;
+
+	if (hash == HASH_SHA_1 && crypto_hash_backend_open == crypto_hash_native_open) {
+		crypto_sha1_many(bufs, lens, n, digests);
+		return true;
+	}
+
+	/* One at a time through the driver */
+	ch = crypto_hash_open(hash);
+	if (!ch)
+		return false;
+
+	size = crypto_hash_get_size(ch);
+	for (i = 0; i < n; i++) {
+		unsigned char *digest;
+
+		if (i)
+			crypto_hash_reset(ch);
+		crypto_hash_write(ch, bufs[i], lens[i]);
+		digest = crypto_hash_read(ch);
+		if (!digest) {
+			crypto_hash_close(ch);
+			return false;
+		}
+		memcpy(digests + i * size, digest, size);
+	}
+
+	crypto_hash_close(ch);
+
+	return true;
+}
+
 struct crypto_pk *crypto_pk_open(enum crypto_algo_pk pk, ...)
 {
 	struct crypto_pk *cp;
@@ -92,8 +262,10 @@ struct crypto_pk *crypto_pk_open(enum crypto_algo_pk pk, ...)
 	cp = crypto_backend->pk_open(pk, vl);
 	va_end(vl);
 
-	if (cp)
+	if (cp) {
 		cp->algo = pk;
+		cp->refcount = 1;
+	}
 
 	return cp;
 }
@@ -113,8 +285,10 @@ struct crypto_pk *crypto_pk_open_priv(enum crypto_algo_pk pk, ...)
 	cp = crypto_backend->pk_open_priv(pk, vl);
 	va_end(vl);
 
-	if (cp)
+	if (cp) {
 		cp->algo = pk;
+		cp->refcount = 1;
+	}
 
 	return cp;
 }
@@ -134,17 +308,39 @@ struct crypto_pk *crypto_pk_genkey(enum crypto_algo_pk pk, ...)
 	cp = crypto_backend->pk_genkey(pk, vl);
 	va_end(vl);
 
-	if (cp)
+	if (cp) {
 		cp->algo = pk;
+		cp->refcount = 1;
+	}
+
+	return cp;
+}
+
+struct crypto_pk *crypto_pk_ref(struct crypto_pk *cp)
+{
+	__atomic_add_fetch(&cp->refcount, 1, __ATOMIC_RELAXED);
 
 	return cp;
 }
 
+/* Drops a reference, the last one frees the handle */
 void crypto_pk_close(struct crypto_pk *cp)
 {
+	if (__atomic_sub_fetch(&cp->refcount, 1, __ATOMIC_ACQ_REL))
+		return;
+
 	cp->close(cp);
 }
 
+bool crypto_pk_precompute(struct crypto_pk *cp)
+{
+	/* Nothing to gain for this backend */
+	if (!cp->precompute)
+		return true;
+
+	return cp->precompute(cp);
+}
+
 unsigned char *crypto_pk_encrypt(const struct crypto_pk *cp, const unsigned char *buf, size_t len, size_t *clen)
 {
 	return cp->encrypt(cp, buf, len, clen);
@@ -161,6 +357,84 @@ unsigned char *crypto_pk_decrypt(const struct crypto_pk *cp, const unsigned char
 	return cp->decrypt(cp, buf, len, clen);
 }
 
+/* For backends without the _into variants */
+static size_t crypto_pk_copy_out(unsigned char *res, size_t reslen, unsigned char *out, size_t outlen)
+{
+	if (!res)
+		return 0;
+
+	if (reslen > outlen)
+		reslen = 0;
+	else
+		memcpy(out, res, reslen);
+	free(res);
+
+	return reslen;
+}
+
+size_t crypto_pk_encrypt_into(const struct crypto_pk *cp, const unsigned char *buf, size_t len, unsigned char *out, size_t outlen)
+{
+	unsigned char *res;
+	size_t reslen;
+
+	if (cp->encrypt_into)
+		return cp->encrypt_into(cp, buf, len, out, outlen);
+
+	res = cp->encrypt(cp, buf, len, &reslen);
+
+	return crypto_pk_copy_out(res, reslen, out, outlen);
+}
+
+size_t crypto_pk_decrypt_into(const struct crypto_pk *cp, const unsigned char *buf, size_t len, unsigned char *out, size_t outlen)
+{
+	unsigned char *res;
+	size_t reslen;
+
+	if (cp->decrypt_into)
+		return cp->decrypt_into(cp, buf, len, out, outlen);
+
+	if (!cp->decrypt)
+		return 0;
+
+	res = cp->decrypt(cp, buf, len, &reslen);
+
+	return crypto_pk_copy_out(res, reslen, out, outlen);
+}
+
+struct crypto_pk_batch {
+	const struct crypto_pk **keys;
+	const unsigned char **in;
+	size_t *lens;
+	unsigned char **out;
+	bool ok;
+};
+
+static void crypto_pk_encrypt_batch_one(void *arg, size_t i)
+{
+	struct crypto_pk_batch *batch = arg;
+	const struct crypto_pk *cp = batch->keys[i];
+
+	batch->lens[i] = crypto_pk_encrypt_into(cp, batch->in[i], batch->lens[i],
+			batch->out[i], (crypto_pk_get_nbits(cp) + 7) / 8);
+	if (!batch->lens[i])
+		__atomic_store_n(&batch->ok, false, __ATOMIC_RELAXED);
+}
+
+bool crypto_pk_encrypt_batch(const struct crypto_pk **keys, const unsigned char **in, size_t *lens, unsigned char **out, size_t n)
+{
+	struct crypto_pk_batch batch = {
+		.keys = keys,
+		.in = in,
+		.lens = lens,
+		.out = out,
+		.ok = true,
+	};
+
+	crypto_pool_run(crypto_pk_encrypt_batch_one, &batch, n);
+
+	return batch.ok;
+}
+
 enum crypto_algo_pk crypto_pk_get_algo(const struct crypto_pk *cp)
 {
 	if (!cp)
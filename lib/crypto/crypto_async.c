@@ -0,0 +1,287 @@
+/*
+ * libopenemv - a library to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Crypto operations queued to a background thread, so that the caller
+ * can go on talking to the card meanwhile. Jobs run one after another
+ * in submission order.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "openemv/crypto.h"
+#include "crypto_backend.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+enum crypto_job_type {
+	CRYPTO_JOB_ENCRYPT,
+	CRYPTO_JOB_DECRYPT,
+	CRYPTO_JOB_HASH,
+};
+
+struct crypto_job {
+	struct crypto_job *next;
+	enum crypto_job_type type;
+	struct crypto_pk *cp;
+	enum crypto_algo_hash hash;
+	crypto_job_cb cb;
+	void *data;
+	bool done;
+	size_t len;
+	/* Capacity, then length of the result, which follows the input */
+	size_t reslen;
+	unsigned char *res;
+	unsigned char buf[];
+};
+
+static pthread_mutex_t crypto_job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t crypto_job_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t crypto_job_finished = PTHREAD_COND_INITIALIZER;
+static struct crypto_job *crypto_job_head, **crypto_job_tail = &crypto_job_head;
+static pthread_once_t crypto_job_once = PTHREAD_ONCE_INIT;
+static bool crypto_job_running;
+static int crypto_job_efd = -1;
+
+static void crypto_job_run(struct crypto_job *job)
+{
+	struct crypto_hash *ch;
+	unsigned char *digest;
+
+	switch (job->type) {
+	case CRYPTO_JOB_ENCRYPT:
+		job->reslen = crypto_pk_encrypt_into(job->cp, job->buf, job->len, job->res, job->reslen);
+		break;
+	case CRYPTO_JOB_DECRYPT:
+		job->reslen = crypto_pk_decrypt_into(job->cp, job->buf, job->len, job->res, job->reslen);
+		break;
+	case CRYPTO_JOB_HASH:
+		ch = crypto_hash_open(job->hash);
+		if (!ch) {
+			job->reslen = 0;
+			break;
+		}
+		crypto_hash_write(ch, job->buf, job->len);
+		digest = crypto_hash_read(ch);
+		if (digest)
+			memcpy(job->res, digest, job->reslen);
+		else
+			job->reslen = 0;
+		crypto_hash_close(ch);
+		break;
+	}
+}
+
+static void *crypto_job_worker(void *data)
+{
+	struct crypto_job *job;
+	uint64_t one = 1;
+
+	while (true) {
+		pthread_mutex_lock(&crypto_job_lock);
+		while (!crypto_job_head)
+			pthread_cond_wait(&crypto_job_queued, &crypto_job_lock);
+
+		job = crypto_job_head;
+		crypto_job_head = job->next;
+		if (!crypto_job_head)
+			crypto_job_tail = &crypto_job_head;
+		pthread_mutex_unlock(&crypto_job_lock);
+
+		crypto_job_run(job);
+
+		/* Before marking it done, after which the job may be freed */
+		if (job->cb)
+			job->cb(job->data, job->reslen ? job->res : NULL, job->reslen);
+
+		pthread_mutex_lock(&crypto_job_lock);
+		job->done = true;
+		pthread_cond_broadcast(&crypto_job_finished);
+		pthread_mutex_unlock(&crypto_job_lock);
+
+		/* Might only fail with the counter full, then it is readable anyway */
+		if (crypto_job_efd >= 0)
+			while (write(crypto_job_efd, &one, sizeof(one)) < 0 && errno == EINTR)
+				;
+	}
+
+	return NULL;
+}
+
+static void crypto_job_init_once(void)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+
+#ifdef HAVE_SYS_EVENTFD_H
+	crypto_job_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+
+	if (pthread_attr_init(&attr))
+		return;
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	crypto_job_running = !pthread_create(&thread, &attr, crypto_job_worker, NULL);
+	pthread_attr_destroy(&attr);
+}
+
+static struct crypto_job *crypto_job_submit(enum crypto_job_type type, const unsigned char *buf, size_t len, size_t reslen, crypto_job_cb cb, void *data)
+{
+	struct crypto_job *job;
+
+	pthread_once(&crypto_job_once, crypto_job_init_once);
+	if (!crypto_job_running)
+		return NULL;
+
+	job = malloc(sizeof(*job) + reslen + len);
+	if (!job)
+		return NULL;
+
+	job->next = NULL;
+	job->type = type;
+	job->cp = NULL;
+	job->cb = cb;
+	job->data = data;
+	job->done = false;
+	job->len = len;
+	job->reslen = reslen;
+	job->res = job->buf + len;
+	memcpy(job->buf, buf, len);
+
+	return job;
+}
+
+static void crypto_job_queue(struct crypto_job *job)
+{
+	pthread_mutex_lock(&crypto_job_lock);
+	*crypto_job_tail = job;
+	crypto_job_tail = &job->next;
+	pthread_cond_signal(&crypto_job_queued);
+	pthread_mutex_unlock(&crypto_job_lock);
+}
+
+static struct crypto_job *crypto_job_pk(enum crypto_job_type type, struct crypto_pk *cp, const unsigned char *buf, size_t len, crypto_job_cb cb, void *data)
+{
+	struct crypto_job *job;
+
+	job = crypto_job_submit(type, buf, len, (crypto_pk_get_nbits(cp) + 7) / 8, cb, data);
+	if (!job)
+		return NULL;
+
+	job->cp = crypto_pk_ref(cp);
+	crypto_job_queue(job);
+
+	return job;
+}
+
+struct crypto_job *crypto_pk_encrypt_async(struct crypto_pk *cp, const unsigned char *buf, size_t len, crypto_job_cb cb, void *data)
+{
+	return crypto_job_pk(CRYPTO_JOB_ENCRYPT, cp, buf, len, cb, data);
+}
+
+struct crypto_job *crypto_pk_decrypt_async(struct crypto_pk *cp, const unsigned char *buf, size_t len, crypto_job_cb cb, void *data)
+{
+	return crypto_job_pk(CRYPTO_JOB_DECRYPT, cp, buf, len, cb, data);
+}
+
+struct crypto_job *crypto_hash_async(enum crypto_algo_hash hash, const unsigned char *buf, size_t len, crypto_job_cb cb, void *data)
+{
+	struct crypto_hash *ch;
+	struct crypto_job *job;
+	size_t size;
+
+	/* Only to learn the digest size, the context goes back to the pool */
+	ch = crypto_hash_open(hash);
+	if (!ch)
+		return NULL;
+	size = crypto_hash_get_size(ch);
+	crypto_hash_close(ch);
+
+	job = crypto_job_submit(CRYPTO_JOB_HASH, buf, len, size, cb, data);
+	if (!job)
+		return NULL;
+
+	job->hash = hash;
+	crypto_job_queue(job);
+
+	return job;
+}
+
+bool crypto_job_done(const struct crypto_job *job)
+{
+	bool done;
+
+	pthread_mutex_lock(&crypto_job_lock);
+	done = job->done;
+	pthread_mutex_unlock(&crypto_job_lock);
+
+	return done;
+}
+
+void crypto_job_wait(struct crypto_job *job)
+{
+	pthread_mutex_lock(&crypto_job_lock);
+	while (!job->done)
+		pthread_cond_wait(&crypto_job_finished, &crypto_job_lock);
+	pthread_mutex_unlock(&crypto_job_lock);
+}
+
+const unsigned char *crypto_job_result(struct crypto_job *job, size_t *len)
+{
+	crypto_job_wait(job);
+
+	*len = job->reslen;
+
+	return job->reslen ? job->res : NULL;
+}
+
+void crypto_job_free(struct crypto_job *job)
+{
+	if (!job)
+		return;
+
+	crypto_job_wait(job);
+
+	if (job->cp)
+		crypto_pk_close(job->cp);
+	free(job);
+}
+
+int crypto_job_fd(void)
+{
+	pthread_once(&crypto_job_once, crypto_job_init_once);
+
+	return crypto_job_efd;
+}
+
+void crypto_job_fd_clear(void)
+{
+	uint64_t count;
+
+	/* Fails with EAGAIN if nothing completed */
+	if (crypto_job_efd >= 0)
+		while (read(crypto_job_efd, &count, sizeof(count)) < 0 && errno == EINTR)
+			;
+}
@@ -28,17 +28,27 @@
 struct crypto_hash {
 	enum crypto_algo_hash algo;
 	void (*write)(struct crypto_hash *ch, const unsigned char *buf, size_t len);
+	/* Optional, several buffers in one call */
+	void (*writev)(struct crypto_hash *ch, const struct iovec *iov, int n);
 	unsigned char *(*read)(struct crypto_hash *ch);
+	void (*reset)(struct crypto_hash *ch);
 	void (*close)(struct crypto_hash *ch);
 	size_t (*get_size)(const struct crypto_hash *ch);
 };
 
 struct crypto_pk {
 	enum crypto_algo_pk algo;
+	/* Handles may be shared, see crypto_pk_ref() */
+	unsigned refcount;
 	unsigned char *(*encrypt)(const struct crypto_pk *cp, const unsigned char *buf, size_t len, size_t *clen);
 	unsigned char *(*decrypt)(const struct crypto_pk *cp, const unsigned char *buf, size_t len, size_t *clen);
+	/* Optional, write the result into a buffer of at least modulus size */
+	size_t (*encrypt_into)(const struct crypto_pk *cp, const unsigned char *buf, size_t len, unsigned char *out, size_t outlen);
+	size_t (*decrypt_into)(const struct crypto_pk *cp, const unsigned char *buf, size_t len, unsigned char *out, size_t outlen);
 	unsigned char *(*get_parameter)(const struct crypto_pk *cp, unsigned param, size_t *plen);
 	size_t (*get_nbits)(const struct crypto_pk *cp);
+	/* Optional, builds modulus specific state kept in the handle */
+	bool (*precompute)(struct crypto_pk *cp);
 	void (*close)(struct crypto_pk *cp);
 };
 
@@ -49,6 +59,29 @@ struct crypto_backend {
 	struct crypto_pk *(*pk_genkey)(enum crypto_algo_pk pk, va_list vl);
 };
 
+/*
+ * Precomputed private keys blind each signature with (r^e, r^-1), then
+ * square both for the next one; a fresh r is drawn after this many uses.
+ */
+#define CRYPTO_PK_BLIND_UPDATES 32
+
+/* Built-in SHA-1, impl being "native" or one of "native-{c,ssse3,sha}" */
+bool crypto_sha1_init(const char *impl);
+struct crypto_hash *crypto_sha1_open(void);
+void crypto_sha1_many(const unsigned char *const *bufs, const size_t *lens, size_t n, unsigned char *digests);
+
+/*
+ * Calls fn(arg, i) for i from 0 to n - 1, on the worker threads and the
+ * calling one, returning when all calls did.
+ */
+void crypto_pool_run(void (*fn)(void *arg, size_t i), void *arg, size_t n);
+
+/* getentropy(), or its emulation where libc has none: at most 256 bytes */
+int crypto_getentropy(void *buf, size_t len);
+
+/* The fastest of the compiled in drivers, for crypto.driver "auto" */
+struct crypto_backend *crypto_probe_init(void);
+
 #ifdef ENABLE_CRYPTO_LIBGCRYPT
 struct crypto_backend *crypto_libgcrypt_init(void);
 #else
@@ -67,4 +100,13 @@ static inline struct crypto_backend *crypto_nettle_init(void)
 }
 #endif
 
+#ifdef ENABLE_CRYPTO_OPENSSL
+struct crypto_backend *crypto_openssl_init(void);
+#else
+static inline struct crypto_backend *crypto_openssl_init(void)
+{
+	return NULL;
+}
+#endif
+
 #endif
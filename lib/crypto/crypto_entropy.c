@@ -0,0 +1,124 @@
+/*
+ * libopenemv - a library to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "crypto_backend.h"
+
+#include <pthread.h>
+
+#if defined(HAVE_GETENTROPY)
+#include <unistd.h>
+/* getentropy call is declared in unistd.h */
+#elif defined(linux)
+#include <linux/random.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#if defined SYS_getrandom
+static int getrandom(void *buf, size_t buflen, unsigned int flags)
+{
+	return syscall(SYS_getrandom, buf, buflen, flags);
+}
+#else
+static int getrandom(void *buf, size_t buflen, unsigned int flags)
+{
+	errno = ENOSYS;
+	return -1;
+}
+#endif
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+
+static int urandom_fd = -1;
+static pthread_once_t urandom_once = PTHREAD_ONCE_INIT;
+
+static void urandom_open(void)
+{
+	int fd, old;
+
+	fd = open("/dev/urandom", O_RDONLY);
+	if (fd < 0)
+		return;
+
+	old = fcntl(fd, F_GETFD);
+	if (old != -1)
+		old = fcntl(fd, F_SETFD, old | FD_CLOEXEC);
+	if (old < 0) {
+		close(fd);
+		return;
+	}
+
+	urandom_fd = fd;
+}
+
+static int getentropy_urandom(void *buf, size_t len)
+{
+	int fd;
+	size_t pos;
+
+	pthread_once(&urandom_once, urandom_open);
+	fd = urandom_fd;
+	if (fd < 0)
+		return -1;
+
+	for (pos = 0; pos < len; ) {
+		ssize_t res = read(fd, buf + pos, len - pos);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return res;
+		} else if (res == 0)
+			return -1;
+		else
+			pos += res;
+	}
+
+	return 0;
+}
+
+static int getentropy(void *buf, size_t buflen)
+{
+	int ret;
+
+	if (buflen > 256)
+		goto failure;
+
+	ret = getrandom(buf, buflen, 0);
+	if (ret < 0) {
+		if (errno == ENOSYS)
+			return getentropy_urandom(buf, buflen);
+		return ret;
+	}
+	if (ret == buflen)
+		return 0;
+failure:
+	errno = EIO;
+	return -1;
+}
+#else
+#error Your system is not yet supported. Please add a getentropy function
+#endif
+
+int crypto_getentropy(void *buf, size_t len)
+{
+	return getentropy(buf, len);
+}
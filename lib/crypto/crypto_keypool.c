@@ -0,0 +1,817 @@
+/*
+ * libopenemv - a library to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Pregenerated key pairs. Worker threads keep "crypto.keypool.depth" keys
+ * ready for each configured size and exponent, emptiest kind first.
+ *
+ * Spooled keys live one per file. The file goes away before its key is
+ * handed out, so that no key is ever given twice, even across a crash.
+ * Files are sealed with two keys derived from the master key file: the
+ * key parameters are XORed with HMAC-SHA1(Kenc, nonce || counter) blocks
+ * and HMAC-SHA1(Kmac, header || nonce || ciphertext) is appended.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "openemv/config.h"
+#include "openemv/crypto.h"
+#include "crypto_backend.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CRYPTO_KEYPOOL_MAX_KINDS 16
+#define CRYPTO_KEYPOOL_MAX_THREADS 64
+#define CRYPTO_KEYPOOL_MAX_DEPTH 1024
+/* Seconds before retrying a kind whose generation failed, doubled each time */
+#define CRYPTO_KEYPOOL_BACKOFF 1
+#define CRYPTO_KEYPOOL_MAX_BACKOFF 64
+/* As given to crypto_pk_open_priv() */
+#define CRYPTO_KEYPOOL_PARAMS 8
+#define CRYPTO_KEYPOOL_NONCE 16
+#define CRYPTO_KEYPOOL_MAC 20
+/* Enough for a 4096 bit key */
+#define CRYPTO_KEYPOOL_MAX_FILE 4096
+#define CRYPTO_KEYPOOL_MAX_MASTER 256
+
+static const unsigned char crypto_keypool_magic[4] = { 'O', 'E', 'K', '1' };
+
+struct crypto_keypool_key {
+	struct crypto_keypool_key *next;
+	struct crypto_pk *cp;
+	/* Spool file, NULL if not spooled */
+	char *path;
+};
+
+struct crypto_keypool_kind {
+	unsigned nbits;
+	unsigned exp;
+	unsigned ready;
+	/* Being generated */
+	unsigned pending;
+	/* Seconds to wait after the last failed generation, 0 if it worked */
+	unsigned backoff;
+	time_t retry;
+	struct crypto_keypool_key *keys;
+};
+
+/* Serializes start and stop */
+static pthread_mutex_t crypto_keypool_ctl = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t crypto_keypool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t crypto_keypool_work = PTHREAD_COND_INITIALIZER;
+static struct crypto_keypool_kind crypto_keypool_kinds[CRYPTO_KEYPOOL_MAX_KINDS];
+static unsigned crypto_keypool_nkinds;
+static unsigned crypto_keypool_depth;
+static pthread_t crypto_keypool_threads[CRYPTO_KEYPOOL_MAX_THREADS];
+static unsigned crypto_keypool_nthreads;
+static bool crypto_keypool_running, crypto_keypool_stopping;
+/* Spool directory, NULL if not spooling */
+static char *crypto_keypool_dir;
+static unsigned char crypto_keypool_kenc[CRYPTO_KEYPOOL_MAC];
+static unsigned char crypto_keypool_kmac[CRYPTO_KEYPOOL_MAC];
+
+static bool crypto_keypool_hmac(const unsigned char *key, size_t keylen, const struct iovec *iov, int n, unsigned char *mac)
+{
+	struct crypto_hash *ch;
+	unsigned char pad[64], inner[CRYPTO_KEYPOOL_MAC];
+	size_t i;
+
+	ch = crypto_hash_open(HASH_SHA_1);
+	if (!ch)
+		return false;
+
+	if (keylen > sizeof(pad)) {
+		crypto_hash_write(ch, key, keylen);
+		memcpy(inner, crypto_hash_read(ch), sizeof(inner));
+		crypto_hash_reset(ch);
+		key = inner;
+		keylen = sizeof(inner);
+	}
+
+	for (i = 0; i < sizeof(pad); i++)
+		pad[i] = (i < keylen ? key[i] : 0) ^ 0x36;
+
+	crypto_hash_write(ch, pad, sizeof(pad));
+	crypto_hash_writev(ch, iov, n);
+	memcpy(inner, crypto_hash_read(ch), sizeof(inner));
+
+	for (i = 0; i < sizeof(pad); i++)
+		pad[i] ^= 0x36 ^ 0x5c;
+
+	crypto_hash_reset(ch);
+	crypto_hash_write(ch, pad, sizeof(pad));
+	crypto_hash_write(ch, inner, sizeof(inner));
+	memcpy(mac, crypto_hash_read(ch), CRYPTO_KEYPOOL_MAC);
+	crypto_hash_close(ch);
+
+	memset(pad, 0, sizeof(pad));
+	memset(inner, 0, sizeof(inner));
+
+	return true;
+}
+
+/* Encrypts or decrypts in place */
+static bool crypto_keypool_crypt(const unsigned char *nonce, unsigned char *buf, size_t len)
+{
+	unsigned char ctr[4], block[CRYPTO_KEYPOOL_MAC];
+	struct iovec iov[2] = {
+		{ .iov_base = (void *)nonce, .iov_len = CRYPTO_KEYPOOL_NONCE },
+		{ .iov_base = ctr, .iov_len = sizeof(ctr) },
+	};
+	uint32_t i;
+	size_t pos, j;
+
+	for (i = 0, pos = 0; pos < len; i++, pos += sizeof(block)) {
+		ctr[0] = i >> 24;
+		ctr[1] = i >> 16;
+		ctr[2] = i >> 8;
+		ctr[3] = i;
+		if (!crypto_keypool_hmac(crypto_keypool_kenc, sizeof(crypto_keypool_kenc), iov, 2, block))
+			return false;
+
+		for (j = 0; j < sizeof(block) && pos + j < len; j++)
+			buf[pos + j] ^= block[j];
+	}
+
+	memset(block, 0, sizeof(block));
+
+	return true;
+}
+
+static bool crypto_keypool_write(int fd, const unsigned char *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = write(fd, buf, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return false;
+		buf += ret;
+		len -= ret;
+	}
+
+	return true;
+}
+
+/* Makes a removal from the spool directory durable */
+static void crypto_keypool_sync_dir(char *path)
+{
+	char *slash = strrchr(path, '/');
+	int fd;
+
+	*slash = 0;
+	fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	*slash = '/';
+	if (fd < 0)
+		return;
+
+	fsync(fd);
+	close(fd);
+}
+
+/* Hidden while being written */
+static char *crypto_keypool_path(unsigned nbits, unsigned exp, const unsigned char *nonce, bool tmp)
+{
+	size_t size = strlen(crypto_keypool_dir) + 64;
+	char *path = malloc(size);
+
+	if (!path)
+		return NULL;
+
+	snprintf(path, size, "%s/%s%u-%u-%02x%02x%02x%02x%02x%02x%02x%02x%s",
+			crypto_keypool_dir, tmp ? "." : "", nbits, exp,
+			nonce[0], nonce[1], nonce[2], nonce[3],
+			nonce[4], nonce[5], nonce[6], nonce[7],
+			tmp ? ".tmp" : ".key");
+
+	return path;
+}
+
+/* Returns the spool file name, NULL if the key could not be spooled */
+static char *crypto_keypool_store(const struct crypto_pk *cp, unsigned nbits, unsigned exp)
+{
+	unsigned char buf[CRYPTO_KEYPOOL_MAX_FILE];
+	unsigned char *nonce = buf + sizeof(crypto_keypool_magic);
+	size_t start = sizeof(crypto_keypool_magic) + CRYPTO_KEYPOOL_NONCE;
+	size_t pos = start;
+	struct iovec iov;
+	char *path = NULL, *tmp = NULL;
+	unsigned i;
+	int fd;
+
+	memcpy(buf, crypto_keypool_magic, sizeof(crypto_keypool_magic));
+	if (crypto_getentropy(nonce, CRYPTO_KEYPOOL_NONCE))
+		return NULL;
+
+	for (i = 0; i < CRYPTO_KEYPOOL_PARAMS; i++) {
+		unsigned char *param;
+		size_t plen;
+
+		param = crypto_pk_get_parameter(cp, i, &plen);
+		if (!param)
+			goto out;
+
+		if (pos + 2 + plen + CRYPTO_KEYPOOL_MAC > sizeof(buf)) {
+			memset(param, 0, plen);
+			free(param);
+			goto out;
+		}
+
+		buf[pos++] = plen >> 8;
+		buf[pos++] = plen;
+		memcpy(buf + pos, param, plen);
+		pos += plen;
+
+		memset(param, 0, plen);
+		free(param);
+	}
+
+	if (!crypto_keypool_crypt(nonce, buf + start, pos - start))
+		goto out;
+
+	iov.iov_base = buf;
+	iov.iov_len = pos;
+	if (!crypto_keypool_hmac(crypto_keypool_kmac, sizeof(crypto_keypool_kmac), &iov, 1, buf + pos))
+		goto out;
+	pos += CRYPTO_KEYPOOL_MAC;
+
+	path = crypto_keypool_path(nbits, exp, nonce, false);
+	tmp = crypto_keypool_path(nbits, exp, nonce, true);
+	if (!path || !tmp)
+		goto err;
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (fd < 0)
+		goto err;
+
+	if (!crypto_keypool_write(fd, buf, pos) || fsync(fd)) {
+		close(fd);
+		unlink(tmp);
+		goto err;
+	}
+	close(fd);
+
+	if (rename(tmp, path)) {
+		unlink(tmp);
+		goto err;
+	}
+
+	goto out;
+
+err:
+	free(path);
+	path = NULL;
+out:
+	free(tmp);
+	memset(buf, 0, pos);
+
+	return path;
+}
+
+static struct crypto_pk *crypto_keypool_load(const char *path)
+{
+	unsigned char buf[CRYPTO_KEYPOOL_MAX_FILE + 1], mac[CRYPTO_KEYPOOL_MAC];
+	const unsigned char *nonce = buf + sizeof(crypto_keypool_magic);
+	size_t start = sizeof(crypto_keypool_magic) + CRYPTO_KEYPOOL_NONCE;
+	const unsigned char *params[CRYPTO_KEYPOOL_PARAMS];
+	size_t lens[CRYPTO_KEYPOOL_PARAMS];
+	struct crypto_pk *cp = NULL;
+	struct iovec iov;
+	size_t len = 0, pos;
+	unsigned char diff = 0;
+	ssize_t ret;
+	unsigned i;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	while (len < sizeof(buf)) {
+		ret = read(fd, buf + len, sizeof(buf) - len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+		len += ret;
+	}
+	close(fd);
+
+	if (len > CRYPTO_KEYPOOL_MAX_FILE || len < start + CRYPTO_KEYPOOL_MAC ||
+	    memcmp(buf, crypto_keypool_magic, sizeof(crypto_keypool_magic)))
+		goto out;
+
+	len -= CRYPTO_KEYPOOL_MAC;
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	if (!crypto_keypool_hmac(crypto_keypool_kmac, sizeof(crypto_keypool_kmac), &iov, 1, mac))
+		goto out;
+
+	for (i = 0; i < CRYPTO_KEYPOOL_MAC; i++)
+		diff |= mac[i] ^ buf[len + i];
+	if (diff)
+		goto out;
+
+	if (!crypto_keypool_crypt(nonce, buf + start, len - start))
+		goto out;
+
+	for (i = 0, pos = start; i < CRYPTO_KEYPOOL_PARAMS; i++) {
+		if (pos + 2 > len)
+			goto out;
+		lens[i] = (buf[pos] << 8) | buf[pos + 1];
+		pos += 2;
+		if (pos + lens[i] > len)
+			goto out;
+		params[i] = buf + pos;
+		pos += lens[i];
+	}
+
+	cp = crypto_pk_open_priv(PK_RSA,
+			params[0], lens[0],
+			params[1], lens[1],
+			params[2], lens[2],
+			params[3], lens[3],
+			params[4], lens[4],
+			params[5], lens[5],
+			params[6], lens[6],
+			params[7], lens[7]);
+
+out:
+	memset(buf, 0, sizeof(buf));
+
+	return cp;
+}
+
+static struct crypto_keypool_kind *crypto_keypool_find(unsigned nbits, unsigned exp)
+{
+	unsigned i;
+
+	for (i = 0; i < crypto_keypool_nkinds; i++)
+		if (crypto_keypool_kinds[i].nbits == nbits &&
+		    crypto_keypool_kinds[i].exp == exp)
+			return &crypto_keypool_kinds[i];
+
+	return NULL;
+}
+
+/* Whether a loaded key is of the kind its file name claims */
+static bool crypto_keypool_matches(const struct crypto_pk *cp, const struct crypto_keypool_kind *kind)
+{
+	unsigned char *e;
+	unsigned exp = 0;
+	size_t elen, i;
+
+	if (crypto_pk_get_nbits(cp) != kind->nbits)
+		return false;
+
+	e = crypto_pk_get_parameter(cp, 1, &elen);
+	if (!e)
+		return false;
+
+	for (i = 0; i < elen; i++) {
+		/* Already too large */
+		if (exp > kind->exp >> 8)
+			break;
+		exp = (exp << 8) | e[i];
+	}
+	free(e);
+
+	return i == elen && exp == kind->exp;
+}
+
+static void crypto_keypool_push(struct crypto_keypool_kind *kind, struct crypto_keypool_key *key)
+{
+	key->next = kind->keys;
+	kind->keys = key;
+	kind->ready++;
+}
+
+/* Keys left over from the previous run, up to the pool depth */
+static void crypto_keypool_load_spool(void)
+{
+	struct crypto_keypool_kind *kind;
+	struct crypto_keypool_key *key;
+	struct dirent *de;
+	unsigned nbits, exp;
+	size_t size, nlen;
+	char *path;
+	DIR *dir;
+
+	dir = opendir(crypto_keypool_dir);
+	if (!dir) {
+		if (errno == ENOENT)
+			mkdir(crypto_keypool_dir, 0700);
+		return;
+	}
+
+	size = strlen(crypto_keypool_dir) + 2;
+	while ((de = readdir(dir))) {
+		nlen = strlen(de->d_name);
+		path = malloc(size + nlen);
+		if (!path)
+			break;
+		snprintf(path, size + nlen, "%s/%s", crypto_keypool_dir, de->d_name);
+
+		/* Interrupted stores */
+		if (de->d_name[0] == '.') {
+			if (nlen > 4 && !strcmp(de->d_name + nlen - 4, ".tmp"))
+				unlink(path);
+			free(path);
+			continue;
+		}
+
+		if (nlen < 4 || strcmp(de->d_name + nlen - 4, ".key") ||
+		    sscanf(de->d_name, "%u-%u-", &nbits, &exp) != 2 ||
+		    !(kind = crypto_keypool_find(nbits, exp)) ||
+		    kind->ready >= crypto_keypool_depth) {
+			free(path);
+			continue;
+		}
+
+		key = malloc(sizeof(*key));
+		if (!key) {
+			free(path);
+			break;
+		}
+
+		/* Left in place for a look, but not used */
+		key->cp = crypto_keypool_load(path);
+		if (!key->cp || !crypto_keypool_matches(key->cp, kind)) {
+			fprintf(stderr, "Can not load spooled key %s\n", path);
+			if (key->cp)
+				crypto_pk_close(key->cp);
+			free(key);
+			free(path);
+			continue;
+		}
+
+		key->path = path;
+		crypto_keypool_push(kind, key);
+	}
+
+	closedir(dir);
+}
+
+static bool crypto_keypool_master(const char *fname)
+{
+	static const char enc[] = "openemv keypool encryption";
+	static const char mac[] = "openemv keypool authentication";
+	unsigned char key[CRYPTO_KEYPOOL_MAX_MASTER];
+	struct iovec iov;
+	size_t len = 0;
+	ssize_t ret;
+	bool ok;
+	int fd;
+
+	fd = open(fname, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	while (len < sizeof(key)) {
+		ret = read(fd, key + len, sizeof(key) - len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+		len += ret;
+	}
+	close(fd);
+
+	/* Not much of a key otherwise */
+	if (len < 16) {
+		memset(key, 0, sizeof(key));
+		return false;
+	}
+
+	iov.iov_base = (void *)enc;
+	iov.iov_len = sizeof(enc) - 1;
+	ok = crypto_keypool_hmac(key, len, &iov, 1, crypto_keypool_kenc);
+
+	iov.iov_base = (void *)mac;
+	iov.iov_len = sizeof(mac) - 1;
+	ok = ok && crypto_keypool_hmac(key, len, &iov, 1, crypto_keypool_kmac);
+
+	memset(key, 0, sizeof(key));
+
+	return ok;
+}
+
+/* "1024/3 1152/3,1984/65537" */
+static bool crypto_keypool_parse(const char *keys)
+{
+	struct crypto_keypool_kind *kind;
+	unsigned long nbits, exp;
+	char *end;
+
+	while (true) {
+		while (*keys == ' ' || *keys == ',')
+			keys++;
+		if (!*keys)
+			break;
+
+		nbits = strtoul(keys, &end, 10);
+		if (end == keys || *end != '/')
+			return false;
+
+		keys = end + 1;
+		exp = strtoul(keys, &end, 10);
+		if (end == keys || !nbits || !exp)
+			return false;
+		keys = end;
+
+		if (crypto_keypool_find(nbits, exp))
+			continue;
+
+		if (crypto_keypool_nkinds == CRYPTO_KEYPOOL_MAX_KINDS)
+			return false;
+
+		kind = &crypto_keypool_kinds[crypto_keypool_nkinds++];
+		memset(kind, 0, sizeof(*kind));
+		kind->nbits = nbits;
+		kind->exp = exp;
+	}
+
+	return crypto_keypool_nkinds != 0;
+}
+
+/*
+ * The kind furthest from being full, if any needs a key. Kinds backing
+ * off are left out, *wake being set to the earliest retry, or 0.
+ */
+static struct crypto_keypool_kind *crypto_keypool_wanted(time_t now, time_t *wake)
+{
+	struct crypto_keypool_kind *kind, *best = NULL;
+	unsigned i;
+
+	*wake = 0;
+	for (i = 0; i < crypto_keypool_nkinds; i++) {
+		kind = &crypto_keypool_kinds[i];
+		if (kind->ready + kind->pending >= crypto_keypool_depth)
+			continue;
+
+		if (kind->backoff && kind->retry > now) {
+			if (!*wake || kind->retry < *wake)
+				*wake = kind->retry;
+			continue;
+		}
+
+		if (!best || kind->ready + kind->pending < best->ready + best->pending)
+			best = kind;
+	}
+
+	return best;
+}
+
+static void *crypto_keypool_worker(void *data)
+{
+	struct crypto_keypool_kind *kind;
+	struct crypto_keypool_key *key;
+	struct timespec ts;
+	time_t wake;
+
+	pthread_mutex_lock(&crypto_keypool_lock);
+	while (!crypto_keypool_stopping) {
+		kind = crypto_keypool_wanted(time(NULL), &wake);
+		if (!kind) {
+			if (wake) {
+				ts.tv_sec = wake;
+				ts.tv_nsec = 0;
+				pthread_cond_timedwait(&crypto_keypool_work, &crypto_keypool_lock, &ts);
+			} else
+				pthread_cond_wait(&crypto_keypool_work, &crypto_keypool_lock);
+			continue;
+		}
+
+		kind->pending++;
+		pthread_mutex_unlock(&crypto_keypool_lock);
+
+		key = malloc(sizeof(*key));
+		if (key) {
+			key->cp = crypto_pk_genkey(PK_RSA, 0, kind->nbits, kind->exp);
+			if (!key->cp) {
+				free(key);
+				key = NULL;
+			}
+		}
+
+		/* Unspooled keys are still good for this run */
+		if (key)
+			key->path = crypto_keypool_dir ?
+				crypto_keypool_store(key->cp, kind->nbits, kind->exp) :
+				NULL;
+
+		pthread_mutex_lock(&crypto_keypool_lock);
+		kind->pending--;
+		if (key) {
+			crypto_keypool_push(kind, key);
+			kind->backoff = 0;
+		} else {
+			if (!kind->backoff)
+				kind->backoff = CRYPTO_KEYPOOL_BACKOFF;
+			else if (kind->backoff < CRYPTO_KEYPOOL_MAX_BACKOFF)
+				kind->backoff *= 2;
+			kind->retry = time(NULL) + kind->backoff;
+		}
+	}
+	pthread_mutex_unlock(&crypto_keypool_lock);
+
+	return NULL;
+}
+
+/* Keys in memory only, spool files stay */
+static void crypto_keypool_free(void)
+{
+	struct crypto_keypool_key *key;
+	unsigned i;
+
+	for (i = 0; i < crypto_keypool_nkinds; i++) {
+		while ((key = crypto_keypool_kinds[i].keys)) {
+			crypto_keypool_kinds[i].keys = key->next;
+			crypto_pk_close(key->cp);
+			free(key->path);
+			free(key);
+		}
+	}
+	crypto_keypool_nkinds = 0;
+
+	free(crypto_keypool_dir);
+	crypto_keypool_dir = NULL;
+	memset(crypto_keypool_kenc, 0, sizeof(crypto_keypool_kenc));
+	memset(crypto_keypool_kmac, 0, sizeof(crypto_keypool_kmac));
+}
+
+bool crypto_keypool_start(void)
+{
+	const char *keys, *spool, *master;
+	int depth, threads;
+
+	pthread_mutex_lock(&crypto_keypool_ctl);
+	if (crypto_keypool_running) {
+		pthread_mutex_unlock(&crypto_keypool_ctl);
+		return true;
+	}
+
+	keys = openemv_config_get("crypto.keypool.keys");
+	if (!keys || !crypto_keypool_parse(keys))
+		goto err;
+
+	depth = openemv_config_get_int("crypto.keypool.depth", 8);
+	if (depth < 1) {
+		fprintf(stderr, "Key pool depth must be positive\n");
+		goto err;
+	}
+	if (depth > CRYPTO_KEYPOOL_MAX_DEPTH)
+		depth = CRYPTO_KEYPOOL_MAX_DEPTH;
+	crypto_keypool_depth = depth;
+
+	spool = openemv_config_get("crypto.keypool.spool");
+	master = openemv_config_get("crypto.keypool.master_key");
+	if (spool) {
+		if (!master || !crypto_keypool_master(master)) {
+			fprintf(stderr, "Key pool spool needs a master key file\n");
+			goto err;
+		}
+
+		crypto_keypool_dir = strdup(spool);
+		if (!crypto_keypool_dir)
+			goto err;
+
+		crypto_keypool_load_spool();
+	}
+
+	threads = openemv_config_get_int("crypto.keypool.threads", 1);
+	if (threads < 1)
+		threads = 1;
+	if (threads > CRYPTO_KEYPOOL_MAX_THREADS)
+		threads = CRYPTO_KEYPOOL_MAX_THREADS;
+
+	for (crypto_keypool_nthreads = 0; crypto_keypool_nthreads < threads; crypto_keypool_nthreads++)
+		if (pthread_create(&crypto_keypool_threads[crypto_keypool_nthreads], NULL, crypto_keypool_worker, NULL))
+			break;
+	if (!crypto_keypool_nthreads)
+		goto err;
+
+	pthread_mutex_lock(&crypto_keypool_lock);
+	crypto_keypool_running = true;
+	pthread_mutex_unlock(&crypto_keypool_lock);
+
+	pthread_mutex_unlock(&crypto_keypool_ctl);
+
+	return true;
+
+err:
+	crypto_keypool_free();
+	pthread_mutex_unlock(&crypto_keypool_ctl);
+
+	return false;
+}
+
+/* Waits for keys being generated, which are spooled as usual */
+void crypto_keypool_stop(void)
+{
+	unsigned i;
+
+	pthread_mutex_lock(&crypto_keypool_ctl);
+	if (!crypto_keypool_running) {
+		pthread_mutex_unlock(&crypto_keypool_ctl);
+		return;
+	}
+
+	pthread_mutex_lock(&crypto_keypool_lock);
+	crypto_keypool_stopping = true;
+	pthread_cond_broadcast(&crypto_keypool_work);
+	pthread_mutex_unlock(&crypto_keypool_lock);
+
+	for (i = 0; i < crypto_keypool_nthreads; i++)
+		pthread_join(crypto_keypool_threads[i], NULL);
+	crypto_keypool_nthreads = 0;
+
+	pthread_mutex_lock(&crypto_keypool_lock);
+	crypto_keypool_running = false;
+	crypto_keypool_stopping = false;
+	crypto_keypool_free();
+	pthread_mutex_unlock(&crypto_keypool_lock);
+
+	pthread_mutex_unlock(&crypto_keypool_ctl);
+}
+
+struct crypto_pk *crypto_keypool_get(enum crypto_algo_pk pk, unsigned nbits, unsigned exp)
+{
+	struct crypto_keypool_kind *kind;
+	struct crypto_keypool_key *key;
+	struct crypto_pk *cp;
+
+	do {
+		key = NULL;
+		pthread_mutex_lock(&crypto_keypool_lock);
+		kind = crypto_keypool_running && pk == PK_RSA ? crypto_keypool_find(nbits, exp) : NULL;
+		if (kind && kind->keys) {
+			key = kind->keys;
+			kind->keys = key->next;
+			kind->ready--;
+			pthread_cond_signal(&crypto_keypool_work);
+		}
+		pthread_mutex_unlock(&crypto_keypool_lock);
+
+		if (!key)
+			return crypto_pk_genkey(pk, 0, nbits, exp);
+
+		cp = key->cp;
+		if (key->path) {
+			/*
+			 * Still spooled, so it could come back after a restart.
+			 * A file already gone was taken by another process
+			 * sharing the spool, or removed: the key is dropped.
+			 */
+			if (unlink(key->path)) {
+				crypto_pk_close(cp);
+				cp = NULL;
+			} else
+				crypto_keypool_sync_dir(key->path);
+			free(key->path);
+		}
+		free(key);
+	} while (!cp);
+
+	return cp;
+}
+
+unsigned crypto_keypool_ready(enum crypto_algo_pk pk, unsigned nbits, unsigned exp)
+{
+	struct crypto_keypool_kind *kind;
+	unsigned ready = 0;
+
+	pthread_mutex_lock(&crypto_keypool_lock);
+	kind = crypto_keypool_running && pk == PK_RSA ? crypto_keypool_find(nbits, exp) : NULL;
+	if (kind)
+		ready = kind->ready;
+	pthread_mutex_unlock(&crypto_keypool_lock);
+
+	return ready;
+}
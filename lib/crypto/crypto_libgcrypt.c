@@ -20,6 +20,7 @@
 #include "openemv/crypto.h"
 #include "crypto_backend.h"
 
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 
@@ -54,6 +55,13 @@ static unsigned char *crypto_hash_libgcrypt_read(struct crypto_hash *_ch)
 	return gcry_md_read(ch->md, 0);
 }
 
+static void crypto_hash_libgcrypt_reset(struct crypto_hash *_ch)
+{
+	struct crypto_hash_libgcrypt *ch = container_of(_ch, struct crypto_hash_libgcrypt, ch);
+
+	gcry_md_reset(ch->md);
+}
+
 static size_t crypto_hash_libgcrypt_get_size(const struct crypto_hash *ch)
 {
 	int algo = GCRY_MD_NONE;
@@ -84,7 +92,9 @@ static struct crypto_hash *crypto_hash_libgcrypt_open(enum crypto_algo_hash hash
 	}
 
 	ch->ch.write = crypto_hash_libgcrypt_write;
+	ch->ch.writev = NULL;
 	ch->ch.read = crypto_hash_libgcrypt_read;
+	ch->ch.reset = crypto_hash_libgcrypt_reset;
 	ch->ch.close = crypto_hash_libgcrypt_close;
 	ch->ch.get_size = crypto_hash_libgcrypt_get_size;
 
@@ -94,6 +104,14 @@ static struct crypto_hash *crypto_hash_libgcrypt_open(enum crypto_algo_hash hash
 struct crypto_pk_libgcrypt {
 	struct crypto_pk cp;
 	gcry_sexp_t pk;
+	/* Public key parameters, see crypto_pk_libgcrypt_precompute() */
+	gcry_mpi_t n, e;
+	size_t keysize;
+	/* Private key parameters, see crypto_pk_libgcrypt_sign_precompute() */
+	gcry_mpi_t p, q, dp, dq, u;
+	pthread_mutex_t blind_lock;
+	gcry_mpi_t blind, unblind;
+	unsigned blind_uses;
 };
 
 static struct crypto_pk *crypto_pk_libgcrypt_open_rsa(va_list vl)
@@ -115,6 +133,9 @@ static struct crypto_pk *crypto_pk_libgcrypt_open_rsa(va_list vl)
 		return NULL;
 	}
 
+	cp->n = cp->e = NULL;
+	cp->p = NULL;
+
 	return &cp->cp;
 }
 
@@ -154,10 +175,10 @@ static struct crypto_pk *crypto_pk_libgcrypt_open_priv_rsa(va_list vl)
 	if (err)
 		goto err_inv;
 
-	if (gcry_mpi_cmp (pmpi, qmpi) > 0) {
+	/* libgcrypt wants p < q and u = p^-1 mod q */
+	if (gcry_mpi_cmp (pmpi, qmpi) > 0)
 		gcry_mpi_swap (pmpi, qmpi);
-		gcry_mpi_invm (invmpi, pmpi, qmpi);
-	}
+	gcry_mpi_invm (invmpi, pmpi, qmpi);
 
 	err = gcry_sexp_build(&cp->pk, NULL, "(private-key (rsa (n %b) (e %b) (d %b) (p %M) (q %M) (u %M)))",
 			modlen, mod, explen, exp, dlen, d,
@@ -173,6 +194,9 @@ static struct crypto_pk *crypto_pk_libgcrypt_open_priv_rsa(va_list vl)
 	gcry_mpi_release(qmpi);
 	gcry_mpi_release(pmpi);
 
+	cp->n = cp->e = NULL;
+	cp->p = NULL;
+
 	return &cp->cp;
 
 err_test:
@@ -224,6 +248,9 @@ static struct crypto_pk *crypto_pk_libgcrypt_genkey_rsa(va_list vl)
 		return NULL;
 	}
 
+	cp->n = cp->e = NULL;
+	cp->p = NULL;
+
 	return &cp->cp;
 }
 
@@ -232,19 +259,209 @@ static void crypto_pk_libgcrypt_close(struct crypto_pk *_cp)
 	struct crypto_pk_libgcrypt *cp = container_of(_cp, struct crypto_pk_libgcrypt, cp);
 
 	gcry_sexp_release(cp->pk);
+	gcry_mpi_release(cp->n);
+	gcry_mpi_release(cp->e);
+	if (cp->p) {
+		gcry_mpi_release(cp->p);
+		gcry_mpi_release(cp->q);
+		gcry_mpi_release(cp->dp);
+		gcry_mpi_release(cp->dq);
+		gcry_mpi_release(cp->u);
+		gcry_mpi_release(cp->blind);
+		gcry_mpi_release(cp->unblind);
+		pthread_mutex_destroy(&cp->blind_lock);
+	}
 	free(cp);
 }
 
-static unsigned char *crypto_pk_libgcrypt_encrypt(const struct crypto_pk *_cp, const unsigned char *buf, size_t len, size_t *clen)
+static gcry_mpi_t crypto_pk_libgcrypt_get_mpi(gcry_sexp_t pk, const char *name)
+{
+	gcry_sexp_t psexp;
+	gcry_mpi_t tmpi;
+
+	psexp = gcry_sexp_find_token(pk, name, 1);
+	if (!psexp)
+		return NULL;
+
+	tmpi = gcry_sexp_nth_mpi(psexp, 1, GCRYMPI_FMT_USG);
+	gcry_sexp_release(psexp);
+
+	return tmpi;
+}
+
+/* The same, for private key parameters: moved to secure memory */
+static gcry_mpi_t crypto_pk_libgcrypt_get_secret(gcry_sexp_t pk, const char *name)
+{
+	gcry_mpi_t tmpi = crypto_pk_libgcrypt_get_mpi(pk, name);
+
+	if (tmpi)
+		gcry_mpi_set_flag(tmpi, GCRYMPI_FLAG_SECURE);
+
+	return tmpi;
+}
+
+/* Draws r, keeping r^e and r^-1 mod n */
+static void crypto_pk_libgcrypt_blind_new(struct crypto_pk_libgcrypt *cp)
+{
+	unsigned nbits = gcry_mpi_get_nbits(cp->n);
+
+	do {
+		gcry_mpi_randomize(cp->blind, nbits, GCRY_STRONG_RANDOM);
+		gcry_mpi_mod(cp->blind, cp->blind, cp->n);
+	} while (!gcry_mpi_invm(cp->unblind, cp->blind, cp->n));
+
+	gcry_mpi_powm(cp->blind, cp->blind, cp->e, cp->n);
+	cp->blind_uses = 0;
+}
+
+/*
+ * gcry_pk_decrypt() parses the key S-expression and sets up blinding for
+ * every call. Keep the CRT parameters as MPIs instead, with libgcrypt's
+ * convention of p < q and u = p^-1 mod q.
+ */
+static bool crypto_pk_libgcrypt_sign_precompute(struct crypto_pk_libgcrypt *cp)
+{
+	gcry_mpi_t d, t;
+
+	/* Public keys have nothing more to keep */
+	d = crypto_pk_libgcrypt_get_secret(cp->pk, "d");
+	if (!d)
+		return true;
+
+	/* Everything derived from the private key lives in secure memory */
+	cp->p = crypto_pk_libgcrypt_get_secret(cp->pk, "p");
+	cp->q = crypto_pk_libgcrypt_get_secret(cp->pk, "q");
+	cp->u = crypto_pk_libgcrypt_get_secret(cp->pk, "u");
+	cp->dp = gcry_mpi_snew(0);
+	cp->dq = gcry_mpi_snew(0);
+	cp->blind = gcry_mpi_snew(0);
+	cp->unblind = gcry_mpi_snew(0);
+	t = gcry_mpi_snew(0);
+
+	if (cp->p && cp->q && cp->u) {
+		gcry_mpi_sub_ui(t, cp->p, 1);
+		gcry_mpi_mod(cp->dp, d, t);
+		gcry_mpi_sub_ui(t, cp->q, 1);
+		gcry_mpi_mod(cp->dq, d, t);
+	}
+	gcry_mpi_release(t);
+	gcry_mpi_release(d);
+
+	if (!cp->p || !cp->q || !cp->u || pthread_mutex_init(&cp->blind_lock, NULL)) {
+		gcry_mpi_release(cp->p);
+		gcry_mpi_release(cp->q);
+		gcry_mpi_release(cp->u);
+		gcry_mpi_release(cp->dp);
+		gcry_mpi_release(cp->dq);
+		gcry_mpi_release(cp->blind);
+		gcry_mpi_release(cp->unblind);
+		cp->p = NULL;
+		return false;
+	}
+
+	crypto_pk_libgcrypt_blind_new(cp);
+
+	return true;
+}
+
+/*
+ * libgcrypt has no way to keep reduction state with a key, and its
+ * gcry_pk_encrypt() builds and parses S-expressions around every modular
+ * exponentiation. Keep the parameters at hand instead, so that encryption
+ * becomes a single gcry_mpi_powm().
+ */
+static bool crypto_pk_libgcrypt_precompute(struct crypto_pk *_cp)
+{
+	struct crypto_pk_libgcrypt *cp = container_of(_cp, struct crypto_pk_libgcrypt, cp);
+
+	if (cp->n)
+		return true;
+
+	/* XXX: RSA-only! */
+	cp->e = crypto_pk_libgcrypt_get_mpi(cp->pk, "e");
+	if (!cp->e)
+		return false;
+
+	cp->n = crypto_pk_libgcrypt_get_mpi(cp->pk, "n");
+	if (!cp->n) {
+		gcry_mpi_release(cp->e);
+		cp->e = NULL;
+		return false;
+	}
+
+	cp->keysize = (gcry_mpi_get_nbits(cp->n) + 7) / 8;
+
+	return crypto_pk_libgcrypt_sign_precompute(cp);
+}
+
+static gcry_mpi_t crypto_pk_libgcrypt_powm(const struct crypto_pk_libgcrypt *cp, const unsigned char *buf, size_t len)
+{
+	gcry_error_t err;
+	gcry_mpi_t tmpi;
+
+	err = gcry_mpi_scan(&tmpi, GCRYMPI_FMT_USG, buf, len, NULL);
+	if (err) {
+		fprintf(stderr, "LibGCrypt error %s/%s\n",
+				gcry_strsource (err),
+				gcry_strerror (err));
+		return NULL;
+	}
+
+	gcry_mpi_powm(tmpi, tmpi, cp->e, cp->n);
+
+	return tmpi;
+}
+
+static size_t crypto_pk_libgcrypt_keysize(const struct crypto_pk_libgcrypt *cp)
+{
+	if (cp->n)
+		return cp->keysize;
+
+	return (gcry_pk_get_nbits(cp->pk) + 7) / 8;
+}
+
+/* Stores the value right aligned in keysize bytes and releases it */
+static size_t crypto_pk_libgcrypt_put_mpi(gcry_mpi_t tmpi, unsigned char *out, size_t keysize)
+{
+	gcry_error_t err;
+	size_t templen;
+
+	err = gcry_mpi_print(GCRYMPI_FMT_USG, NULL, keysize, &templen, tmpi);
+	if (!err && templen > keysize)
+		err = gcry_error(GPG_ERR_TOO_SHORT);
+	if (!err)
+		err = gcry_mpi_print(GCRYMPI_FMT_USG, out + keysize - templen, templen, &templen, tmpi);
+	gcry_mpi_release(tmpi);
+	if (err) {
+		fprintf(stderr, "LibGCrypt error %s/%s\n",
+				gcry_strsource (err),
+				gcry_strerror (err));
+		return 0;
+	}
+	memset(out, 0, keysize - templen);
+
+	return keysize;
+}
+
+static size_t crypto_pk_libgcrypt_encrypt_into(const struct crypto_pk *_cp, const unsigned char *buf, size_t len, unsigned char *out, size_t outlen)
 {
 	struct crypto_pk_libgcrypt *cp = container_of(_cp, struct crypto_pk_libgcrypt, cp);
 	gcry_error_t err;
 	int blen = len;
 	gcry_sexp_t dsexp, esexp, asexp;
 	gcry_mpi_t tmpi;
-	size_t templen;
-	size_t keysize;
-	unsigned char *result;
+	size_t keysize = crypto_pk_libgcrypt_keysize(cp);
+
+	if (outlen < keysize)
+		return 0;
+
+	if (cp->n) {
+		tmpi = crypto_pk_libgcrypt_powm(cp, buf, len);
+		if (!tmpi)
+			return 0;
+
+		return crypto_pk_libgcrypt_put_mpi(tmpi, out, keysize);
+	}
 
 	err = gcry_sexp_build(&dsexp, NULL, "(data (flags raw) (value %b))",
 			blen, buf);
@@ -252,7 +469,7 @@ static unsigned char *crypto_pk_libgcrypt_encrypt(const struct crypto_pk *_cp, c
 		fprintf(stderr, "LibGCrypt error %s/%s\n",
 				gcry_strsource (err),
 				gcry_strerror (err));
-		return NULL;
+		return 0;
 	}
 
 	err = gcry_pk_encrypt(&esexp, dsexp, cp->pk);
@@ -261,63 +478,125 @@ static unsigned char *crypto_pk_libgcrypt_encrypt(const struct crypto_pk *_cp, c
 		fprintf(stderr, "LibGCrypt error %s/%s\n",
 				gcry_strsource (err),
 				gcry_strerror (err));
-		return NULL;
+		return 0;
 	}
 
 	asexp = gcry_sexp_find_token(esexp, "a", 1);
 	gcry_sexp_release(esexp);
 	if (!asexp)
-		return NULL;
+		return 0;
 
 	tmpi = gcry_sexp_nth_mpi(asexp, 1, GCRYMPI_FMT_USG);
 	gcry_sexp_release(asexp);
 	if (!tmpi)
-		return NULL;
+		return 0;
+
+	return crypto_pk_libgcrypt_put_mpi(tmpi, out, keysize);
+}
+
+static unsigned char *crypto_pk_libgcrypt_encrypt(const struct crypto_pk *_cp, const unsigned char *buf, size_t len, size_t *clen)
+{
+	struct crypto_pk_libgcrypt *cp = container_of(_cp, struct crypto_pk_libgcrypt, cp);
+	size_t keysize = crypto_pk_libgcrypt_keysize(cp);
+	unsigned char *result;
 
-	keysize = (gcry_pk_get_nbits(cp->pk) + 7) / 8;
 	result = malloc(keysize);
-	if (!result) {
-		gcry_mpi_release(tmpi);
+	if (!result)
 		return NULL;
-	}
 
-	err = gcry_mpi_print(GCRYMPI_FMT_USG, NULL, keysize, &templen, tmpi);
-	if (err) {
-		fprintf(stderr, "LibGCrypt error %s/%s\n",
-				gcry_strsource (err),
-				gcry_strerror (err));
-		gcry_mpi_release(tmpi);
+	*clen = crypto_pk_libgcrypt_encrypt_into(_cp, buf, len, result, keysize);
+	if (!*clen) {
 		free(result);
 		return NULL;
 	}
 
-	err = gcry_mpi_print(GCRYMPI_FMT_USG, result + keysize - templen, templen, &templen, tmpi);
+	return result;
+}
+
+/* Takes the current blinding pair and moves on to the next one */
+static void crypto_pk_libgcrypt_blind_get(struct crypto_pk_libgcrypt *cp, gcry_mpi_t blind, gcry_mpi_t unblind)
+{
+	pthread_mutex_lock(&cp->blind_lock);
+	if (cp->blind_uses == CRYPTO_PK_BLIND_UPDATES)
+		crypto_pk_libgcrypt_blind_new(cp);
+
+	gcry_mpi_set(blind, cp->blind);
+	gcry_mpi_set(unblind, cp->unblind);
+	gcry_mpi_mulm(cp->blind, cp->blind, cp->blind, cp->n);
+	gcry_mpi_mulm(cp->unblind, cp->unblind, cp->unblind, cp->n);
+	cp->blind_uses++;
+	pthread_mutex_unlock(&cp->blind_lock);
+}
+
+static size_t crypto_pk_libgcrypt_sign_into(struct crypto_pk_libgcrypt *cp, const unsigned char *buf, size_t len, unsigned char *out)
+{
+	gcry_mpi_t c, m1, m2, blind, unblind;
+	gcry_error_t err;
+	size_t ret = 0;
+
+	err = gcry_mpi_scan(&c, GCRYMPI_FMT_USG, buf, len, NULL);
 	if (err) {
 		fprintf(stderr, "LibGCrypt error %s/%s\n",
 				gcry_strsource (err),
 				gcry_strerror (err));
-		gcry_mpi_release(tmpi);
-		free(result);
-		return NULL;
+		return 0;
 	}
-	memset(result, 0, keysize - templen);
 
-	*clen = keysize;
-	gcry_mpi_release(tmpi);
+	if (gcry_mpi_cmp(c, cp->n) >= 0) {
+		gcry_mpi_release(c);
+		return 0;
+	}
 
-	return result;
+	m1 = gcry_mpi_snew(0);
+	m2 = gcry_mpi_snew(0);
+	blind = gcry_mpi_snew(0);
+	unblind = gcry_mpi_snew(0);
+
+	crypto_pk_libgcrypt_blind_get(cp, blind, unblind);
+	gcry_mpi_mulm(blind, c, blind, cp->n);
+
+	/* m1 = c^dp mod p, m2 = c^dq mod q, m = m1 + p * (u * (m2 - m1) mod q) */
+	gcry_mpi_mod(m1, blind, cp->p);
+	gcry_mpi_powm(m1, m1, cp->dp, cp->p);
+	gcry_mpi_mod(m2, blind, cp->q);
+	gcry_mpi_powm(m2, m2, cp->dq, cp->q);
+	gcry_mpi_subm(m2, m2, m1, cp->q);
+	gcry_mpi_mulm(m2, m2, cp->u, cp->q);
+	gcry_mpi_mul(m2, m2, cp->p);
+	gcry_mpi_add(m1, m1, m2);
+
+	gcry_mpi_mulm(m1, m1, unblind, cp->n);
+
+	/* A fault in either half would give away a factor of n */
+	gcry_mpi_powm(m2, m1, cp->e, cp->n);
+	if (!gcry_mpi_cmp(m2, c)) {
+		ret = crypto_pk_libgcrypt_put_mpi(m1, out, cp->keysize);
+		m1 = NULL;
+	}
+
+	gcry_mpi_release(unblind);
+	gcry_mpi_release(blind);
+	gcry_mpi_release(m2);
+	gcry_mpi_release(m1);
+	gcry_mpi_release(c);
+
+	return ret;
 }
 
-static unsigned char *crypto_pk_libgcrypt_decrypt(const struct crypto_pk *_cp, const unsigned char *buf, size_t len, size_t *clen)
+static size_t crypto_pk_libgcrypt_decrypt_into(const struct crypto_pk *_cp, const unsigned char *buf, size_t len, unsigned char *out, size_t outlen)
 {
 	struct crypto_pk_libgcrypt *cp = container_of(_cp, struct crypto_pk_libgcrypt, cp);
 	gcry_error_t err;
 	int blen = len;
 	gcry_sexp_t esexp, dsexp;
 	gcry_mpi_t tmpi;
-	size_t templen;
-	size_t keysize;
-	unsigned char *result;
+	size_t keysize = crypto_pk_libgcrypt_keysize(cp);
+
+	if (outlen < keysize)
+		return 0;
+
+	if (cp->p)
+		return crypto_pk_libgcrypt_sign_into(cp, buf, len, out);
 
 	/* XXX: RSA-only! */
 	err = gcry_sexp_build(&esexp, NULL, "(enc-val (flags) (rsa (a %b)))",
@@ -326,7 +605,7 @@ static unsigned char *crypto_pk_libgcrypt_decrypt(const struct crypto_pk *_cp, c
 		fprintf(stderr, "LibGCrypt error %s/%s\n",
 				gcry_strsource (err),
 				gcry_strerror (err));
-		return NULL;
+		return 0;
 	}
 
 	err = gcry_pk_decrypt(&dsexp, esexp, cp->pk);
@@ -335,44 +614,32 @@ static unsigned char *crypto_pk_libgcrypt_decrypt(const struct crypto_pk *_cp, c
 		fprintf(stderr, "LibGCrypt error %s/%s\n",
 				gcry_strsource (err),
 				gcry_strerror (err));
-		return NULL;
+		return 0;
 	}
 
 	tmpi = gcry_sexp_nth_mpi(dsexp, 1, GCRYMPI_FMT_USG);
 	gcry_sexp_release(dsexp);
 	if (!tmpi)
-		return NULL;
+		return 0;
 
-	keysize = (gcry_pk_get_nbits(cp->pk) + 7) / 8;
-	result = malloc(keysize);
-	if (!result) {
-		gcry_mpi_release(tmpi);
-		return NULL;
-	}
+	return crypto_pk_libgcrypt_put_mpi(tmpi, out, keysize);
+}
 
-	err = gcry_mpi_print(GCRYMPI_FMT_USG, NULL, keysize, &templen, tmpi);
-	if (err) {
-		fprintf(stderr, "LibGCrypt error %s/%s\n",
-				gcry_strsource (err),
-				gcry_strerror (err));
-		gcry_mpi_release(tmpi);
-		free(result);
+static unsigned char *crypto_pk_libgcrypt_decrypt(const struct crypto_pk *_cp, const unsigned char *buf, size_t len, size_t *clen)
+{
+	struct crypto_pk_libgcrypt *cp = container_of(_cp, struct crypto_pk_libgcrypt, cp);
+	size_t keysize = crypto_pk_libgcrypt_keysize(cp);
+	unsigned char *result;
+
+	result = malloc(keysize);
+	if (!result)
 		return NULL;
-	}
 
-	err = gcry_mpi_print(GCRYMPI_FMT_USG, result + keysize - templen, templen, &templen, tmpi);
-	if (err) {
-		fprintf(stderr, "LibGCrypt error %s/%s\n",
-				gcry_strsource (err),
-				gcry_strerror (err));
-		gcry_mpi_release(tmpi);
+	*clen = crypto_pk_libgcrypt_decrypt_into(_cp, buf, len, result, keysize);
+	if (!*clen) {
 		free(result);
 		return NULL;
 	}
-	memset(result, 0, keysize - templen);
-
-	*clen = keysize;
-	gcry_mpi_release(tmpi);
 
 	return result;
 }
@@ -384,30 +651,69 @@ static size_t crypto_pk_libgcrypt_get_nbits(const struct crypto_pk *_cp)
 	return gcry_pk_get_nbits(cp->pk);
 }
 
+/* d mod (prime - 1) */
+static gcry_mpi_t crypto_pk_libgcrypt_get_crt_exp(gcry_sexp_t pk, const char *prime)
+{
+	gcry_mpi_t d, p;
+
+	d = crypto_pk_libgcrypt_get_secret(pk, "d");
+	if (!d)
+		return NULL;
+
+	p = crypto_pk_libgcrypt_get_secret(pk, prime);
+	if (!p) {
+		gcry_mpi_release(d);
+		return NULL;
+	}
+
+	gcry_mpi_sub_ui(p, p, 1);
+	gcry_mpi_mod(d, d, p);
+	gcry_mpi_release(p);
+
+	return d;
+}
+
 static unsigned char *crypto_pk_libgcrypt_get_parameter(const struct crypto_pk *_cp, unsigned param, size_t *plen)
 {
 	struct crypto_pk_libgcrypt *cp = container_of(_cp, struct crypto_pk_libgcrypt, cp);
 	gcry_error_t err;
-	gcry_sexp_t psexp;
 	gcry_mpi_t tmpi;
 	size_t parameter_size;
 	unsigned char *result;
-	const char *name;
 
-	/* XXX: RSA-only! */
-	if (param == 0)
-		name = "n";
-	else if (param == 1)
-		name = "e";
-	else
-		return NULL;
-
-	psexp = gcry_sexp_find_token(cp->pk, name, 1);
-	if (!psexp)
+	/*
+	 * XXX: RSA-only! The private ones are given the other way round,
+	 * libgcrypt keeping p < q and u = p^-1 mod q.
+	 */
+	switch (param) {
+	case 0:
+		tmpi = crypto_pk_libgcrypt_get_mpi(cp->pk, "n");
+		break;
+	case 1:
+		tmpi = crypto_pk_libgcrypt_get_mpi(cp->pk, "e");
+		break;
+	case 2:
+		tmpi = crypto_pk_libgcrypt_get_secret(cp->pk, "d");
+		break;
+	case 3:
+		tmpi = crypto_pk_libgcrypt_get_secret(cp->pk, "q");
+		break;
+	case 4:
+		tmpi = crypto_pk_libgcrypt_get_secret(cp->pk, "p");
+		break;
+	case 5:
+		tmpi = crypto_pk_libgcrypt_get_crt_exp(cp->pk, "q");
+		break;
+	case 6:
+		tmpi = crypto_pk_libgcrypt_get_crt_exp(cp->pk, "p");
+		break;
+	case 7:
+		tmpi = crypto_pk_libgcrypt_get_secret(cp->pk, "u");
+		break;
+	default:
 		return NULL;
+	}
 
-	tmpi = gcry_sexp_nth_mpi(psexp, 1, GCRYMPI_FMT_USG);
-	gcry_sexp_release(psexp);
 	if (!tmpi)
 		return NULL;
 
@@ -444,7 +750,11 @@ static struct crypto_pk *crypto_pk_libgcrypt_open(enum crypto_algo_pk pk, va_lis
 		return NULL;
 
 	cp->close = crypto_pk_libgcrypt_close;
+	cp->precompute = crypto_pk_libgcrypt_precompute;
 	cp->encrypt = crypto_pk_libgcrypt_encrypt;
+	cp->encrypt_into = crypto_pk_libgcrypt_encrypt_into;
+	cp->decrypt = NULL;
+	cp->decrypt_into = NULL;
 	cp->get_parameter = crypto_pk_libgcrypt_get_parameter;
 	cp->get_nbits = crypto_pk_libgcrypt_get_nbits;
 
@@ -461,8 +771,11 @@ static struct crypto_pk *crypto_pk_libgcrypt_open_priv(enum crypto_algo_pk pk, v
 		return NULL;
 
 	cp->close = crypto_pk_libgcrypt_close;
+	cp->precompute = crypto_pk_libgcrypt_precompute;
 	cp->encrypt = crypto_pk_libgcrypt_encrypt;
+	cp->encrypt_into = crypto_pk_libgcrypt_encrypt_into;
 	cp->decrypt = crypto_pk_libgcrypt_decrypt;
+	cp->decrypt_into = crypto_pk_libgcrypt_decrypt_into;
 	cp->get_parameter = crypto_pk_libgcrypt_get_parameter;
 	cp->get_nbits = crypto_pk_libgcrypt_get_nbits;
 
@@ -479,8 +792,11 @@ static struct crypto_pk *crypto_pk_libgcrypt_genkey(enum crypto_algo_pk pk, va_l
 		return NULL;
 
 	cp->close = crypto_pk_libgcrypt_close;
+	cp->precompute = crypto_pk_libgcrypt_precompute;
 	cp->encrypt = crypto_pk_libgcrypt_encrypt;
+	cp->encrypt_into = crypto_pk_libgcrypt_encrypt_into;
 	cp->decrypt = crypto_pk_libgcrypt_decrypt;
+	cp->decrypt_into = crypto_pk_libgcrypt_decrypt_into;
 	cp->get_parameter = crypto_pk_libgcrypt_get_parameter;
 	cp->get_nbits = crypto_pk_libgcrypt_get_nbits;
 
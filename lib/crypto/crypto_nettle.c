@@ -20,6 +20,7 @@
 #include "openemv/crypto.h"
 #include "crypto_backend.h"
 
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
@@ -58,6 +59,13 @@ static unsigned char *crypto_hash_nettle_read(struct crypto_hash *_ch)
 	return ch->digest;
 }
 
+static void crypto_hash_nettle_reset(struct crypto_hash *_ch)
+{
+	struct crypto_hash_nettle *ch = container_of(_ch, struct crypto_hash_nettle, ch);
+
+	sha1_init(&ch->ctx);
+}
+
 static size_t crypto_hash_nettle_get_size(const struct crypto_hash *ch)
 {
 	if (ch->algo == HASH_SHA_1)
@@ -77,7 +85,9 @@ static struct crypto_hash *crypto_hash_nettle_open(enum crypto_algo_hash hash)
 	sha1_init(&ch->ctx);
 
 	ch->ch.write = crypto_hash_nettle_write;
+	ch->ch.writev = NULL;
 	ch->ch.read = crypto_hash_nettle_read;
+	ch->ch.reset = crypto_hash_nettle_reset;
 	ch->ch.close = crypto_hash_nettle_close;
 	ch->ch.get_size = crypto_hash_nettle_get_size;
 
@@ -88,63 +98,326 @@ struct crypto_pk_nettle {
 	struct crypto_pk cp;
 	struct rsa_public_key rsa_pub;
 	struct rsa_private_key rsa_priv;
+	/* Public exponent is 3, see crypto_pk_nettle_cube() */
+	bool cube;
+	/* Montgomery reduction state, see crypto_pk_nettle_precompute() */
+	mp_limb_t *mont_r2;
+	mp_limb_t mont_ninv;
+	/* Signing state, see crypto_pk_nettle_precompute_priv() */
+	bool sign;
+	pthread_mutex_t blind_lock;
+	mpz_t blind, unblind;
+	unsigned blind_uses;
 };
 
+struct rnd_ctx;
+static struct rnd_ctx *rnd_get(void);
+static nettle_random_func rnd_func;
+
+/* Enough for the largest EMV modulus (1984 bits) */
+#define CRYPTO_NETTLE_FAST_LIMBS ((2048 + GMP_NUMB_BITS - 1) / GMP_NUMB_BITS)
+
 static void crypto_pk_nettle_close(struct crypto_pk *_cp)
 {
 	struct crypto_pk_nettle *cp = container_of(_cp, struct crypto_pk_nettle, cp);
 
 	rsa_public_key_clear(&cp->rsa_pub);
 	rsa_private_key_clear(&cp->rsa_priv);
+	free(cp->mont_r2);
+	if (cp->sign) {
+		mpz_clear(cp->blind);
+		mpz_clear(cp->unblind);
+		pthread_mutex_destroy(&cp->blind_lock);
+	}
 	free(cp);
 }
 
-static unsigned char *crypto_pk_nettle_encrypt(const struct crypto_pk *_cp, const unsigned char *buf, size_t len, size_t *clen)
+static void crypto_nettle_limbs_from_bytes(mp_limb_t *r, mp_size_t rn, const unsigned char *buf, size_t len)
+{
+	size_t i;
+
+	memset(r, 0, rn * sizeof(*r));
+	for (i = 0; i < len; i++)
+		r[i / sizeof(*r)] |= (mp_limb_t)buf[len - 1 - i] << (8 * (i % sizeof(*r)));
+}
+
+static void crypto_nettle_limbs_to_bytes(unsigned char *buf, size_t len, const mp_limb_t *r)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[len - 1 - i] = r[i / sizeof(*r)] >> (8 * (i % sizeof(*r)));
+}
+
+/* r = t mod n, t having 2 * nn limbs */
+static void crypto_nettle_mod(mp_limb_t *r, const mp_limb_t *t, const mp_limb_t *n, mp_size_t nn)
+{
+	mp_limb_t q[CRYPTO_NETTLE_FAST_LIMBS + 1];
+
+	mpn_tdiv_qr(q, r, 0, t, 2 * nn, n, nn);
+}
+
+/*
+ * x^3 mod n as a square and a multiplication, entirely on stack limbs:
+ * no allocation, and nothing shared between users of a (possibly cached)
+ * key. For e = 65537 this does not beat mpz_powm(), which already works
+ * in Montgomery form, so those keys stay on the generic path.
+ */
+static void crypto_pk_nettle_cube(const struct crypto_pk_nettle *cp, const unsigned char *buf, size_t len, unsigned char *out)
+{
+	mp_limb_t x[CRYPTO_NETTLE_FAST_LIMBS], r[CRYPTO_NETTLE_FAST_LIMBS];
+	mp_limb_t t[2 * CRYPTO_NETTLE_FAST_LIMBS];
+	const mp_limb_t *n = mpz_limbs_read(cp->rsa_pub.n);
+	mp_size_t nn = mpz_size(cp->rsa_pub.n);
+
+	/* Reduce the input first, it may be as long as the modulus */
+	crypto_nettle_limbs_from_bytes(t, 2 * nn, buf, len);
+	crypto_nettle_mod(x, t, n, nn);
+
+	mpn_sqr(t, x, nn);
+	crypto_nettle_mod(r, t, n, nn);
+
+	mpn_mul_n(t, r, x, nn);
+	crypto_nettle_mod(r, t, n, nn);
+
+	crypto_nettle_limbs_to_bytes(out, cp->rsa_pub.size, r);
+}
+
+/*
+ * r = t / B^nn mod n (Montgomery reduction), t having 2 * nn limbs and
+ * being less than B^nn * n. Carries of the row additions are parked in
+ * the low limbs that have just become zero and added in at the end.
+ */
+static void crypto_nettle_redc(mp_limb_t *r, mp_limb_t *t, const mp_limb_t *n, mp_size_t nn, mp_limb_t ninv)
+{
+	mp_size_t i;
+
+	for (i = 0; i < nn; i++)
+		t[i] = mpn_addmul_1(t + i, n, nn, t[i] * ninv);
+
+	if (mpn_add_n(r, t + nn, t, nn) || mpn_cmp(r, n, nn) >= 0)
+		mpn_sub_n(r, r, n, nn);
+}
+
+static void crypto_pk_nettle_mont_mul(const struct crypto_pk_nettle *cp, mp_limb_t *r, const mp_limb_t *a, const mp_limb_t *b)
+{
+	mp_limb_t t[2 * CRYPTO_NETTLE_FAST_LIMBS];
+	mp_size_t nn = mpz_size(cp->rsa_pub.n);
+
+	if (a == b)
+		mpn_sqr(t, a, nn);
+	else
+		mpn_mul_n(t, a, b, nn);
+	crypto_nettle_redc(r, t, mpz_limbs_read(cp->rsa_pub.n), nn, cp->mont_ninv);
+}
+
+/*
+ * x^e mod n in Montgomery form with the constants kept in the handle, so
+ * unlike mpz_powm() nothing is recomputed for each operation. The public
+ * exponent is short, plain left to right binary exponentiation is fine.
+ */
+static void crypto_pk_nettle_mont_powm(const struct crypto_pk_nettle *cp, const unsigned char *buf, size_t len, unsigned char *out)
+{
+	mp_limb_t x[CRYPTO_NETTLE_FAST_LIMBS], a[CRYPTO_NETTLE_FAST_LIMBS];
+	mp_limb_t t[2 * CRYPTO_NETTLE_FAST_LIMBS];
+	mp_size_t nn = mpz_size(cp->rsa_pub.n);
+	size_t bit = mpz_sizeinbase(cp->rsa_pub.e, 2) - 1;
+
+	/* x * R^2 / R, the input need not be reduced for that */
+	crypto_nettle_limbs_from_bytes(t, nn, buf, len);
+	crypto_pk_nettle_mont_mul(cp, x, t, cp->mont_r2);
+
+	mpn_copyi(a, x, nn);
+	while (bit--) {
+		crypto_pk_nettle_mont_mul(cp, a, a, a);
+		if (mpz_tstbit(cp->rsa_pub.e, bit))
+			crypto_pk_nettle_mont_mul(cp, a, a, x);
+	}
+
+	/* Back from Montgomery form */
+	mpn_copyi(t, a, nn);
+	mpn_zero(t + nn, nn);
+	crypto_nettle_redc(a, t, mpz_limbs_read(cp->rsa_pub.n), nn, cp->mont_ninv);
+
+	crypto_nettle_limbs_to_bytes(out, cp->rsa_pub.size, a);
+}
+
+static size_t crypto_pk_nettle_encrypt_into(const struct crypto_pk *_cp, const unsigned char *buf, size_t len, unsigned char *out, size_t outlen)
 {
 	struct crypto_pk_nettle *cp = container_of(_cp, struct crypto_pk_nettle, cp);
 	mpz_t data;
 	size_t datasize;
-	unsigned char *out;
+
+	if (outlen < cp->rsa_pub.size)
+		return 0;
+
+	if ((cp->cube || cp->mont_r2) && len <= cp->rsa_pub.size) {
+		if (cp->cube)
+			crypto_pk_nettle_cube(cp, buf, len, out);
+		else
+			crypto_pk_nettle_mont_powm(cp, buf, len, out);
+
+		return cp->rsa_pub.size;
+	}
 
 	nettle_mpz_init_set_str_256_u(data, len, buf);
 	mpz_powm(data, data, cp->rsa_pub.e, cp->rsa_pub.n);
 	datasize = nettle_mpz_sizeinbase_256_u(data);
 
+	nettle_mpz_get_str_256(datasize, out + cp->rsa_pub.size - datasize, data);
+	memset(out, 0, cp->rsa_pub.size - datasize);
+	mpz_clear(data);
+
+	return cp->rsa_pub.size;
+}
+
+static unsigned char *crypto_pk_nettle_encrypt(const struct crypto_pk *_cp, const unsigned char *buf, size_t len, size_t *clen)
+{
+	struct crypto_pk_nettle *cp = container_of(_cp, struct crypto_pk_nettle, cp);
+	unsigned char *out;
+
 	out = malloc(cp->rsa_pub.size);
 	if (!out) {
 		*clen = 0;
 		return NULL;
 	}
-	nettle_mpz_get_str_256(datasize, out + cp->rsa_pub.size - datasize, data);
-	memset(out, 0, cp->rsa_pub.size - datasize);
-	mpz_clear(data);
 
-	*clen = cp->rsa_pub.size;
+	*clen = crypto_pk_nettle_encrypt_into(_cp, buf, len, out, cp->rsa_pub.size);
+	if (!*clen) {
+		free(out);
+		return NULL;
+	}
 
 	return out;
 }
 
-static unsigned char *crypto_pk_nettle_decrypt(const struct crypto_pk *_cp, const unsigned char *buf, size_t len, size_t *clen)
+/* Draws r, keeping r^e and r^-1 mod n */
+static bool crypto_pk_nettle_blind_new(struct crypto_pk_nettle *cp)
+{
+	struct rnd_ctx *rnd = rnd_get();
+
+	if (!rnd)
+		return false;
+
+	do {
+		nettle_mpz_random(cp->blind, rnd, rnd_func, cp->rsa_pub.n);
+	} while (!mpz_invert(cp->unblind, cp->blind, cp->rsa_pub.n));
+
+	mpz_powm(cp->blind, cp->blind, cp->rsa_pub.e, cp->rsa_pub.n);
+	cp->blind_uses = 0;
+
+	return true;
+}
+
+/* Takes the current blinding pair and moves on to the next one */
+static bool crypto_pk_nettle_blind_get(struct crypto_pk_nettle *cp, mpz_t blind, mpz_t unblind)
+{
+	bool ok = true;
+
+	pthread_mutex_lock(&cp->blind_lock);
+	if (cp->blind_uses == CRYPTO_PK_BLIND_UPDATES)
+		ok = crypto_pk_nettle_blind_new(cp);
+
+	if (ok) {
+		mpz_set(blind, cp->blind);
+		mpz_set(unblind, cp->unblind);
+		mpz_mul(cp->blind, cp->blind, cp->blind);
+		mpz_mod(cp->blind, cp->blind, cp->rsa_pub.n);
+		mpz_mul(cp->unblind, cp->unblind, cp->unblind);
+		mpz_mod(cp->unblind, cp->unblind, cp->rsa_pub.n);
+		cp->blind_uses++;
+	}
+	pthread_mutex_unlock(&cp->blind_lock);
+
+	return ok;
+}
+
+/*
+ * rsa_compute_root() with our blinding around it, instead of
+ * rsa_compute_root_tr() drawing and inverting a new factor each time.
+ */
+static size_t crypto_pk_nettle_sign_into(struct crypto_pk_nettle *cp, const unsigned char *buf, size_t len, unsigned char *out)
+{
+	mpz_t c, m, blind, unblind;
+	size_t datasize, ret = 0;
+
+	nettle_mpz_init_set_str_256_u(c, len, buf);
+	if (mpz_cmp(c, cp->rsa_pub.n) >= 0) {
+		mpz_clear(c);
+		return 0;
+	}
+
+	mpz_init(m);
+	mpz_init(blind);
+	mpz_init(unblind);
+
+	if (!crypto_pk_nettle_blind_get(cp, blind, unblind))
+		goto out;
+
+	mpz_mul(m, c, blind);
+	mpz_mod(m, m, cp->rsa_pub.n);
+	rsa_compute_root(&cp->rsa_priv, m, m);
+	mpz_mul(m, m, unblind);
+	mpz_mod(m, m, cp->rsa_pub.n);
+
+	/* A fault in either half would give away a factor of n */
+	mpz_powm(blind, m, cp->rsa_pub.e, cp->rsa_pub.n);
+	if (mpz_cmp(blind, c))
+		goto out;
+
+	datasize = nettle_mpz_sizeinbase_256_u(m);
+	nettle_mpz_get_str_256(datasize, out + cp->rsa_priv.size - datasize, m);
+	memset(out, 0, cp->rsa_priv.size - datasize);
+	ret = cp->rsa_priv.size;
+
+out:
+	mpz_clear(unblind);
+	mpz_clear(blind);
+	mpz_clear(m);
+	mpz_clear(c);
+
+	return ret;
+}
+
+static size_t crypto_pk_nettle_decrypt_into(const struct crypto_pk *_cp, const unsigned char *buf, size_t len, unsigned char *out, size_t outlen)
 {
 	struct crypto_pk_nettle *cp = container_of(_cp, struct crypto_pk_nettle, cp);
 	mpz_t data;
 	size_t datasize;
-	unsigned char *out;
+
+	if (outlen < cp->rsa_priv.size)
+		return 0;
+
+	if (cp->sign)
+		return crypto_pk_nettle_sign_into(cp, buf, len, out);
 
 	nettle_mpz_init_set_str_256_u(data, len, buf);
 	rsa_compute_root(&cp->rsa_priv, data, data);
 	datasize = nettle_mpz_sizeinbase_256_u(data);
 
+	nettle_mpz_get_str_256(datasize, out + cp->rsa_priv.size - datasize, data);
+	memset(out, 0, cp->rsa_priv.size - datasize);
+	mpz_clear(data);
+
+	return cp->rsa_priv.size;
+}
+
+static unsigned char *crypto_pk_nettle_decrypt(const struct crypto_pk *_cp, const unsigned char *buf, size_t len, size_t *clen)
+{
+	struct crypto_pk_nettle *cp = container_of(_cp, struct crypto_pk_nettle, cp);
+	unsigned char *out;
+
 	out = malloc(cp->rsa_priv.size);
 	if (!out) {
 		*clen = 0;
 		return NULL;
 	}
-	nettle_mpz_get_str_256(datasize, out + cp->rsa_priv.size - datasize, data);
-	memset(out, 0, cp->rsa_priv.size - datasize);
-	mpz_clear(data);
 
-	*clen = cp->rsa_priv.size;
+	*clen = crypto_pk_nettle_decrypt_into(_cp, buf, len, out, cp->rsa_priv.size);
+	if (!*clen) {
+		free(out);
+		return NULL;
+	}
 
 	return out;
 }
@@ -161,11 +434,37 @@ static unsigned char *crypto_pk_nettle_get_parameter(const struct crypto_pk *_cp
 	struct crypto_pk_nettle *cp = container_of(_cp, struct crypto_pk_nettle, cp);
 	mpz_t *p;
 
-	if (param == 0)
+	switch (param) {
+	case 0:
 		p = &cp->rsa_pub.n;
-	else if (param == 1)
+		break;
+	case 1:
 		p = &cp->rsa_pub.e;
-	else
+		break;
+	case 2:
+		p = &cp->rsa_priv.d;
+		break;
+	case 3:
+		p = &cp->rsa_priv.p;
+		break;
+	case 4:
+		p = &cp->rsa_priv.q;
+		break;
+	case 5:
+		p = &cp->rsa_priv.a;
+		break;
+	case 6:
+		p = &cp->rsa_priv.b;
+		break;
+	case 7:
+		p = &cp->rsa_priv.c;
+		break;
+	default:
+		return NULL;
+	}
+
+	/* Public keys have no private parameters */
+	if (param > 1 && !cp->cp.decrypt)
 		return NULL;
 
 	size_t parameter_size = nettle_mpz_sizeinbase_256_u(*p);
@@ -181,6 +480,75 @@ static unsigned char *crypto_pk_nettle_get_parameter(const struct crypto_pk *_cp
 	return out;
 }
 
+/*
+ * Keeps -1/n mod B and R^2 mod n (R = B^nn) in the handle. The e = 3
+ * path does not need them: a Montgomery cube takes more multiplications
+ * than the plain one.
+ */
+static bool crypto_pk_nettle_precompute(struct crypto_pk *_cp)
+{
+	struct crypto_pk_nettle *cp = container_of(_cp, struct crypto_pk_nettle, cp);
+	mp_size_t nn = mpz_size(cp->rsa_pub.n);
+	mp_limb_t n0, inv;
+	mpz_t r2;
+	unsigned i;
+
+	if (cp->cube || cp->mont_r2)
+		return true;
+
+	if (nn > CRYPTO_NETTLE_FAST_LIMBS || !mpz_odd_p(cp->rsa_pub.n))
+		return false;
+
+	cp->mont_r2 = malloc(nn * sizeof(*cp->mont_r2));
+	if (!cp->mont_r2)
+		return false;
+
+	/* Newton iteration, each step doubles the number of correct bits */
+	n0 = mpz_getlimbn(cp->rsa_pub.n, 0);
+	inv = n0;
+	for (i = 0; i < 6; i++)
+		inv *= 2 - n0 * inv;
+	cp->mont_ninv = -inv;
+
+	mpz_init(r2);
+	mpz_setbit(r2, 2 * nn * GMP_NUMB_BITS);
+	mpz_mod(r2, r2, cp->rsa_pub.n);
+	mpn_zero(cp->mont_r2, nn);
+	mpn_copyi(cp->mont_r2, mpz_limbs_read(r2), mpz_size(r2));
+	mpz_clear(r2);
+
+	return true;
+}
+
+/* The public key part, then the signing state */
+static bool crypto_pk_nettle_precompute_priv(struct crypto_pk *_cp)
+{
+	struct crypto_pk_nettle *cp = container_of(_cp, struct crypto_pk_nettle, cp);
+
+	if (!cp->sign) {
+		if (pthread_mutex_init(&cp->blind_lock, NULL))
+			return false;
+		mpz_init(cp->blind);
+		mpz_init(cp->unblind);
+
+		if (!crypto_pk_nettle_blind_new(cp)) {
+			mpz_clear(cp->blind);
+			mpz_clear(cp->unblind);
+			pthread_mutex_destroy(&cp->blind_lock);
+			return false;
+		}
+		cp->sign = true;
+	}
+
+	return crypto_pk_nettle_precompute(_cp);
+}
+
+/* Most EMV keys, CA ones included, use e = 3 */
+static bool crypto_pk_nettle_is_cube(const struct rsa_public_key *pub)
+{
+	return mpz_size(pub->n) <= CRYPTO_NETTLE_FAST_LIMBS && !mpz_cmp_ui(pub->e, 3);
+}
+
 static struct crypto_pk *crypto_pk_nettle_open(enum crypto_algo_pk pk, va_list vl)
 {
 	struct crypto_pk_nettle *cp;
@@ -212,8 +580,15 @@ static struct crypto_pk *crypto_pk_nettle_open(enum crypto_algo_pk pk, va_list v
 		return NULL;
 	}
 
+	cp->cube = crypto_pk_nettle_is_cube(&cp->rsa_pub);
+	cp->mont_r2 = NULL;
+	cp->sign = false;
 	cp->cp.close = crypto_pk_nettle_close;
+	cp->cp.precompute = crypto_pk_nettle_precompute;
 	cp->cp.encrypt = crypto_pk_nettle_encrypt;
+	cp->cp.encrypt_into = crypto_pk_nettle_encrypt_into;
+	cp->cp.decrypt = NULL;
+	cp->cp.decrypt_into = NULL;
 	cp->cp.get_parameter = crypto_pk_nettle_get_parameter;
 	cp->cp.get_nbits = crypto_pk_nettle_get_nbits;
 
@@ -273,9 +648,15 @@ static struct crypto_pk *crypto_pk_nettle_open_priv(enum crypto_algo_pk pk, va_l
 		return NULL;
 	}
 
+	cp->cube = crypto_pk_nettle_is_cube(&cp->rsa_pub);
+	cp->mont_r2 = NULL;
+	cp->sign = false;
 	cp->cp.close = crypto_pk_nettle_close;
+	cp->cp.precompute = crypto_pk_nettle_precompute_priv;
 	cp->cp.encrypt = crypto_pk_nettle_encrypt;
+	cp->cp.encrypt_into = crypto_pk_nettle_encrypt_into;
 	cp->cp.decrypt = crypto_pk_nettle_decrypt;
+	cp->cp.decrypt_into = crypto_pk_nettle_decrypt_into;
 	cp->cp.get_parameter = crypto_pk_nettle_get_parameter;
 	cp->cp.get_nbits = crypto_pk_nettle_get_nbits;
 
@@ -284,112 +665,30 @@ static struct crypto_pk *crypto_pk_nettle_open_priv(enum crypto_algo_pk pk, va_l
 
 #define RND_N_SOURCES 2
 
-static struct {
+/* Each thread has its own generator, seeded when first used */
+struct rnd_ctx {
 	struct yarrow256_ctx yactx;
 	struct yarrow_source sources[RND_N_SOURCES];
-} rndctx;
-
-#if defined(HAVE_GETENTROPY)
-#include <unistd.h>
-/* getentropy call is declared in unistd.h */
-#elif defined(linux)
-#include <linux/random.h>
-#include <errno.h>
-#include <unistd.h>
-#include <sys/syscall.h>
-
-#if defined SYS_getrandom
-static int getrandom(void *buf, size_t buflen, unsigned int flags)
-{
-	return syscall(SYS_getrandom, buf, buflen, flags);
-}
-#else
-static int getrandom(void *buf, size_t buflen, unsigned int flags)
-{
-	errno = ENOSYS;
-	return -1;
-}
-#endif
-
-#include <sys/stat.h>
-#include <sys/types.h>
-#include <fcntl.h>
-
-static int getentropy_urandom(void *buf, size_t len)
-{
-	static int fd = -1;
-	size_t pos;
-
-	if (fd == -1) {
-		int old;
-
-		fd = open("/dev/urandom", O_RDONLY);
-		if (fd < 0) {
-			return fd;
-		}
-
-		old = fcntl(fd, F_GETFD);
-		if (old != -1)
-			old = fcntl(fd, F_SETFD, old | FD_CLOEXEC);
-		if (old < 0)
-			return old;
-	}
-
-	for (pos = 0; pos < len; ) {
-		ssize_t res = read(fd, buf + pos, len - pos);
-		if (res < 0) {
-			if (errno == EINTR)
-				continue;
-
-			return res;
-		} else if (res == 0)
-			return -1;
-		else
-			pos += res;
-	}
-
-	return 0;
-}
-
-static int getentropy(void *buf, size_t buflen)
-{
-	int ret;
-
-	if (buflen > 256)
-		goto failure;
+};
 
-	ret = getrandom(buf, buflen, 0);
-	if (ret < 0) {
-		if (errno == ENOSYS)
-			return getentropy_urandom(buf, buflen);
-		return ret;
-	}
-	if (ret == buflen)
-		return 0;
-failure:
-	errno = EIO;
-	return -1;
-}
-#else
-#error Your system is not yet supported. Please add a getentropy function
-#endif
+static pthread_key_t rnd_key;
 
 #define GETENTROPY_BUF_SIZE 16
 
-static int rnd_source_getentropy(int init)
+static int rnd_source_getentropy(struct rnd_ctx *ctx, int init)
 {
 	unsigned char buf[GETENTROPY_BUF_SIZE];
 	unsigned int read_size = sizeof(buf);
 	int rc;
 
-	rc = getentropy(buf, read_size);
+	rc = crypto_getentropy(buf, read_size);
 	if (rc < 0) {
 		perror("getentropy");
 
 		return rc;
 	}
 
-	return yarrow256_update(&rndctx.yactx, init,
+	return yarrow256_update(&ctx->yactx, init,
 			read_size * 8 / 2, read_size, buf);
 
 }
@@ -402,39 +701,67 @@ typedef unsigned int rnd_size_t;
 
 static void rnd_func(void *_ctx, rnd_size_t length, uint8_t *data)
 {
-	yarrow256_random(&rndctx.yactx, length, data);
+	struct rnd_ctx *ctx = _ctx;
+
+	yarrow256_random(&ctx->yactx, length, data);
 }
 
-static bool rnd_reseed(void)
+static bool rnd_reseed(struct rnd_ctx *ctx)
 {
-	if (rnd_source_getentropy(0) < 0)
+	if (rnd_source_getentropy(ctx, 0) < 0)
 		return false;
 
-	if (rnd_source_getentropy(1) < 0)
+	if (rnd_source_getentropy(ctx, 1) < 0)
 		return false;
 
-	yarrow256_slow_reseed(&rndctx.yactx);
+	yarrow256_slow_reseed(&ctx->yactx);
 
 	return true;
 }
 
-static bool rnd_init(void)
+/* Thread exit */
+static void rnd_free(void *data)
 {
-	static bool initialized = false;
+	struct rnd_ctx *ctx = data;
 
-	if (initialized)
-		return true;
+	memset(ctx, 0, sizeof(*ctx));
+	free(ctx);
+}
 
-	yarrow256_init(&rndctx.yactx, RND_N_SOURCES, rndctx.sources);
+static struct rnd_ctx *rnd_get(void)
+{
+	struct rnd_ctx *ctx = pthread_getspecific(rnd_key);
 
-	initialized = rnd_reseed();
+	if (ctx)
+		return ctx;
 
-	return initialized;
+	ctx = malloc(sizeof(*ctx));
+	if (!ctx)
+		return NULL;
+
+	yarrow256_init(&ctx->yactx, RND_N_SOURCES, ctx->sources);
+	if (!rnd_reseed(ctx) || pthread_setspecific(rnd_key, ctx)) {
+		rnd_free(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+/* Called once, from crypto_init() */
+static bool rnd_init(void)
+{
+	if (pthread_key_create(&rnd_key, rnd_free))
+		return false;
+
+	/* Fail early if there is no entropy to be had */
+	return rnd_get() != NULL;
 }
 
 static struct crypto_pk *crypto_pk_nettle_genkey(enum crypto_algo_pk pk, va_list vl)
 {
 	struct crypto_pk_nettle *cp;
+	struct rnd_ctx *rnd;
 	/*int transient;*/
 	unsigned int nbits;
 	unsigned int exp;
@@ -446,19 +773,29 @@ static struct crypto_pk *crypto_pk_nettle_genkey(enum crypto_algo_pk pk, va_list
 	nbits = va_arg(vl, unsigned int);
 	exp = va_arg(vl, unsigned int);
 
+	rnd = rnd_get();
+	if (!rnd)
+		return NULL;
+
 	cp = malloc(sizeof(*cp));
 	rsa_public_key_init(&cp->rsa_pub);
 	rsa_private_key_init(&cp->rsa_priv);
 
 	mpz_set_ui(cp->rsa_pub.e, exp);
 
-	rsa_generate_keypair(&cp->rsa_pub, &cp->rsa_priv, NULL,
-			rnd_func, NULL, NULL,
+	rsa_generate_keypair(&cp->rsa_pub, &cp->rsa_priv,
+			rnd, rnd_func, NULL, NULL,
 			nbits, 0);
 
+	cp->cube = crypto_pk_nettle_is_cube(&cp->rsa_pub);
+	cp->mont_r2 = NULL;
+	cp->sign = false;
 	cp->cp.close = crypto_pk_nettle_close;
+	cp->cp.precompute = crypto_pk_nettle_precompute_priv;
 	cp->cp.encrypt = crypto_pk_nettle_encrypt;
+	cp->cp.encrypt_into = crypto_pk_nettle_encrypt_into;
 	cp->cp.decrypt = crypto_pk_nettle_decrypt;
+	cp->cp.decrypt_into = crypto_pk_nettle_decrypt_into;
 	cp->cp.get_parameter = crypto_pk_nettle_get_parameter;
 	cp->cp.get_nbits = crypto_pk_nettle_get_nbits;
 
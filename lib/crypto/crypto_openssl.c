@@ -0,0 +1,718 @@
+/*
+ * libopenemv - a library to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "openemv/crypto.h"
+#include "crypto_backend.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/bn.h>
+#include <openssl/core_names.h>
+#include <openssl/crypto.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+
+static void crypto_openssl_error(void)
+{
+	unsigned long err = ERR_get_error();
+
+	fprintf(stderr, "OpenSSL error %s\n", err ? ERR_error_string(err, NULL) : "unknown");
+	ERR_clear_error();
+}
+
+struct crypto_hash_openssl {
+	struct crypto_hash ch;
+	EVP_MD_CTX *md;
+	/* Once read, the digest stays until the next reset */
+	bool final;
+	/* A reset failed, nothing is hashed until one succeeds */
+	bool failed;
+	unsigned char digest[EVP_MAX_MD_SIZE];
+};
+
+static const EVP_MD *crypto_hash_openssl_md(enum crypto_algo_hash hash)
+{
+	if (hash == HASH_SHA_1)
+		return EVP_sha1();
+
+	return NULL;
+}
+
+static void crypto_hash_openssl_close(struct crypto_hash *_ch)
+{
+	struct crypto_hash_openssl *ch = container_of(_ch, struct crypto_hash_openssl, ch);
+
+	EVP_MD_CTX_free(ch->md);
+	free(ch);
+}
+
+static void crypto_hash_openssl_write(struct crypto_hash *_ch, const unsigned char *buf, size_t len)
+{
+	struct crypto_hash_openssl *ch = container_of(_ch, struct crypto_hash_openssl, ch);
+
+	if (!ch->final && !ch->failed)
+		EVP_DigestUpdate(ch->md, buf, len);
+}
+
+static unsigned char *crypto_hash_openssl_read(struct crypto_hash *_ch)
+{
+	struct crypto_hash_openssl *ch = container_of(_ch, struct crypto_hash_openssl, ch);
+
+	if (ch->failed)
+		return NULL;
+
+	if (!ch->final) {
+		if (!EVP_DigestFinal_ex(ch->md, ch->digest, NULL)) {
+			crypto_openssl_error();
+			return NULL;
+		}
+		ch->final = true;
+	}
+
+	return ch->digest;
+}
+
+static void crypto_hash_openssl_reset(struct crypto_hash *_ch)
+{
+	struct crypto_hash_openssl *ch = container_of(_ch, struct crypto_hash_openssl, ch);
+
+	/* Keeps the already fetched digest implementation */
+	ch->failed = !EVP_DigestInit_ex2(ch->md, NULL, NULL);
+	if (ch->failed)
+		crypto_openssl_error();
+	ch->final = false;
+}
+
+static size_t crypto_hash_openssl_get_size(const struct crypto_hash *ch)
+{
+	const EVP_MD *md = crypto_hash_openssl_md(ch->algo);
+
+	if (!md)
+		return 0;
+
+	return EVP_MD_get_size(md);
+}
+
+static struct crypto_hash *crypto_hash_openssl_open(enum crypto_algo_hash hash)
+{
+	const EVP_MD *md = crypto_hash_openssl_md(hash);
+	struct crypto_hash_openssl *ch;
+
+	if (!md)
+		return NULL;
+
+	ch = malloc(sizeof(*ch));
+	if (!ch)
+		return NULL;
+
+	ch->md = EVP_MD_CTX_new();
+	if (!ch->md || !EVP_DigestInit_ex2(ch->md, md, NULL)) {
+		crypto_openssl_error();
+		EVP_MD_CTX_free(ch->md);
+		free(ch);
+		return NULL;
+	}
+	ch->final = false;
+	ch->failed = false;
+
+	ch->ch.write = crypto_hash_openssl_write;
+	ch->ch.writev = NULL;
+	ch->ch.read = crypto_hash_openssl_read;
+	ch->ch.reset = crypto_hash_openssl_reset;
+	ch->ch.close = crypto_hash_openssl_close;
+	ch->ch.get_size = crypto_hash_openssl_get_size;
+
+	return &ch->ch;
+}
+
+/*
+ * The key is kept as plain BIGNUMs: going through EVP_PKEY_encrypt()
+ * for each raw RSA operation costs more than the exponentiation with
+ * a public exponent of 3.
+ */
+struct crypto_pk_openssl {
+	struct crypto_pk cp;
+	BIGNUM *n, *e;
+	/* Private keys only */
+	BIGNUM *d, *p, *q, *dmp1, *dmq1, *iqmp;
+	/* See crypto_pk_openssl_precompute() */
+	BN_MONT_CTX *mont;
+	/* Private keys, see crypto_pk_openssl_sign_precompute() */
+	BN_MONT_CTX *mont_p, *mont_q;
+	BN_BLINDING *blinding;
+};
+
+static void crypto_pk_openssl_close(struct crypto_pk *_cp)
+{
+	struct crypto_pk_openssl *cp = container_of(_cp, struct crypto_pk_openssl, cp);
+
+	BN_free(cp->n);
+	BN_free(cp->e);
+	BN_clear_free(cp->d);
+	BN_clear_free(cp->p);
+	BN_clear_free(cp->q);
+	BN_clear_free(cp->dmp1);
+	BN_clear_free(cp->dmq1);
+	BN_clear_free(cp->iqmp);
+	BN_MONT_CTX_free(cp->mont);
+	BN_MONT_CTX_free(cp->mont_p);
+	BN_MONT_CTX_free(cp->mont_q);
+	BN_BLINDING_free(cp->blinding);
+	free(cp);
+}
+
+static BIGNUM *crypto_pk_openssl_bn(const unsigned char *buf, size_t len, bool secret)
+{
+	BIGNUM *bn = secret ? BN_secure_new() : BN_new();
+
+	if (!bn)
+		return NULL;
+
+	if (!BN_bin2bn(buf, len, bn)) {
+		BN_free(bn);
+		return NULL;
+	}
+
+	if (secret)
+		BN_set_flags(bn, BN_FLG_CONSTTIME);
+
+	return bn;
+}
+
+static struct crypto_pk *crypto_pk_openssl_open_rsa(va_list vl)
+{
+	struct crypto_pk_openssl *cp = calloc(1, sizeof(*cp));
+	unsigned char *mod = va_arg(vl, unsigned char *);
+	size_t modlen = va_arg(vl, size_t);
+	unsigned char *exp = va_arg(vl, unsigned char *);
+	size_t explen = va_arg(vl, size_t);
+
+	if (!cp)
+		return NULL;
+
+	cp->n = crypto_pk_openssl_bn(mod, modlen, false);
+	cp->e = crypto_pk_openssl_bn(exp, explen, false);
+	if (!cp->n || !cp->e || BN_is_zero(cp->n)) {
+		crypto_pk_openssl_close(&cp->cp);
+		return NULL;
+	}
+
+	return &cp->cp;
+}
+
+static struct crypto_pk *crypto_pk_openssl_open_priv_rsa(va_list vl)
+{
+	struct crypto_pk_openssl *cp = calloc(1, sizeof(*cp));
+	unsigned char *mod = va_arg(vl, unsigned char *);
+	size_t modlen = va_arg(vl, size_t);
+	unsigned char *exp = va_arg(vl, unsigned char *);
+	size_t explen = va_arg(vl, size_t);
+	unsigned char *d = va_arg(vl, unsigned char *);
+	size_t dlen = va_arg(vl, size_t);
+	unsigned char *p = va_arg(vl, unsigned char *);
+	size_t plen = va_arg(vl, size_t);
+	unsigned char *q = va_arg(vl, unsigned char *);
+	size_t qlen = va_arg(vl, size_t);
+	unsigned char *dp = va_arg(vl, unsigned char *);
+	size_t dplen = va_arg(vl, size_t);
+	unsigned char *dq = va_arg(vl, unsigned char *);
+	size_t dqlen = va_arg(vl, size_t);
+	unsigned char *inv = va_arg(vl, unsigned char *);
+	size_t invlen = va_arg(vl, size_t);
+
+	if (!cp)
+		return NULL;
+
+	cp->n = crypto_pk_openssl_bn(mod, modlen, false);
+	cp->e = crypto_pk_openssl_bn(exp, explen, false);
+	cp->d = crypto_pk_openssl_bn(d, dlen, true);
+	cp->p = crypto_pk_openssl_bn(p, plen, true);
+	cp->q = crypto_pk_openssl_bn(q, qlen, true);
+	cp->dmp1 = crypto_pk_openssl_bn(dp, dplen, true);
+	cp->dmq1 = crypto_pk_openssl_bn(dq, dqlen, true);
+	/* Same convention as nettle: q^-1 mod p */
+	cp->iqmp = crypto_pk_openssl_bn(inv, invlen, true);
+	if (!cp->n || !cp->e || !cp->d || !cp->p || !cp->q ||
+	    !cp->dmp1 || !cp->dmq1 || !cp->iqmp ||
+	    BN_is_zero(cp->n) || BN_is_zero(cp->p) || BN_is_zero(cp->q)) {
+		crypto_pk_openssl_close(&cp->cp);
+		return NULL;
+	}
+
+	return &cp->cp;
+}
+
+static BIGNUM *crypto_pk_openssl_get_bn(EVP_PKEY *pkey, const char *name)
+{
+	BIGNUM *bn = NULL;
+
+	if (!EVP_PKEY_get_bn_param(pkey, name, &bn))
+		return NULL;
+
+	return bn;
+}
+
+static struct crypto_pk *crypto_pk_openssl_genkey_rsa(va_list vl)
+{
+	struct crypto_pk_openssl *cp;
+	EVP_PKEY_CTX *ctx;
+	EVP_PKEY *pkey = NULL;
+	BIGNUM *pubexp;
+	/*int transient;*/
+	unsigned int nbits;
+	unsigned int exp;
+
+	/*transient = */va_arg(vl, int);
+	nbits = va_arg(vl, unsigned int);
+	exp = va_arg(vl, unsigned int);
+
+	ctx = EVP_PKEY_CTX_new_from_name(NULL, "RSA", NULL);
+	if (!ctx) {
+		crypto_openssl_error();
+		return NULL;
+	}
+
+	pubexp = BN_new();
+	if (!pubexp || !BN_set_word(pubexp, exp) ||
+	    EVP_PKEY_keygen_init(ctx) <= 0 ||
+	    EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, nbits) <= 0 ||
+	    EVP_PKEY_CTX_set1_rsa_keygen_pubexp(ctx, pubexp) <= 0 ||
+	    EVP_PKEY_generate(ctx, &pkey) <= 0) {
+		crypto_openssl_error();
+		BN_free(pubexp);
+		EVP_PKEY_CTX_free(ctx);
+		return NULL;
+	}
+	BN_free(pubexp);
+	EVP_PKEY_CTX_free(ctx);
+
+	cp = calloc(1, sizeof(*cp));
+	if (!cp) {
+		EVP_PKEY_free(pkey);
+		return NULL;
+	}
+
+	cp->n = crypto_pk_openssl_get_bn(pkey, OSSL_PKEY_PARAM_RSA_N);
+	cp->e = crypto_pk_openssl_get_bn(pkey, OSSL_PKEY_PARAM_RSA_E);
+	cp->d = crypto_pk_openssl_get_bn(pkey, OSSL_PKEY_PARAM_RSA_D);
+	cp->p = crypto_pk_openssl_get_bn(pkey, OSSL_PKEY_PARAM_RSA_FACTOR1);
+	cp->q = crypto_pk_openssl_get_bn(pkey, OSSL_PKEY_PARAM_RSA_FACTOR2);
+	cp->dmp1 = crypto_pk_openssl_get_bn(pkey, OSSL_PKEY_PARAM_RSA_EXPONENT1);
+	cp->dmq1 = crypto_pk_openssl_get_bn(pkey, OSSL_PKEY_PARAM_RSA_EXPONENT2);
+	cp->iqmp = crypto_pk_openssl_get_bn(pkey, OSSL_PKEY_PARAM_RSA_COEFFICIENT1);
+	EVP_PKEY_free(pkey);
+
+	if (!cp->n || !cp->e || !cp->d || !cp->p || !cp->q ||
+	    !cp->dmp1 || !cp->dmq1 || !cp->iqmp) {
+		crypto_openssl_error();
+		crypto_pk_openssl_close(&cp->cp);
+		return NULL;
+	}
+
+	BN_set_flags(cp->d, BN_FLG_CONSTTIME);
+	BN_set_flags(cp->p, BN_FLG_CONSTTIME);
+	BN_set_flags(cp->q, BN_FLG_CONSTTIME);
+	BN_set_flags(cp->dmp1, BN_FLG_CONSTTIME);
+	BN_set_flags(cp->dmq1, BN_FLG_CONSTTIME);
+	BN_set_flags(cp->iqmp, BN_FLG_CONSTTIME);
+
+	return &cp->cp;
+}
+
+/*
+ * Montgomery constants for both primes, and a BN_BLINDING which updates
+ * its factors by squaring and renews them every few uses by itself.
+ */
+static bool crypto_pk_openssl_sign_precompute(struct crypto_pk_openssl *cp)
+{
+	BN_CTX *ctx;
+
+	if (cp->blinding)
+		return true;
+
+	ctx = BN_CTX_secure_new();
+	if (!ctx)
+		return false;
+
+	cp->mont_p = BN_MONT_CTX_new();
+	cp->mont_q = BN_MONT_CTX_new();
+	if (!cp->mont_p || !cp->mont_q ||
+	    !BN_MONT_CTX_set(cp->mont_p, cp->p, ctx) ||
+	    !BN_MONT_CTX_set(cp->mont_q, cp->q, ctx))
+		goto err;
+
+	cp->blinding = BN_BLINDING_create_param(NULL, cp->e, cp->n, ctx,
+			BN_mod_exp_mont, cp->mont);
+	if (!cp->blinding)
+		goto err;
+
+	BN_CTX_free(ctx);
+
+	return true;
+
+err:
+	crypto_openssl_error();
+	BN_MONT_CTX_free(cp->mont_p);
+	BN_MONT_CTX_free(cp->mont_q);
+	cp->mont_p = cp->mont_q = NULL;
+	BN_CTX_free(ctx);
+
+	return false;
+}
+
+/* Montgomery constants for the modulus, reused by every encryption */
+static bool crypto_pk_openssl_precompute(struct crypto_pk *_cp)
+{
+	struct crypto_pk_openssl *cp = container_of(_cp, struct crypto_pk_openssl, cp);
+	BN_MONT_CTX *mont;
+	BN_CTX *ctx;
+
+	if (cp->mont)
+		return !cp->p || crypto_pk_openssl_sign_precompute(cp);
+
+	/* Montgomery reduction needs an odd modulus */
+	if (!BN_is_odd(cp->n))
+		return false;
+
+	ctx = BN_CTX_new();
+	mont = BN_MONT_CTX_new();
+	if (!ctx || !mont || !BN_MONT_CTX_set(mont, cp->n, ctx)) {
+		crypto_openssl_error();
+		BN_MONT_CTX_free(mont);
+		BN_CTX_free(ctx);
+		return false;
+	}
+	BN_CTX_free(ctx);
+
+	cp->mont = mont;
+
+	return !cp->p || crypto_pk_openssl_sign_precompute(cp);
+}
+
+static size_t crypto_pk_openssl_keysize(const struct crypto_pk_openssl *cp)
+{
+	return BN_num_bytes(cp->n);
+}
+
+static size_t crypto_pk_openssl_encrypt_into(const struct crypto_pk *_cp, const unsigned char *buf, size_t len, unsigned char *out, size_t outlen)
+{
+	struct crypto_pk_openssl *cp = container_of(_cp, struct crypto_pk_openssl, cp);
+	size_t keysize = crypto_pk_openssl_keysize(cp);
+	BN_CTX *ctx;
+	BIGNUM *x;
+	size_t ret = 0;
+
+	if (outlen < keysize)
+		return 0;
+
+	ctx = BN_CTX_new();
+	if (!ctx)
+		return 0;
+
+	BN_CTX_start(ctx);
+	x = BN_CTX_get(ctx);
+	if (!x || !BN_bin2bn(buf, len, x) || BN_ucmp(x, cp->n) >= 0)
+		goto out;
+
+	if (cp->mont ?
+	    !BN_mod_exp_mont(x, x, cp->e, cp->n, ctx, cp->mont) :
+	    !BN_mod_exp(x, x, cp->e, cp->n, ctx)) {
+		crypto_openssl_error();
+		goto out;
+	}
+
+	if (BN_bn2binpad(x, out, keysize) < 0)
+		goto out;
+
+	ret = keysize;
+
+out:
+	BN_CTX_end(ctx);
+	BN_CTX_free(ctx);
+
+	return ret;
+}
+
+static unsigned char *crypto_pk_openssl_encrypt(const struct crypto_pk *_cp, const unsigned char *buf, size_t len, size_t *clen)
+{
+	struct crypto_pk_openssl *cp = container_of(_cp, struct crypto_pk_openssl, cp);
+	size_t keysize = crypto_pk_openssl_keysize(cp);
+	unsigned char *result;
+
+	result = malloc(keysize);
+	if (!result)
+		return NULL;
+
+	*clen = crypto_pk_openssl_encrypt_into(_cp, buf, len, result, keysize);
+	if (!*clen) {
+		free(result);
+		return NULL;
+	}
+
+	return result;
+}
+
+/*
+ * Chinese remainder theorem, with constant time exponentiations. With
+ * the key precomputed, the input is blinded and the result checked.
+ */
+static size_t crypto_pk_openssl_decrypt_into(const struct crypto_pk *_cp, const unsigned char *buf, size_t len, unsigned char *out, size_t outlen)
+{
+	struct crypto_pk_openssl *cp = container_of(_cp, struct crypto_pk_openssl, cp);
+	size_t keysize = crypto_pk_openssl_keysize(cp);
+	BN_CTX *ctx;
+	BIGNUM *c, *m1, *m2, *unblind = NULL, *check = NULL;
+	size_t ret = 0;
+
+	if (outlen < keysize)
+		return 0;
+
+	ctx = BN_CTX_secure_new();
+	if (!ctx)
+		return 0;
+
+	BN_CTX_start(ctx);
+	c = BN_CTX_get(ctx);
+	m1 = BN_CTX_get(ctx);
+	m2 = BN_CTX_get(ctx);
+	if (!m2 || !BN_bin2bn(buf, len, c) || BN_ucmp(c, cp->n) >= 0)
+		goto out;
+
+	if (cp->blinding) {
+		unblind = BN_CTX_get(ctx);
+		check = BN_CTX_get(ctx);
+		if (!check || !BN_copy(check, c))
+			goto out;
+
+		/* The factors are shared, the inverse for this call is kept apart */
+		if (!BN_BLINDING_lock(cp->blinding))
+			goto err;
+		if (!BN_BLINDING_convert_ex(c, unblind, cp->blinding, ctx)) {
+			BN_BLINDING_unlock(cp->blinding);
+			goto err;
+		}
+		BN_BLINDING_unlock(cp->blinding);
+	}
+
+	/* m1 = c^dP mod p, m2 = c^dQ mod q */
+	if (!BN_mod(m1, c, cp->p, ctx) ||
+	    !BN_mod_exp_mont_consttime(m1, m1, cp->dmp1, cp->p, ctx, cp->mont_p) ||
+	    !BN_mod(m2, c, cp->q, ctx) ||
+	    !BN_mod_exp_mont_consttime(m2, m2, cp->dmq1, cp->q, ctx, cp->mont_q))
+		goto err;
+
+	/* m = m2 + q * ((m1 - m2) * qInv mod p) */
+	if (!BN_mod_sub(m1, m1, m2, cp->p, ctx) ||
+	    !BN_mod_mul(m1, m1, cp->iqmp, cp->p, ctx) ||
+	    !BN_mul(m1, m1, cp->q, ctx) ||
+	    !BN_add(m1, m1, m2))
+		goto err;
+
+	if (cp->blinding) {
+		if (!BN_BLINDING_invert_ex(m1, unblind, cp->blinding, ctx) ||
+		    !BN_mod_exp_mont(m2, m1, cp->e, cp->n, ctx, cp->mont))
+			goto err;
+
+		/* A fault in either half would give away a factor of n */
+		if (BN_cmp(m2, check))
+			goto out;
+	}
+
+	if (BN_bn2binpad(m1, out, keysize) < 0)
+		goto out;
+
+	ret = keysize;
+	goto out;
+
+err:
+	crypto_openssl_error();
+out:
+	BN_CTX_end(ctx);
+	BN_CTX_free(ctx);
+
+	return ret;
+}
+
+static unsigned char *crypto_pk_openssl_decrypt(const struct crypto_pk *_cp, const unsigned char *buf, size_t len, size_t *clen)
+{
+	struct crypto_pk_openssl *cp = container_of(_cp, struct crypto_pk_openssl, cp);
+	size_t keysize = crypto_pk_openssl_keysize(cp);
+	unsigned char *result;
+
+	result = malloc(keysize);
+	if (!result)
+		return NULL;
+
+	*clen = crypto_pk_openssl_decrypt_into(_cp, buf, len, result, keysize);
+	if (!*clen) {
+		free(result);
+		return NULL;
+	}
+
+	return result;
+}
+
+static size_t crypto_pk_openssl_get_nbits(const struct crypto_pk *_cp)
+{
+	struct crypto_pk_openssl *cp = container_of(_cp, struct crypto_pk_openssl, cp);
+
+	return BN_num_bits(cp->n);
+}
+
+static unsigned char *crypto_pk_openssl_get_parameter(const struct crypto_pk *_cp, unsigned param, size_t *plen)
+{
+	struct crypto_pk_openssl *cp = container_of(_cp, struct crypto_pk_openssl, cp);
+	unsigned char *result;
+	const BIGNUM *bn;
+
+	/* XXX: RSA-only! */
+	switch (param) {
+	case 0:
+		bn = cp->n;
+		break;
+	case 1:
+		bn = cp->e;
+		break;
+	case 2:
+		bn = cp->d;
+		break;
+	case 3:
+		bn = cp->p;
+		break;
+	case 4:
+		bn = cp->q;
+		break;
+	case 5:
+		bn = cp->dmp1;
+		break;
+	case 6:
+		bn = cp->dmq1;
+		break;
+	case 7:
+		bn = cp->iqmp;
+		break;
+	default:
+		return NULL;
+	}
+
+	/* Public keys have no private parameters */
+	if (!bn)
+		return NULL;
+
+	result = malloc(BN_num_bytes(bn));
+	if (!result)
+		return NULL;
+
+	*plen = BN_bn2bin(bn, result);
+
+	return result;
+}
+
+static struct crypto_pk *crypto_pk_openssl_open(enum crypto_algo_pk pk, va_list vl)
+{
+	struct crypto_pk *cp;
+
+	if (pk == PK_RSA)
+		cp = crypto_pk_openssl_open_rsa(vl);
+	else
+		return NULL;
+
+	if (!cp)
+		return NULL;
+
+	cp->close = crypto_pk_openssl_close;
+	cp->precompute = crypto_pk_openssl_precompute;
+	cp->encrypt = crypto_pk_openssl_encrypt;
+	cp->encrypt_into = crypto_pk_openssl_encrypt_into;
+	cp->decrypt = NULL;
+	cp->decrypt_into = NULL;
+	cp->get_parameter = crypto_pk_openssl_get_parameter;
+	cp->get_nbits = crypto_pk_openssl_get_nbits;
+
+	return cp;
+}
+
+static struct crypto_pk *crypto_pk_openssl_open_priv(enum crypto_algo_pk pk, va_list vl)
+{
+	struct crypto_pk *cp;
+
+	if (pk == PK_RSA)
+		cp = crypto_pk_openssl_open_priv_rsa(vl);
+	else
+		return NULL;
+
+	if (!cp)
+		return NULL;
+
+	cp->close = crypto_pk_openssl_close;
+	cp->precompute = crypto_pk_openssl_precompute;
+	cp->encrypt = crypto_pk_openssl_encrypt;
+	cp->encrypt_into = crypto_pk_openssl_encrypt_into;
+	cp->decrypt = crypto_pk_openssl_decrypt;
+	cp->decrypt_into = crypto_pk_openssl_decrypt_into;
+	cp->get_parameter = crypto_pk_openssl_get_parameter;
+	cp->get_nbits = crypto_pk_openssl_get_nbits;
+
+	return cp;
+}
+
+static struct crypto_pk *crypto_pk_openssl_genkey(enum crypto_algo_pk pk, va_list vl)
+{
+	struct crypto_pk *cp;
+
+	if (pk == PK_RSA)
+		cp = crypto_pk_openssl_genkey_rsa(vl);
+	else
+		return NULL;
+
+	if (!cp)
+		return NULL;
+
+	cp->close = crypto_pk_openssl_close;
+	cp->precompute = crypto_pk_openssl_precompute;
+	cp->encrypt = crypto_pk_openssl_encrypt;
+	cp->encrypt_into = crypto_pk_openssl_encrypt_into;
+	cp->decrypt = crypto_pk_openssl_decrypt;
+	cp->decrypt_into = crypto_pk_openssl_decrypt_into;
+	cp->get_parameter = crypto_pk_openssl_get_parameter;
+	cp->get_nbits = crypto_pk_openssl_get_nbits;
+
+	return cp;
+}
+
+static struct crypto_backend crypto_openssl_backend = {
+	.hash_open = crypto_hash_openssl_open,
+	.pk_open = crypto_pk_openssl_open,
+	.pk_open_priv = crypto_pk_openssl_open_priv,
+	.pk_genkey = crypto_pk_openssl_genkey,
+};
+
+struct crypto_backend *crypto_openssl_init(void)
+{
+	if (!OPENSSL_init_crypto(0, NULL)) {
+		crypto_openssl_error();
+		return NULL;
+	}
+
+	return &crypto_openssl_backend;
+}
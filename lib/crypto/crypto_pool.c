@@ -0,0 +1,150 @@
+/*
+ * libopenemv - a library to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Worker threads for the batch operations. A batch is a loop over
+ * independent items; workers and the calling thread take items one by
+ * one until none are left. The pool runs one batch at a time, a caller
+ * finding it busy does its batch alone.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "openemv/config.h"
+#include "crypto_backend.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+/* Upper bound on crypto.threads */
+#define CRYPTO_POOL_MAX_THREADS 256
+
+struct crypto_pool_job {
+	void (*fn)(void *arg, size_t i);
+	void *arg;
+	size_t n;
+	size_t next;
+	/* Workers which joined and are not done yet */
+	unsigned workers;
+};
+
+static pthread_mutex_t crypto_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t crypto_pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t crypto_pool_idle = PTHREAD_COND_INITIALIZER;
+static struct crypto_pool_job *crypto_pool_job;
+static unsigned long crypto_pool_generation;
+static pthread_once_t crypto_pool_once = PTHREAD_ONCE_INIT;
+static unsigned crypto_pool_threads;
+
+static void crypto_pool_do(struct crypto_pool_job *job)
+{
+	size_t i;
+
+	while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->n)
+		job->fn(job->arg, i);
+}
+
+static void *crypto_pool_worker(void *data)
+{
+	unsigned long seen = 0;
+	struct crypto_pool_job *job;
+
+	pthread_mutex_lock(&crypto_pool_lock);
+	while (true) {
+		while (!crypto_pool_job || crypto_pool_generation == seen)
+			pthread_cond_wait(&crypto_pool_work, &crypto_pool_lock);
+
+		seen = crypto_pool_generation;
+		job = crypto_pool_job;
+		job->workers++;
+		pthread_mutex_unlock(&crypto_pool_lock);
+
+		crypto_pool_do(job);
+
+		pthread_mutex_lock(&crypto_pool_lock);
+		if (!--job->workers)
+			pthread_cond_signal(&crypto_pool_idle);
+	}
+
+	return NULL;
+}
+
+/* "crypto.threads" counts the calling thread; 0 means one per CPU */
+static void crypto_pool_init_once(void)
+{
+	long threads = openemv_config_get_int("crypto.threads", 0);
+	pthread_attr_t attr;
+	pthread_t thread;
+	unsigned i;
+
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > CRYPTO_POOL_MAX_THREADS)
+		threads = CRYPTO_POOL_MAX_THREADS;
+	if (threads <= 1)
+		return;
+
+	if (pthread_attr_init(&attr))
+		return;
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	/* Whatever could be started */
+	for (i = 0; i < threads - 1; i++)
+		if (pthread_create(&thread, &attr, crypto_pool_worker, NULL))
+			break;
+	crypto_pool_threads = i;
+
+	pthread_attr_destroy(&attr);
+}
+
+void crypto_pool_run(void (*fn)(void *arg, size_t i), void *arg, size_t n)
+{
+	struct crypto_pool_job job = {
+		.fn = fn,
+		.arg = arg,
+		.n = n,
+	};
+
+	if (n > 1)
+		pthread_once(&crypto_pool_once, crypto_pool_init_once);
+
+	if (n <= 1 || !crypto_pool_threads) {
+		crypto_pool_do(&job);
+		return;
+	}
+
+	pthread_mutex_lock(&crypto_pool_lock);
+	if (crypto_pool_job) {
+		pthread_mutex_unlock(&crypto_pool_lock);
+		crypto_pool_do(&job);
+		return;
+	}
+
+	crypto_pool_job = &job;
+	crypto_pool_generation++;
+	pthread_cond_broadcast(&crypto_pool_work);
+	pthread_mutex_unlock(&crypto_pool_lock);
+
+	crypto_pool_do(&job);
+
+	/* No more workers may join; wait for those which did */
+	pthread_mutex_lock(&crypto_pool_lock);
+	crypto_pool_job = NULL;
+	while (job.workers)
+		pthread_cond_wait(&crypto_pool_idle, &crypto_pool_lock);
+	pthread_mutex_unlock(&crypto_pool_lock);
+}
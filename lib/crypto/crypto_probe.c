@@ -0,0 +1,320 @@
+/*
+ * libopenemv - a library to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * The "auto" driver: times what a certificate recovery costs, a 1408 bit
+ * public key operation and SHA-1 of 1 KiB, on each compiled in driver and
+ * keeps the fastest. The choice is written to crypto.auto_state, if set,
+ * and taken from there as long as the drivers and crypto.hash are the
+ * same. Drivers which lost stay initialised, but are not used.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "openemv/config.h"
+#include "openemv/crypto.h"
+#include "crypto_backend.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CRYPTO_PROBE_BITS 1408
+#define CRYPTO_PROBE_HASH_BYTES 1024
+#define CRYPTO_PROBE_ROUNDS 5
+#define CRYPTO_PROBE_OPS 16
+
+struct crypto_probe_driver {
+	const char *name;
+	struct crypto_backend *(*init)(void);
+};
+
+static const struct crypto_probe_driver crypto_probe_drivers[] = {
+#ifdef ENABLE_CRYPTO_LIBGCRYPT
+	{ "libgcrypt", crypto_libgcrypt_init },
+#endif
+#ifdef ENABLE_CRYPTO_NETTLE
+	{ "nettle", crypto_nettle_init },
+#endif
+#ifdef ENABLE_CRYPTO_OPENSSL
+	{ "openssl", crypto_openssl_init },
+#endif
+};
+
+#define CRYPTO_PROBE_DRIVERS (sizeof(crypto_probe_drivers) / sizeof(crypto_probe_drivers[0]))
+
+static double crypto_probe_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The timing does not depend on the modulus being a real RSA one */
+static void crypto_probe_fill(unsigned char *buf, size_t len)
+{
+	unsigned x = 0x2545f491;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		x = x * 1103515245 + 12345;
+		buf[i] = x >> 16;
+	}
+}
+
+static struct crypto_pk *crypto_probe_pk_open(struct crypto_backend *backend, ...)
+{
+	struct crypto_pk *cp;
+	va_list vl;
+
+	va_start(vl, backend);
+	cp = backend->pk_open(PK_RSA, vl);
+	va_end(vl);
+
+	return cp;
+}
+
+/* Seconds per public key operation, best of a few rounds; negative on failure */
+static double crypto_probe_pk(struct crypto_backend *backend)
+{
+	size_t mlen = CRYPTO_PROBE_BITS / 8;
+	unsigned char mod[CRYPTO_PROBE_BITS / 8], data[CRYPTO_PROBE_BITS / 8];
+	unsigned char exp[] = { 3 };
+	struct crypto_pk *cp;
+	double best = -1;
+	unsigned i, j;
+
+	crypto_probe_fill(mod, mlen);
+	mod[0] |= 0x80;
+	mod[mlen - 1] |= 1;
+	memcpy(data, mod, mlen);
+	data[0] &= 0x7f;
+
+	cp = crypto_probe_pk_open(backend, mod, mlen, exp, sizeof(exp));
+	if (!cp)
+		return -1;
+
+	/* Timed the way keys are used, once prepared */
+	if (cp->precompute && !cp->precompute(cp)) {
+		cp->close(cp);
+		return -1;
+	}
+
+	/* The first round warms the caches up and is not counted */
+	for (i = 0; i <= CRYPTO_PROBE_ROUNDS; i++) {
+		double start = crypto_probe_now(), elapsed;
+
+		for (j = 0; j < CRYPTO_PROBE_OPS; j++) {
+			size_t clen;
+			unsigned char *out = cp->encrypt(cp, data, mlen, &clen);
+
+			if (!out) {
+				cp->close(cp);
+				return -1;
+			}
+			free(out);
+		}
+
+		elapsed = (crypto_probe_now() - start) / CRYPTO_PROBE_OPS;
+		if (i && (best < 0 || elapsed < best))
+			best = elapsed;
+	}
+
+	cp->close(cp);
+
+	return best;
+}
+
+/* The same, for hashing 1 KiB with SHA-1 */
+static double crypto_probe_hash(struct crypto_backend *backend)
+{
+	unsigned char data[CRYPTO_PROBE_HASH_BYTES];
+	struct crypto_hash *ch;
+	double best = -1;
+	unsigned i, j;
+
+	crypto_probe_fill(data, sizeof(data));
+
+	ch = backend->hash_open(HASH_SHA_1);
+	if (!ch)
+		return -1;
+
+	for (i = 0; i <= CRYPTO_PROBE_ROUNDS; i++) {
+		double start = crypto_probe_now(), elapsed;
+
+		for (j = 0; j < CRYPTO_PROBE_OPS; j++) {
+			ch->write(ch, data, sizeof(data));
+			ch->read(ch);
+			ch->reset(ch);
+		}
+
+		elapsed = (crypto_probe_now() - start) / CRYPTO_PROBE_OPS;
+		if (i && (best < 0 || elapsed < best))
+			best = elapsed;
+	}
+
+	ch->close(ch);
+
+	return best;
+}
+
+/* What the cached choice depends on, as "libgcrypt,nettle:native:" */
+static void crypto_probe_key(char *key, size_t size, const char *hash)
+{
+	size_t i, pos = 0;
+
+	key[0] = 0;
+	for (i = 0; i < CRYPTO_PROBE_DRIVERS && pos < size; i++)
+		pos += snprintf(key + pos, size - pos, "%s%s", i ? "," : "", crypto_probe_drivers[i].name);
+
+	if (pos < size)
+		snprintf(key + pos, size - pos, ":%s:", hash);
+}
+
+/* Returns the cached driver index, -1 if there is none or it is stale */
+static int crypto_probe_load(const char *path, const char *key)
+{
+	char line[128];
+	size_t klen = strlen(key);
+	FILE *f;
+	char *nl;
+	unsigned i;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+
+	if (!fgets(line, sizeof(line), f)) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+
+	nl = strchr(line, '\n');
+	if (nl)
+		*nl = 0;
+
+	if (strncmp(line, key, klen))
+		return -1;
+
+	for (i = 0; i < CRYPTO_PROBE_DRIVERS; i++)
+		if (!strcmp(line + klen, crypto_probe_drivers[i].name))
+			return i;
+
+	return -1;
+}
+
+/*
+ * Replaces the state file at once, so that readers never see half of it.
+ * The temporary file has a unique name, processes starting together
+ * each writing their own.
+ */
+static void crypto_probe_store(const char *path, const char *key, const char *name)
+{
+	size_t size = strlen(path) + 8;
+	char *tmp = malloc(size);
+	FILE *f;
+	bool ok;
+	int fd;
+
+	if (!tmp)
+		return;
+
+	snprintf(tmp, size, "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		free(tmp);
+		return;
+	}
+
+	/* Nothing secret, readable as a plain fopen() would leave it */
+	fchmod(fd, 0644);
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		remove(tmp);
+		free(tmp);
+		return;
+	}
+
+	ok = fprintf(f, "%s%s\n", key, name) > 0;
+	if (fclose(f))
+		ok = false;
+
+	if (!ok || rename(tmp, path))
+		remove(tmp);
+
+	free(tmp);
+}
+
+struct crypto_backend *crypto_probe_init(void)
+{
+	const char *hash = openemv_config_get_def("crypto.hash", "driver");
+	const char *state = openemv_config_get("crypto.auto_state");
+	struct crypto_backend *backend, *best = NULL;
+	double best_time = 0;
+	char key[64];
+	int cached = -1;
+	unsigned i;
+
+	crypto_probe_key(key, sizeof(key), hash);
+
+	if (state) {
+		cached = crypto_probe_load(state, key);
+		if (cached >= 0) {
+			backend = crypto_probe_drivers[cached].init();
+			if (backend)
+				return backend;
+		}
+	}
+
+	for (i = 0; i < CRYPTO_PROBE_DRIVERS; i++) {
+		double pk_time, hash_time = 0;
+
+		backend = crypto_probe_drivers[i].init();
+		if (!backend)
+			continue;
+
+		pk_time = crypto_probe_pk(backend);
+		if (pk_time < 0)
+			continue;
+
+		/* With the built-in SHA-1, only the driver's public key code counts */
+		if (!strcmp(hash, "driver")) {
+			hash_time = crypto_probe_hash(backend);
+			if (hash_time < 0)
+				continue;
+		}
+
+		if (!best || pk_time + hash_time < best_time) {
+			best = backend;
+			best_time = pk_time + hash_time;
+			cached = i;
+		}
+	}
+
+	if (best && state)
+		crypto_probe_store(state, key, crypto_probe_drivers[cached].name);
+
+	return best;
+}
@@ -0,0 +1,591 @@
+/*
+ * libopenemv - a library to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Built-in SHA-1, independent of the crypto driver. The block function
+ * is picked once from what the CPU supports: SHA extensions, a vector
+ * message schedule with scalar rounds, or plain C.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "openemv/crypto.h"
+#include "crypto_backend.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRYPTO_SHA1_X86 1
+#include <immintrin.h>
+#endif
+
+#define SHA1_BLOCK_SIZE 64
+#define SHA1_DIGEST_SIZE 20
+
+#define SHA1_K0 0x5a827999
+#define SHA1_K1 0x6ed9eba1
+#define SHA1_K2 0x8f1bbcdc
+#define SHA1_K3 0xca62c1d6
+
+struct crypto_hash_sha1 {
+	struct crypto_hash ch;
+	uint32_t state[5];
+	uint64_t length;
+	size_t buflen;
+	unsigned char buf[SHA1_BLOCK_SIZE];
+	unsigned char digest[SHA1_DIGEST_SIZE];
+};
+
+static const uint32_t crypto_sha1_iv[5] = {
+	0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0,
+};
+
+#define SHA1_ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define SHA1_CH(b, c, d) ((d) ^ ((b) & ((c) ^ (d))))
+#define SHA1_PARITY(b, c, d) ((b) ^ (c) ^ (d))
+#define SHA1_MAJ(b, c, d) (((b) & (c)) | ((d) & ((b) | (c))))
+
+#define SHA1_ROUND(f, k, a, b, c, d, e, x) do {		\
+		e += SHA1_ROL(a, 5) + f(b, c, d) + (k) + (x);	\
+		b = SHA1_ROL(b, 30);				\
+	} while (0)
+
+/* Five rounds, after which the variables are back in place */
+#define SHA1_ROUND5(f, k, W, i) do {				\
+		SHA1_ROUND(f, k, a, b, c, d, e, W(i));		\
+		SHA1_ROUND(f, k, e, a, b, c, d, W((i) + 1));	\
+		SHA1_ROUND(f, k, d, e, a, b, c, W((i) + 2));	\
+		SHA1_ROUND(f, k, c, d, e, a, b, W((i) + 3));	\
+		SHA1_ROUND(f, k, b, c, d, e, a, W((i) + 4));	\
+	} while (0)
+
+/*
+ * All 80 rounds on a to e, fully unrolled, W(i) giving the message
+ * schedule word of round i (plus the constant, if k0 to k3 are zero).
+ * S(j) runs before the j-th five rounds, to interleave other work.
+ */
+#define SHA1_ROUNDS(W, S, k0, k1, k2, k3) do {			\
+		S(0); SHA1_ROUND5(SHA1_CH, k0, W, 0);		\
+		S(1); SHA1_ROUND5(SHA1_CH, k0, W, 5);		\
+		S(2); SHA1_ROUND5(SHA1_CH, k0, W, 10);		\
+		S(3); SHA1_ROUND5(SHA1_CH, k0, W, 15);		\
+		S(4); SHA1_ROUND5(SHA1_PARITY, k1, W, 20);	\
+		S(5); SHA1_ROUND5(SHA1_PARITY, k1, W, 25);	\
+		S(6); SHA1_ROUND5(SHA1_PARITY, k1, W, 30);	\
+		S(7); SHA1_ROUND5(SHA1_PARITY, k1, W, 35);	\
+		S(8); SHA1_ROUND5(SHA1_MAJ, k2, W, 40);		\
+		S(9); SHA1_ROUND5(SHA1_MAJ, k2, W, 45);		\
+		S(10); SHA1_ROUND5(SHA1_MAJ, k2, W, 50);	\
+		S(11); SHA1_ROUND5(SHA1_MAJ, k2, W, 55);	\
+		S(12); SHA1_ROUND5(SHA1_PARITY, k3, W, 60);	\
+		S(13); SHA1_ROUND5(SHA1_PARITY, k3, W, 65);	\
+		S(14); SHA1_ROUND5(SHA1_PARITY, k3, W, 70);	\
+		S(15); SHA1_ROUND5(SHA1_PARITY, k3, W, 75);	\
+	} while (0)
+
+#define SHA1_NOP(j) do { } while (0)
+
+/* Next schedule word for rounds 16 and on, in a ring of 16 words */
+#define SHA1_EXPAND(i) (w[(i) & 15] = SHA1_ROL(w[((i) + 13) & 15] ^	\
+			w[((i) + 8) & 15] ^ w[((i) + 2) & 15] ^		\
+			w[(i) & 15], 1))
+
+/* The schedule computed as the rounds go */
+#define SHA1_W(i) ((i) < 16 ?						\
+		(w[(i) & 15] = (uint32_t)data[4 * (i)] << 24 |		\
+			data[4 * (i) + 1] << 16 |			\
+			data[4 * (i) + 2] << 8 |			\
+			data[4 * (i) + 3]) :				\
+		SHA1_EXPAND(i))
+
+static void crypto_sha1_compress_c(uint32_t state[5], const unsigned char *data, size_t blocks)
+{
+	uint32_t a, b, c, d, e, w[16];
+
+	for (; blocks--; data += SHA1_BLOCK_SIZE) {
+		a = state[0];
+		b = state[1];
+		c = state[2];
+		d = state[3];
+		e = state[4];
+
+		SHA1_ROUNDS(SHA1_W, SHA1_NOP, SHA1_K0, SHA1_K1, SHA1_K2, SHA1_K3);
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+	}
+}
+
+#ifdef CRYPTO_SHA1_X86
+#define SHA1_WK(i) wk[i]
+#define SHA1_VROL(x, n) _mm_or_si128(_mm_slli_epi32(x, n), _mm_srli_epi32(x, 32 - (n)))
+
+/*
+ * Message schedule words 4 * g to 4 * g + 3, with the round constant
+ * added. w[i] depends on w[i - 3], so up to word 32 the last word of a
+ * group takes a second step; from there on the equivalent recurrence
+ *	w[i] = (w[i - 6] ^ w[i - 16] ^ w[i - 28] ^ w[i - 32]) <<< 2
+ * has no dependency within a group.
+ */
+#define SHA1_VSCHED(g) do {							\
+		if ((g) < 8) {							\
+			t = _mm_xor_si128(_mm_srli_si128(w[(g) - 1], 4), w[(g) - 2]); \
+			t = _mm_xor_si128(t, _mm_alignr_epi8(w[(g) - 3], w[(g) - 4], 8)); \
+			t = SHA1_VROL(_mm_xor_si128(t, w[(g) - 4]), 1);		\
+			w[g] = _mm_xor_si128(t, SHA1_VROL(_mm_slli_si128(t, 12), 1)); \
+		} else {							\
+			t = _mm_xor_si128(_mm_alignr_epi8(w[(g) - 1], w[(g) - 2], 8), w[(g) - 4]); \
+			t = _mm_xor_si128(t, _mm_xor_si128(w[(g) - 7], w[(g) - 8])); \
+			w[g] = SHA1_VROL(t, 2);					\
+		}								\
+		_mm_store_si128((__m128i *)&wk[4 * (g)], _mm_add_epi32(w[g], k[(g) / 5])); \
+	} while (0)
+
+/* Group j + 4 is ready well before the rounds of block j need it */
+#define SHA1_VSCHED_AHEAD(j) SHA1_VSCHED((j) + 4)
+
+/*
+ * Vector message schedule, computed alongside the scalar rounds so that
+ * it fills the execution slots the round dependency chain leaves free.
+ */
+__attribute__((target("ssse3")))
+static void crypto_sha1_compress_ssse3(uint32_t state[5], const unsigned char *data, size_t blocks)
+{
+	const __m128i bswap = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	const __m128i k[4] = {
+		_mm_set1_epi32(SHA1_K0), _mm_set1_epi32(SHA1_K1),
+		_mm_set1_epi32(SHA1_K2), _mm_set1_epi32(SHA1_K3),
+	};
+	uint32_t wk[80] __attribute__((aligned(16)));
+	uint32_t a, b, c, d, e;
+	__m128i w[20], t;
+	unsigned i;
+
+	for (; blocks--; data += SHA1_BLOCK_SIZE) {
+		for (i = 0; i < 4; i++) {
+			w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16 * i)), bswap);
+			_mm_store_si128((__m128i *)&wk[4 * i], _mm_add_epi32(w[i], k[0]));
+		}
+
+		a = state[0];
+		b = state[1];
+		c = state[2];
+		d = state[3];
+		e = state[4];
+
+		SHA1_ROUNDS(SHA1_WK, SHA1_VSCHED_AHEAD, 0, 0, 0, 0);
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+	}
+}
+
+/*
+ * Four rounds with the SHA extensions, for rounds 16 to 67 where the
+ * message schedule is updated alongside: cur holds the current message
+ * words, p1 to p3 the ones of the three previous groups.
+ */
+#define SHA1_NI_ROUNDS(f, e_in, e_out, cur, p1, p2, p3) do {	\
+		e_in = _mm_sha1nexte_epu32(e_in, cur);		\
+		e_out = abcd;					\
+		p3 = _mm_sha1msg2_epu32(p3, cur);		\
+		abcd = _mm_sha1rnds4_epu32(abcd, e_in, f);	\
+		p1 = _mm_sha1msg1_epu32(p1, cur);		\
+		p2 = _mm_xor_si128(p2, cur);			\
+	} while (0)
+
+__attribute__((target("sha,sse4.1")))
+static void crypto_sha1_compress_sha(uint32_t state[5], const unsigned char *data, size_t blocks)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, e0, e0_save, e1;
+	__m128i m0, m1, m2, m3;
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0x1b);
+	e0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+	for (; blocks--; data += SHA1_BLOCK_SIZE) {
+		abcd_save = abcd;
+		e0_save = e0;
+
+		m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)data), bswap);
+		e0 = _mm_add_epi32(e0, m0);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+		m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), bswap);
+		e1 = _mm_sha1nexte_epu32(e1, m1);
+		e0 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+		m0 = _mm_sha1msg1_epu32(m0, m1);
+
+		m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), bswap);
+		e0 = _mm_sha1nexte_epu32(e0, m2);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+		m1 = _mm_sha1msg1_epu32(m1, m2);
+		m0 = _mm_xor_si128(m0, m2);
+
+		m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), bswap);
+		e1 = _mm_sha1nexte_epu32(e1, m3);
+		e0 = abcd;
+		m0 = _mm_sha1msg2_epu32(m0, m3);
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+		m2 = _mm_sha1msg1_epu32(m2, m3);
+		m1 = _mm_xor_si128(m1, m3);
+
+		SHA1_NI_ROUNDS(0, e0, e1, m0, m3, m2, m1);
+		SHA1_NI_ROUNDS(1, e1, e0, m1, m0, m3, m2);
+		SHA1_NI_ROUNDS(1, e0, e1, m2, m1, m0, m3);
+		SHA1_NI_ROUNDS(1, e1, e0, m3, m2, m1, m0);
+		SHA1_NI_ROUNDS(1, e0, e1, m0, m3, m2, m1);
+		SHA1_NI_ROUNDS(1, e1, e0, m1, m0, m3, m2);
+		SHA1_NI_ROUNDS(2, e0, e1, m2, m1, m0, m3);
+		SHA1_NI_ROUNDS(2, e1, e0, m3, m2, m1, m0);
+		SHA1_NI_ROUNDS(2, e0, e1, m0, m3, m2, m1);
+		SHA1_NI_ROUNDS(2, e1, e0, m1, m0, m3, m2);
+		SHA1_NI_ROUNDS(2, e0, e1, m2, m1, m0, m3);
+		SHA1_NI_ROUNDS(3, e1, e0, m3, m2, m1, m0);
+		SHA1_NI_ROUNDS(3, e0, e1, m0, m3, m2, m1);
+
+		e1 = _mm_sha1nexte_epu32(e1, m1);
+		e0 = abcd;
+		m2 = _mm_sha1msg2_epu32(m2, m1);
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+		m3 = _mm_xor_si128(m3, m1);
+
+		e0 = _mm_sha1nexte_epu32(e0, m2);
+		e1 = abcd;
+		m3 = _mm_sha1msg2_epu32(m3, m2);
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+		e1 = _mm_sha1nexte_epu32(e1, m3);
+		e0 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+		e0 = _mm_sha1nexte_epu32(e0, e0_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+	}
+
+	_mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(abcd, 0x1b));
+	state[4] = _mm_extract_epi32(e0, 3);
+}
+#endif
+
+/*
+ * Multi-buffer kernels: one block of each of up to 4 or 8 independent
+ * messages, a message per vector lane. state is laid out word by word,
+ * state[LANES * i + lane]; lanes with a NULL block are left alone.
+ */
+typedef uint32_t crypto_sha1_v4 __attribute__((vector_size(16)));
+typedef uint32_t crypto_sha1_v8 __attribute__((vector_size(32)));
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define SHA1_BE32(x) (x)
+#else
+#define SHA1_BE32(x) __builtin_bswap32(x)
+#endif
+
+#define SHA1_MB_W(i) ((i) < 16 ? w[i] : SHA1_EXPAND(i))
+
+#define SHA1_MB_COMPRESS(vec, lanes, state, block) do {			\
+		uint32_t m[16][lanes] __attribute__((aligned(sizeof(vec)))); \
+		vec w[16], s[5], mask, a, b, c, d, e;			\
+		unsigned i, l;						\
+									\
+		for (l = 0; l < (lanes); l++) {				\
+			mask[l] = block[l] ? 0xffffffff : 0;		\
+			for (i = 0; i < 16; i++) {			\
+				uint32_t x = 0;				\
+									\
+				if (block[l])				\
+					memcpy(&x, block[l] + 4 * i, 4); \
+				m[i][l] = SHA1_BE32(x);			\
+			}						\
+		}							\
+		for (i = 0; i < 16; i++)				\
+			memcpy(&w[i], m[i], sizeof(vec));		\
+		for (i = 0; i < 5; i++)					\
+			memcpy(&s[i], state + (lanes) * i, sizeof(vec));	\
+									\
+		a = s[0];						\
+		b = s[1];						\
+		c = s[2];						\
+		d = s[3];						\
+		e = s[4];						\
+									\
+		SHA1_ROUNDS(SHA1_MB_W, SHA1_NOP, SHA1_K0, SHA1_K1, SHA1_K2, SHA1_K3); \
+									\
+		s[0] += a & mask;					\
+		s[1] += b & mask;					\
+		s[2] += c & mask;					\
+		s[3] += d & mask;					\
+		s[4] += e & mask;					\
+		for (i = 0; i < 5; i++)					\
+			memcpy(state + (lanes) * i, &s[i], sizeof(vec));	\
+	} while (0)
+
+static void crypto_sha1_many_x4(uint32_t *state, const unsigned char *const *block)
+{
+	SHA1_MB_COMPRESS(crypto_sha1_v4, 4, state, block);
+}
+
+#ifdef CRYPTO_SHA1_X86
+__attribute__((target("avx2")))
+static void crypto_sha1_many_x8(uint32_t *state, const unsigned char *const *block)
+{
+	SHA1_MB_COMPRESS(crypto_sha1_v8, 8, state, block);
+}
+#endif
+
+#define SHA1_MB_MAX_LANES 8
+
+static void (*crypto_sha1_compress)(uint32_t state[5], const unsigned char *data, size_t blocks) = crypto_sha1_compress_c;
+static void (*crypto_sha1_many_compress)(uint32_t *state, const unsigned char *const *block) = crypto_sha1_many_x4;
+static unsigned crypto_sha1_many_lanes = 4;
+
+bool crypto_sha1_init(const char *impl)
+{
+	bool any = !strcmp(impl, "native");
+
+	if (!any && strcmp(impl, "native-c") && strcmp(impl, "native-ssse3") && strcmp(impl, "native-sha"))
+		return false;
+
+	crypto_sha1_compress = crypto_sha1_compress_c;
+	crypto_sha1_many_compress = crypto_sha1_many_x4;
+	crypto_sha1_many_lanes = 4;
+#ifdef CRYPTO_SHA1_X86
+	/* Forcing an implementation the CPU lacks gets the portable one */
+	if ((any || !strcmp(impl, "native-sha")) && __builtin_cpu_supports("sha") &&
+	    __builtin_cpu_supports("sse4.1"))
+		crypto_sha1_compress = crypto_sha1_compress_sha;
+	else if ((any || !strcmp(impl, "native-ssse3")) && __builtin_cpu_supports("ssse3"))
+		crypto_sha1_compress = crypto_sha1_compress_ssse3;
+
+	if (__builtin_cpu_supports("avx2")) {
+		crypto_sha1_many_compress = crypto_sha1_many_x8;
+		crypto_sha1_many_lanes = 8;
+	}
+#endif
+
+	return true;
+}
+
+static void crypto_sha1_close(struct crypto_hash *_ch)
+{
+	struct crypto_hash_sha1 *ch = container_of(_ch, struct crypto_hash_sha1, ch);
+
+	free(ch);
+}
+
+static void crypto_sha1_reset(struct crypto_hash *_ch)
+{
+	struct crypto_hash_sha1 *ch = container_of(_ch, struct crypto_hash_sha1, ch);
+
+	memcpy(ch->state, crypto_sha1_iv, sizeof(ch->state));
+	ch->length = 0;
+	ch->buflen = 0;
+}
+
+static void crypto_sha1_write(struct crypto_hash *_ch, const unsigned char *buf, size_t len)
+{
+	struct crypto_hash_sha1 *ch = container_of(_ch, struct crypto_hash_sha1, ch);
+	size_t n;
+
+	if (!len)
+		return;
+
+	ch->length += len;
+
+	if (ch->buflen) {
+		n = SHA1_BLOCK_SIZE - ch->buflen;
+		if (n > len)
+			n = len;
+
+		memcpy(ch->buf + ch->buflen, buf, n);
+		ch->buflen += n;
+		buf += n;
+		len -= n;
+
+		if (ch->buflen < SHA1_BLOCK_SIZE)
+			return;
+
+		crypto_sha1_compress(ch->state, ch->buf, 1);
+		ch->buflen = 0;
+	}
+
+	n = len / SHA1_BLOCK_SIZE;
+	if (n) {
+		crypto_sha1_compress(ch->state, buf, n);
+		buf += n * SHA1_BLOCK_SIZE;
+		len -= n * SHA1_BLOCK_SIZE;
+	}
+
+	memcpy(ch->buf, buf, len);
+	ch->buflen = len;
+}
+
+static void crypto_sha1_writev(struct crypto_hash *ch, const struct iovec *iov, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		crypto_sha1_write(ch, iov[i].iov_base, iov[i].iov_len);
+}
+
+/*
+ * Final blocks for a message of length bytes ending with the tail bytes
+ * which did not fill a block. Returns their size, 64 or 128 bytes.
+ */
+static size_t crypto_sha1_pad(unsigned char pad[2 * SHA1_BLOCK_SIZE], const unsigned char *tail, size_t taillen, uint64_t length)
+{
+	uint64_t bits = length * 8;
+	size_t padlen;
+	unsigned i;
+
+	memcpy(pad, tail, taillen);
+	padlen = taillen < SHA1_BLOCK_SIZE - 8 ? SHA1_BLOCK_SIZE : 2 * SHA1_BLOCK_SIZE;
+	pad[taillen] = 0x80;
+	memset(pad + taillen + 1, 0, padlen - 8 - taillen - 1);
+	for (i = 0; i < 8; i++)
+		pad[padlen - 1 - i] = bits >> (8 * i);
+
+	return padlen;
+}
+
+/* Pads a copy of the state, so the context can go on being written */
+static unsigned char *crypto_sha1_read(struct crypto_hash *_ch)
+{
+	struct crypto_hash_sha1 *ch = container_of(_ch, struct crypto_hash_sha1, ch);
+	unsigned char pad[2 * SHA1_BLOCK_SIZE];
+	uint32_t state[5];
+	size_t padlen;
+	unsigned i;
+
+	memcpy(state, ch->state, sizeof(state));
+	padlen = crypto_sha1_pad(pad, ch->buf, ch->buflen, ch->length);
+
+	crypto_sha1_compress(state, pad, padlen / SHA1_BLOCK_SIZE);
+
+	for (i = 0; i < SHA1_DIGEST_SIZE; i++)
+		ch->digest[i] = state[i / 4] >> (24 - 8 * (i % 4));
+
+	return ch->digest;
+}
+
+struct crypto_sha1_lane {
+	const unsigned char *data;
+	/* Whole blocks in data, then the padded tail */
+	size_t full;
+	size_t blocks;
+	unsigned char pad[2 * SHA1_BLOCK_SIZE];
+};
+
+/* Up to one vector's worth of messages, in lockstep */
+static void crypto_sha1_many_group(const unsigned char *const *bufs, const size_t *lens, size_t n, unsigned char *digests)
+{
+	struct crypto_sha1_lane lane[SHA1_MB_MAX_LANES];
+	const unsigned char *block[SHA1_MB_MAX_LANES];
+	uint32_t state[5 * SHA1_MB_MAX_LANES];
+	unsigned lanes = crypto_sha1_many_lanes, l, i;
+	size_t j, blocks = 0;
+
+	for (l = 0; l < lanes; l++) {
+		for (i = 0; i < 5; i++)
+			state[lanes * i + l] = crypto_sha1_iv[i];
+
+		if (l >= n) {
+			lane[l].blocks = 0;
+			continue;
+		}
+
+		lane[l].data = bufs[l];
+		lane[l].full = lens[l] / SHA1_BLOCK_SIZE;
+		lane[l].blocks = lane[l].full + crypto_sha1_pad(lane[l].pad,
+				bufs[l] + lane[l].full * SHA1_BLOCK_SIZE,
+				lens[l] % SHA1_BLOCK_SIZE, lens[l]) / SHA1_BLOCK_SIZE;
+		if (lane[l].blocks > blocks)
+			blocks = lane[l].blocks;
+	}
+
+	for (j = 0; j < blocks; j++) {
+		for (l = 0; l < lanes; l++) {
+			if (j >= lane[l].blocks)
+				block[l] = NULL;
+			else if (j < lane[l].full)
+				block[l] = lane[l].data + j * SHA1_BLOCK_SIZE;
+			else
+				block[l] = lane[l].pad + (j - lane[l].full) * SHA1_BLOCK_SIZE;
+		}
+
+		crypto_sha1_many_compress(state, block);
+	}
+
+	for (l = 0; l < n; l++)
+		for (i = 0; i < SHA1_DIGEST_SIZE; i++)
+			digests[l * SHA1_DIGEST_SIZE + i] = state[lanes * (i / 4) + l] >> (24 - 8 * (i % 4));
+}
+
+/*
+ * Independent messages hashed side by side in vector lanes. A group of
+ * messages takes as long as its longest one, so similar lengths pay off.
+ */
+void crypto_sha1_many(const unsigned char *const *bufs, const size_t *lens, size_t n, unsigned char *digests)
+{
+	size_t done, group;
+
+	for (done = 0; done < n; done += group) {
+		group = n - done;
+		if (group > crypto_sha1_many_lanes)
+			group = crypto_sha1_many_lanes;
+
+		crypto_sha1_many_group(bufs + done, lens + done, group, digests + done * SHA1_DIGEST_SIZE);
+	}
+}
+
+static size_t crypto_sha1_get_size(const struct crypto_hash *ch)
+{
+	return SHA1_DIGEST_SIZE;
+}
+
+struct crypto_hash *crypto_sha1_open(void)
+{
+	struct crypto_hash_sha1 *ch = malloc(sizeof(*ch));
+
+	if (!ch)
+		return NULL;
+
+	crypto_sha1_reset(&ch->ch);
+
+	ch->ch.write = crypto_sha1_write;
+	ch->ch.writev = crypto_sha1_writev;
+	ch->ch.read = crypto_sha1_read;
+	ch->ch.reset = crypto_sha1_reset;
+	ch->ch.close = crypto_sha1_close;
+	ch->ch.get_size = crypto_sha1_get_size;
+
+	return &ch->ch;
+}
@@ -20,38 +20,170 @@
 #include "openemv/dump.h"
 
 #include <stdio.h>
+#include <string.h>
+
+#define DUMP_HEX16(h, a, b, c, d, e, f) \
+	h "0" h "1" h "2" h "3" h "4" h "5" h "6" h "7" \
+	h "8" h "9" h a h b h c h d h e h f
+#define DUMP_HEX256(a, b, c, d, e, f) \
+	DUMP_HEX16("0", a, b, c, d, e, f) DUMP_HEX16("1", a, b, c, d, e, f) \
+	DUMP_HEX16("2", a, b, c, d, e, f) DUMP_HEX16("3", a, b, c, d, e, f) \
+	DUMP_HEX16("4", a, b, c, d, e, f) DUMP_HEX16("5", a, b, c, d, e, f) \
+	DUMP_HEX16("6", a, b, c, d, e, f) DUMP_HEX16("7", a, b, c, d, e, f) \
+	DUMP_HEX16("8", a, b, c, d, e, f) DUMP_HEX16("9", a, b, c, d, e, f) \
+	DUMP_HEX16(a, a, b, c, d, e, f) DUMP_HEX16(b, a, b, c, d, e, f) \
+	DUMP_HEX16(c, a, b, c, d, e, f) DUMP_HEX16(d, a, b, c, d, e, f) \
+	DUMP_HEX16(e, a, b, c, d, e, f) DUMP_HEX16(f, a, b, c, d, e, f)
+
+/* Two hex digits for every byte value */
+static const char dump_hex_lower[512 + 1] = DUMP_HEX256("a", "b", "c", "d", "e", "f");
+static const char dump_hex_upper[512 + 1] = DUMP_HEX256("A", "B", "C", "D", "E", "F");
+
+/* Enough for a row with a 64-bit offset */
+#define DUMP_ROW_MAX	96
+
+static size_t dump_offset_digits(size_t off)
+{
+	size_t digits = 2;
+
+	while (digits < 2 * sizeof(off) && (off >> (4 * digits)))
+		digits++;
+
+	return digits;
+}
+
+static size_t dump_row_len(size_t off, size_t len)
+{
+	size_t n = len - off < 16 ? len - off : 16;
+
+	/* "\t" offset ":" 16 * " xx" " |" ascii "\n" */
+	return 1 + dump_offset_digits(off) + 1 + 16 * 3 + 2 + n + 1;
+}
+
+static size_t dump_row(char *out, const unsigned char *ptr, size_t off, size_t len)
+{
+	size_t digits = dump_offset_digits(off);
+	size_t n = len - off < 16 ? len - off : 16;
+	char *p = out;
+	size_t j;
+
+	*p++ = '\t';
+	for (j = digits; j > 0; j--)
+		*p++ = dump_hex_lower[2 * ((off >> (4 * (j - 1))) & 0xf) + 1];
+	*p++ = ':';
+
+	for (j = 0; j < n; j++) {
+		p[0] = ' ';
+		memcpy(p + 1, dump_hex_lower + 2 * ptr[off + j], 2);
+		p += 3;
+	}
+	memset(p, ' ', 3 * (16 - n));
+	p += 3 * (16 - n);
+
+	*p++ = ' ';
+	*p++ = '|';
+	for (j = 0; j < n; j++) {
+		unsigned char c = ptr[off + j];
+
+		*p++ = (c >= 0x20 && c < 0x7f) ? c : '.';
+	}
+	*p++ = '\n';
+
+	return p - out;
+}
+
+size_t dump_buffer_mem(const unsigned char *ptr, size_t len, char *buf, size_t size)
+{
+	char row[DUMP_ROW_MAX];
+	size_t i, total = 0, pos = 0, n;
+
+	for (i = 0; i < len; i += 16)
+		total += dump_row_len(i, len);
+
+	if (!size)
+		return total;
+
+	if (total < size) {
+		for (i = 0; i < len; i += 16)
+			pos += dump_row(buf + pos, ptr, i, len);
+	} else {
+		/* Truncate, formatting the last partial row on the side */
+		for (i = 0; i < len && pos < size - 1; i += 16) {
+			n = dump_row(row, ptr, i, len);
+			if (n > size - 1 - pos)
+				n = size - 1 - pos;
+			memcpy(buf + pos, row, n);
+			pos += n;
+		}
+	}
+	buf[pos] = 0;
+
+	return total;
+}
+
+size_t dump_buffer_simple_mem(const unsigned char *ptr, size_t len, char *buf, size_t size)
+{
+	size_t i, total = len ? 3 * len - 1 : 0, pos = 0;
+	char tmp[3];
+
+	if (!size)
+		return total;
+
+	tmp[0] = ' ';
+	for (i = 0; i < len && pos < size - 1; i++) {
+		const char *src = i ? tmp : tmp + 1;
+		size_t n = i ? 3 : 2;
+
+		memcpy(tmp + 1, dump_hex_upper + 2 * ptr[i], 2);
+		if (n > size - 1 - pos)
+			n = size - 1 - pos;
+		memcpy(buf + pos, src, n);
+		pos += n;
+	}
+	buf[pos] = 0;
+
+	return total;
+}
 
 void dump_buffer_simple(const unsigned char *ptr, size_t len, FILE *f)
 {
-	int i;
+	char buf[BUFSIZ];
+	size_t i, pos = 0;
 
 	if (!f)
 		f = stdout;
 
-	for (i = 0; i < len; i ++)
-		fprintf(f, "%s%02hhX", i ? " " : "", ptr[i]);
+	for (i = 0; i < len; i++) {
+		if (pos + 3 > sizeof(buf)) {
+			fwrite(buf, 1, pos, f);
+			pos = 0;
+		}
+		if (i)
+			buf[pos++] = ' ';
+		memcpy(buf + pos, dump_hex_upper + 2 * ptr[i], 2);
+		pos += 2;
+	}
+
+	if (pos)
+		fwrite(buf, 1, pos, f);
 }
 
 void dump_buffer(const unsigned char *ptr, size_t len, FILE *f)
 {
-	int i, j;
+	char buf[BUFSIZ];
+	size_t i, pos = 0;
 
 	if (!f)
 		f = stdout;
 
 	for (i = 0; i < len; i += 16) {
-		fprintf(f, "\t%02x:", i);
-		for (j = 0; j < 16; j++) {
-			if (i + j < len)
-				fprintf(f, " %02hhx", ptr[i + j]);
-			else
-				fprintf(f, "   ");
-		}
-		fprintf(f, " |");
-		for (j = 0; j < 16 && i + j < len; j++) {
-			fprintf(f, "%c", (ptr[i+j] >= 0x20 && ptr[i+j] < 0x7f) ? ptr[i+j] : '.' );
+		if (pos + DUMP_ROW_MAX > sizeof(buf)) {
+			fwrite(buf, 1, pos, f);
+			pos = 0;
 		}
-		fprintf(f, "\n");
+		pos += dump_row(buf + pos, ptr, i, len);
 	}
-}
 
+	if (pos)
+		fwrite(buf, 1, pos, f);
+}
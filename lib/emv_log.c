@@ -0,0 +1,358 @@
+/*
+ * libopenemv - a library to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "openemv/bcd.h"
+#include "openemv/emv_log.h"
+#include "openemv/emv_commands.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const struct emv_log_column_desc {
+	tlv_tag_t tag;
+	bool bcd;
+	size_t width;
+	size_t member;
+} emv_log_columns[EMV_LOG_COLUMNS] = {
+	[EMV_LOG_AMOUNT] = { 0x9f02, true, sizeof(uint64_t), offsetof(struct emv_log, amount) },
+	[EMV_LOG_AMOUNT_OTHER] = { 0x9f03, true, sizeof(uint64_t), offsetof(struct emv_log, amount_other) },
+	[EMV_LOG_CURRENCY] = { 0x5f2a, true, sizeof(uint16_t), offsetof(struct emv_log, currency) },
+	[EMV_LOG_COUNTRY] = { 0x9f1a, true, sizeof(uint16_t), offsetof(struct emv_log, country) },
+	[EMV_LOG_DATE] = { 0x9a, true, sizeof(uint32_t), offsetof(struct emv_log, date) },
+	[EMV_LOG_TIME] = { 0x9f21, true, sizeof(uint32_t), offsetof(struct emv_log, time) },
+	[EMV_LOG_TYPE] = { 0x9c, true, sizeof(uint8_t), offsetof(struct emv_log, type) },
+	[EMV_LOG_ATC] = { 0x9f36, false, sizeof(uint16_t), offsetof(struct emv_log, atc) },
+	[EMV_LOG_CID] = { 0x9f27, false, sizeof(uint8_t), offsetof(struct emv_log, cid) },
+};
+
+struct emv_log_plan {
+	size_t entry_len;
+	struct {
+		bool present;
+		size_t offset;
+		size_t len;
+	} col[EMV_LOG_COLUMNS];
+	struct tlv format;
+	unsigned char format_buf[];
+};
+
+struct emv_log_plan *emv_log_plan_compile(const struct tlv *format)
+{
+	struct emv_log_plan *plan;
+	const unsigned char *buf;
+	size_t left, pos = 0;
+	unsigned i;
+
+	if (!format || !format->len)
+		return NULL;
+
+	plan = calloc(1, sizeof(*plan) + format->len);
+	if (!plan)
+		return NULL;
+
+	memcpy(plan->format_buf, format->value, format->len);
+	plan->format.tag = format->tag;
+	plan->format.len = format->len;
+	plan->format.value = plan->format_buf;
+
+	buf = format->value;
+	left = format->len;
+	while (left) {
+		struct tlv tlv;
+
+		/* Log records are fixed size, so every field needs a length */
+		if (!tlv_parse_tl(&buf, &left, &tlv) || !tlv.len)
+			goto err;
+
+		for (i = 0; i < EMV_LOG_COLUMNS; i++) {
+			if (emv_log_columns[i].tag != tlv.tag || plan->col[i].present)
+				continue;
+
+			plan->col[i].present = true;
+			plan->col[i].offset = pos;
+			plan->col[i].len = tlv.len;
+		}
+
+		pos += tlv.len;
+	}
+
+	plan->entry_len = pos;
+
+	return plan;
+
+err:
+	free(plan);
+
+	return NULL;
+}
+
+static struct emv_log_plan *emv_log_plan_dup(const struct emv_log_plan *plan)
+{
+	struct emv_log_plan *copy = malloc(sizeof(*plan) + plan->format.len);
+
+	if (!copy)
+		return NULL;
+
+	memcpy(copy, plan, sizeof(*plan) + plan->format.len);
+	copy->format.value = copy->format_buf;
+
+	return copy;
+}
+
+void emv_log_plan_free(struct emv_log_plan *plan)
+{
+	free(plan);
+}
+
+size_t emv_log_plan_entry_len(const struct emv_log_plan *plan)
+{
+	return plan->entry_len;
+}
+
+bool emv_log_plan_has(const struct emv_log_plan *plan, enum emv_log_column column)
+{
+	return column < EMV_LOG_COLUMNS && plan->col[column].present;
+}
+
+bool emv_log_plan_field(const struct emv_log_plan *plan, tlv_tag_t tag, size_t *offset, size_t *len)
+{
+	const unsigned char *buf = plan->format.value;
+	size_t left = plan->format.len, pos = 0;
+	struct tlv tlv;
+
+	while (left && tlv_parse_tl(&buf, &left, &tlv)) {
+		if (tlv.tag == tag) {
+			*offset = pos;
+			*len = tlv.len;
+			return true;
+		}
+		pos += tlv.len;
+	}
+
+	return false;
+}
+
+const struct tlv *emv_log_plan_format(const struct emv_log_plan *plan)
+{
+	return &plan->format;
+}
+
+/* Takes the plan over, it is freed along with the log even on failure */
+static struct emv_log *emv_log_alloc(struct emv_log_plan *plan, unsigned capacity)
+{
+	struct emv_log *log;
+	unsigned i;
+
+	log = calloc(1, sizeof(*log));
+	if (!log) {
+		emv_log_plan_free(plan);
+		return NULL;
+	}
+
+	log->plan = plan;
+
+	log->capacity = capacity;
+	log->entry_len = plan->entry_len;
+
+	/* All storage is allocated up front, decoding does not allocate */
+	for (i = 0; i < EMV_LOG_COLUMNS; i++) {
+		void **column = (void **)((char *)log + emv_log_columns[i].member);
+
+		*column = calloc(capacity ? capacity : 1, emv_log_columns[i].width);
+		if (!*column)
+			goto err;
+	}
+
+	log->raw = malloc(capacity ? capacity * plan->entry_len : 1);
+	if (!log->raw)
+		goto err;
+
+	return log;
+
+err:
+	emv_log_free(log);
+
+	return NULL;
+}
+
+struct emv_log *emv_log_new(const struct emv_log_plan *plan, unsigned capacity)
+{
+	struct emv_log_plan *copy = emv_log_plan_dup(plan);
+
+	if (!copy)
+		return NULL;
+
+	return emv_log_alloc(copy, capacity);
+}
+
+void emv_log_free(struct emv_log *log)
+{
+	unsigned i;
+
+	if (!log)
+		return;
+
+	for (i = 0; i < EMV_LOG_COLUMNS; i++)
+		free(*(void **)((char *)log + emv_log_columns[i].member));
+
+	free(log->raw);
+	emv_log_plan_free((struct emv_log_plan *)log->plan);
+	free(log);
+}
+
+/* Columns are decoded this many records at a time */
+#define EMV_LOG_BATCH 64
+
+/* Decode the columns of count stored records, starting with first */
+static void emv_log_decode_columns(struct emv_log *log, unsigned first, unsigned count)
+{
+	const struct emv_log_plan *plan = log->plan;
+	uint64_t values[EMV_LOG_BATCH];
+	unsigned i, j, n;
+
+	for (i = 0; i < EMV_LOG_COLUMNS; i++) {
+		void *column = *(void **)((char *)log + emv_log_columns[i].member);
+		size_t len = plan->col[i].len;
+		unsigned done;
+
+		if (!plan->col[i].present)
+			continue;
+
+		for (done = 0; done < count; done += n) {
+			const unsigned char *p = log->raw + (first + done) * plan->entry_len + plan->col[i].offset;
+			unsigned at = first + done;
+
+			n = count - done < EMV_LOG_BATCH ? count - done : EMV_LOG_BATCH;
+
+			/* Records are entry_len apart, malformed BCD fields read as zero */
+			if (emv_log_columns[i].bcd) {
+				bcd_decode_batch(p, plan->entry_len, len, n, values, NULL);
+			} else {
+				for (j = 0; j < n; j++) {
+					const unsigned char *f = p + j * plan->entry_len;
+					size_t k;
+
+					values[j] = 0;
+					for (k = 0; k < len; k++)
+						values[j] = (values[j] << 8) | f[k];
+				}
+			}
+
+			for (j = 0; j < n; j++) {
+				switch (emv_log_columns[i].width) {
+				case sizeof(uint8_t):
+					((uint8_t *)column)[at + j] = values[j];
+					break;
+				case sizeof(uint16_t):
+					((uint16_t *)column)[at + j] = values[j];
+					break;
+				case sizeof(uint32_t):
+					((uint32_t *)column)[at + j] = values[j];
+					break;
+				case sizeof(uint64_t):
+					((uint64_t *)column)[at + j] = values[j];
+					break;
+				}
+			}
+		}
+	}
+}
+
+/* Store a record without decoding it yet */
+static bool emv_log_append(struct emv_log *log, const unsigned char *rec, size_t len)
+{
+	if (log->count == log->capacity || len != log->entry_len)
+		return false;
+
+	memcpy(log->raw + log->count * log->entry_len, rec, len);
+	log->count++;
+
+	return true;
+}
+
+bool emv_log_decode(struct emv_log *log, const unsigned char *rec, size_t len)
+{
+	if (!emv_log_append(log, rec, len))
+		return false;
+
+	emv_log_decode_columns(log, log->count - 1, 1);
+
+	return true;
+}
+
+static struct tlvdb *emv_log_get_format(struct sc *sc, const struct tlvdb *db, const struct tlv **format)
+{
+	struct tlvdb *data;
+
+	*format = tlvdb_get(db, 0x9f4f, NULL);
+	if (*format)
+		return NULL;
+
+	data = emv_get_data(sc, 0x9f4f);
+	*format = tlvdb_get(data, 0x9f4f, NULL);
+
+	return data;
+}
+
+struct emv_log *emv_log_read(struct sc *sc, const struct tlvdb *db)
+{
+	const struct tlv *entry = tlvdb_get(db, 0x9f4d, NULL);
+	const struct tlv *format;
+	struct emv_log_plan *plan;
+	struct tlvdb *format_db;
+	struct emv_log *log;
+	unsigned char sfi;
+	unsigned rec;
+
+	if (!entry || entry->len != 2)
+		return NULL;
+
+	sfi = entry->value[0];
+	if (sfi == 0 || sfi > 30)
+		return NULL;
+
+	format_db = emv_log_get_format(sc, db, &format);
+	plan = emv_log_plan_compile(format);
+	tlvdb_free(format_db);
+	if (!plan)
+		return NULL;
+
+	log = emv_log_alloc(plan, entry->value[1]);
+	if (!log)
+		return NULL;
+
+	for (rec = 1; rec <= entry->value[1]; rec++) {
+		unsigned short sw;
+		size_t len;
+		unsigned char *buf = emv_read_record(sc, sfi, rec, &sw, &len);
+
+		if (!buf)
+			continue;
+
+		if (sw == 0x9000 && !emv_log_append(log, buf, len))
+			log->skipped++;
+
+		free(buf);
+	}
+
+	/* A column at a time, over all records */
+	emv_log_decode_columns(log, 0, log->count);
+
+	return log;
+}
@@ -0,0 +1,199 @@
+/*
+ * libopenemv - a library to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Cache of opened public key handles. The same CA and issuer keys are
+ * used over and over, while opening a handle means importing the modulus
+ * into the backend. Handles are reference counted, so an entry evicted
+ * from the cache stays valid for whoever still holds it.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "openemv/emv_pk.h"
+#include "openemv/crypto.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EMV_PK_CACHE_SIZE 32
+
+struct emv_pk_cache_entry {
+	/* Least recently used list, most recent first */
+	struct emv_pk_cache_entry *prev, *next;
+	uint64_t hash;
+	unsigned char pk_algo;
+	size_t mlen;
+	size_t elen;
+	struct crypto_pk *cp;
+	/* Modulus, then exponent */
+	unsigned char key[];
+};
+
+static pthread_mutex_t emv_pk_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct emv_pk_cache_entry *emv_pk_cache_head, *emv_pk_cache_tail;
+static unsigned emv_pk_cache_count;
+
+/* FNV-1a over the algorithm, exponent and modulus */
+static uint64_t emv_pk_cache_hash(const struct emv_pk *pk)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	h = (h ^ pk->pk_algo) * 0x100000001b3ULL;
+	for (i = 0; i < pk->elen; i++)
+		h = (h ^ pk->exp[i]) * 0x100000001b3ULL;
+	for (i = 0; i < pk->mlen; i++)
+		h = (h ^ pk->modulus[i]) * 0x100000001b3ULL;
+
+	return h;
+}
+
+static void emv_pk_cache_unlink(struct emv_pk_cache_entry *e)
+{
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		emv_pk_cache_head = e->next;
+
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		emv_pk_cache_tail = e->prev;
+
+	emv_pk_cache_count--;
+}
+
+static void emv_pk_cache_push(struct emv_pk_cache_entry *e)
+{
+	e->prev = NULL;
+	e->next = emv_pk_cache_head;
+	if (emv_pk_cache_head)
+		emv_pk_cache_head->prev = e;
+	else
+		emv_pk_cache_tail = e;
+	emv_pk_cache_head = e;
+
+	emv_pk_cache_count++;
+}
+
+/* Looks the key up and takes a reference; called with the lock held */
+static struct crypto_pk *emv_pk_cache_find(const struct emv_pk *pk, uint64_t hash)
+{
+	struct emv_pk_cache_entry *e;
+
+	for (e = emv_pk_cache_head; e; e = e->next) {
+		if (e->hash != hash || e->pk_algo != pk->pk_algo ||
+		    e->mlen != pk->mlen || e->elen != pk->elen ||
+		    memcmp(e->key, pk->modulus, pk->mlen) ||
+		    memcmp(e->key + pk->mlen, pk->exp, pk->elen))
+			continue;
+
+		if (e != emv_pk_cache_head) {
+			emv_pk_cache_unlink(e);
+			emv_pk_cache_push(e);
+		}
+
+		return crypto_pk_ref(e->cp);
+	}
+
+	return NULL;
+}
+
+struct crypto_pk *emv_pk_crypto_open(const struct emv_pk *pk)
+{
+	uint64_t hash = emv_pk_cache_hash(pk);
+	struct emv_pk_cache_entry *e, *victim = NULL;
+	struct crypto_pk *cp, *cached;
+
+	pthread_mutex_lock(&emv_pk_cache_lock);
+	cp = emv_pk_cache_find(pk, hash);
+	pthread_mutex_unlock(&emv_pk_cache_lock);
+
+	if (cp)
+		return cp;
+
+	/* Importing the key is the slow part, do it unlocked */
+	cp = crypto_pk_open(pk->pk_algo,
+			pk->modulus, pk->mlen,
+			pk->exp, pk->elen);
+	if (!cp)
+		return NULL;
+
+	/* Cached keys are long lived; failing this only costs speed */
+	crypto_pk_precompute(cp);
+
+	e = malloc(sizeof(*e) + pk->mlen + pk->elen);
+	if (!e)
+		return cp;
+
+	e->hash = hash;
+	e->pk_algo = pk->pk_algo;
+	e->mlen = pk->mlen;
+	e->elen = pk->elen;
+	e->cp = crypto_pk_ref(cp);
+	memcpy(e->key, pk->modulus, pk->mlen);
+	memcpy(e->key + pk->mlen, pk->exp, pk->elen);
+
+	pthread_mutex_lock(&emv_pk_cache_lock);
+
+	/* Another thread might have opened the same key meanwhile */
+	cached = emv_pk_cache_find(pk, hash);
+	if (!cached) {
+		emv_pk_cache_push(e);
+		if (emv_pk_cache_count > EMV_PK_CACHE_SIZE) {
+			victim = emv_pk_cache_tail;
+			emv_pk_cache_unlink(victim);
+		}
+		e = NULL;
+	}
+
+	pthread_mutex_unlock(&emv_pk_cache_lock);
+
+	if (cached) {
+		crypto_pk_close(e->cp);
+		crypto_pk_close(cp);
+		free(e);
+		cp = cached;
+	}
+
+	if (victim) {
+		crypto_pk_close(victim->cp);
+		free(victim);
+	}
+
+	return cp;
+}
+
+void emv_pk_cache_flush(void)
+{
+	struct emv_pk_cache_entry *e, *next;
+
+	pthread_mutex_lock(&emv_pk_cache_lock);
+	e = emv_pk_cache_head;
+	emv_pk_cache_head = emv_pk_cache_tail = NULL;
+	emv_pk_cache_count = 0;
+	pthread_mutex_unlock(&emv_pk_cache_lock);
+
+	for (; e; e = next) {
+		next = e->next;
+		crypto_pk_close(e->cp);
+		free(e);
+	}
+}
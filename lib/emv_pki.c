@@ -29,56 +29,81 @@ static const struct tlv empty_tlv = {.tag = 0x0, .len = 0, .value = empty_tlv_va
 
 static size_t emv_pki_hash_psn[256] = { 0, 0, 11, 2, 17, 2, };
 
-static unsigned char *emv_pki_decode_message(const struct emv_pk *enc_pk,
+/* Buffers gathered for crypto_hash_writev(), written out when full */
+#define EMV_PKI_HASH_IOV 32
+
+struct emv_pki_hash_iov {
+	struct crypto_hash *ch;
+	int n;
+	struct iovec iov[EMV_PKI_HASH_IOV];
+	unsigned char tl[EMV_PKI_HASH_IOV / 2][TLV_TL_MAX];
+};
+
+static void emv_pki_hash_add(struct emv_pki_hash_iov *hv, const void *buf, size_t len)
+{
+	if (hv->n == EMV_PKI_HASH_IOV) {
+		crypto_hash_writev(hv->ch, hv->iov, hv->n);
+		hv->n = 0;
+	}
+
+	hv->iov[hv->n].iov_base = (void *)buf;
+	hv->iov[hv->n].iov_len = len;
+	hv->n++;
+}
+
+static void emv_pki_hash_flush(struct emv_pki_hash_iov *hv)
+{
+	crypto_hash_writev(hv->ch, hv->iov, hv->n);
+	hv->n = 0;
+}
+
+/* data must have room for EMV_PK_MAX_MODULUS bytes */
+static bool emv_pki_decode_message(const struct emv_pk *enc_pk,
 		uint8_t msgtype,
+		unsigned char *data,
 		size_t *len,
 		const struct tlv *cert_tlv,
 		... /* A list of tlv pointers, end with NULL */
 		)
 {
 	struct crypto_pk *kcp;
-	unsigned char *data;
 	size_t data_len;
 	va_list vl;
 
 	if (!enc_pk)
-		return NULL;
+		return false;
 
 	if (!cert_tlv)
-		return NULL;
+		return false;
 
-	if (cert_tlv->len != enc_pk->mlen)
-		return NULL;
+	if (cert_tlv->len != enc_pk->mlen || enc_pk->mlen > EMV_PK_MAX_MODULUS)
+		return false;
 
-	kcp = crypto_pk_open(enc_pk->pk_algo,
-			enc_pk->modulus, enc_pk->mlen,
-			enc_pk->exp, enc_pk->elen);
+	kcp = emv_pk_crypto_open(enc_pk);
 	if (!kcp)
-		return NULL;
+		return false;
 
-	data = crypto_pk_encrypt(kcp, cert_tlv->value, cert_tlv->len, &data_len);
+	data_len = crypto_pk_encrypt_into(kcp, cert_tlv->value, cert_tlv->len, data, EMV_PK_MAX_MODULUS);
 	crypto_pk_close(kcp);
+	if (!data_len)
+		return false;
 
-	if (data[data_len-1] != 0xbc || data[0] != 0x6a || data[1] != msgtype) {
-		free(data);
-		return NULL;
-	}
+	if (data[data_len-1] != 0xbc || data[0] != 0x6a || data[1] != msgtype)
+		return false;
 
 	size_t hash_pos = emv_pki_hash_psn[msgtype];
-	if (hash_pos == 0 || hash_pos > data_len){
-		free(data);
-		return NULL;
-	}
+	if (hash_pos == 0 || hash_pos > data_len)
+		return false;
 
 	struct crypto_hash *ch;
 	ch = crypto_hash_open(data[hash_pos]);
-	if (!ch) {
-		free(data);
-		return NULL;
-	}
+	if (!ch)
+		return false;
 
 	size_t hash_len = crypto_hash_get_size(ch);
-	crypto_hash_write(ch, data + 1, data_len - 2 - hash_len);
+	struct emv_pki_hash_iov hv = { .ch = ch };
+
+	emv_pki_hash_add(&hv, data + 1, data_len - 2 - hash_len);
 
 	va_start(vl, cert_tlv);
 	while (true) {
@@ -86,21 +111,22 @@ static unsigned char *emv_pki_decode_message(const struct emv_pk *enc_pk,
 		if (!add_tlv)
 			break;
 
-		crypto_hash_write(ch, add_tlv->value, add_tlv->len);
+		emv_pki_hash_add(&hv, add_tlv->value, add_tlv->len);
 	}
 	va_end(vl);
 
+	emv_pki_hash_flush(&hv);
+
 	if (memcmp(data + data_len - 1 - hash_len, crypto_hash_read(ch), hash_len)) {
 		crypto_hash_close(ch);
-		free(data);
-		return NULL;
+		return false;
 	}
 
 	crypto_hash_close(ch);
 
 	*len = data_len - hash_len - 1;
 
-	return data;
+	return true;
 }
 
 static unsigned emv_cn_length(const struct tlv *tlv)
@@ -143,7 +169,7 @@ static struct emv_pk *emv_pki_decode_key(const struct emv_pk *enc_pk,
 		)
 {
 	size_t pan_length;
-	unsigned char *data;
+	unsigned char data[EMV_PK_MAX_MODULUS];
 	size_t data_len;
 	size_t pk_len;
 
@@ -160,13 +186,13 @@ static struct emv_pk *emv_pki_decode_key(const struct emv_pk *enc_pk,
 	else
 		return NULL;
 
-	data = emv_pki_decode_message(enc_pk, msgtype, &data_len,
+	if (!emv_pki_decode_message(enc_pk, msgtype, data, &data_len,
 			cert_tlv,
 			rem_tlv,
 			exp_tlv,
 			add_tlv,
-			NULL);
-	if (!data || data_len < 11 + pan_length)
+			NULL) ||
+	    data_len < 11 + pan_length)
 		return NULL;
 
 	/* Perform the rest of checks here */
@@ -180,30 +206,20 @@ static struct emv_pk *emv_pki_decode_key(const struct emv_pk *enc_pk,
 	unsigned pan2_len = emv_cn_length(&pan2_tlv);
 
 	if (((msgtype == 2) && (pan2_len < 4 || pan2_len > pan_len)) ||
-	    ((msgtype == 4) && (pan2_len != pan_len))) {
-		free(data);
-
+	    ((msgtype == 4) && (pan2_len != pan_len)))
 		return NULL;
-	}
 
 	unsigned i;
 	for (i = 0; i < pan2_len; i++)
-		if (emv_cn_get(pan_tlv, i) != emv_cn_get(&pan2_tlv, i)) {
-			free(data);
-
+		if (emv_cn_get(pan_tlv, i) != emv_cn_get(&pan2_tlv, i))
 			return NULL;
-		}
 
 	pk_len = data[9 + pan_length];
-	if (pk_len > data_len - 11 - pan_length + rem_tlv->len) {
-		free(data);
+	if (pk_len > data_len - 11 - pan_length + rem_tlv->len)
 		return NULL;
-	}
 
-	if (exp_tlv->len != data[10 + pan_length]) {
-		free(data);
+	if (exp_tlv->len != data[10 + pan_length])
 		return NULL;
-	}
 
 	struct emv_pk *pk = emv_pk_new(pk_len, exp_tlv->len);
 
@@ -224,8 +240,6 @@ static struct emv_pk *emv_pki_decode_key(const struct emv_pk *enc_pk,
 	memcpy(pk->modulus + data_len - (11 + pan_length), rem_tlv->value, rem_tlv->len);
 	memcpy(pk->exp, exp_tlv->value, exp_tlv->len);
 
-	free(data);
-
 	return pk;
 }
 
@@ -270,19 +284,18 @@ struct tlvdb *emv_pki_recover_dac(const struct emv_pk *enc_pk, const struct tlvd
 		.len = sda_data_len,
 		.value = sda_data,
 	};
+	unsigned char data[EMV_PK_MAX_MODULUS];
 	size_t data_len;
-	unsigned char *data = emv_pki_decode_message(enc_pk, 3, &data_len,
+
+	if (!emv_pki_decode_message(enc_pk, 3, data, &data_len,
 			tlvdb_get(db, 0x93, NULL),
 			&sda_tlv,
-			NULL);
-
-	if (!data || data_len < 5)
+			NULL) ||
+	    data_len < 5)
 		return NULL;
 
 	struct tlvdb *dac_db = tlvdb_fixed(0x9f45, 2, data+3);
 
-	free(data);
-
 	return dac_db;
 }
 
@@ -292,37 +305,32 @@ struct tlvdb *emv_pki_recover_idn(const struct emv_pk *enc_pk, const struct tlvd
 		.len = dyn_data_len,
 		.value = dyn_data,
 	};
+	unsigned char data[EMV_PK_MAX_MODULUS];
 	size_t data_len;
-	unsigned char *data = emv_pki_decode_message(enc_pk, 5, &data_len,
+
+	if (!emv_pki_decode_message(enc_pk, 5, data, &data_len,
 			tlvdb_get(db, 0x9f4b, NULL),
 			&dyn_tlv,
-			NULL);
-
-	if (!data || data_len < 3)
+			NULL) ||
+	    data_len < 3)
 		return NULL;
 
-	if (data[3] < 2 || data[3] > data_len - 3) {
-		free(data);
+	if (data[3] < 2 || data[3] > data_len - 3)
 		return NULL;
-	}
 
 	size_t idn_len = data[4];
-	if (idn_len > data[3] - 1) {
-		free(data);
+	if (idn_len > data[3] - 1)
 		return NULL;
-	}
 
 	struct tlvdb *idn_db = tlvdb_fixed(0x9f4c, idn_len, data + 5);
-	free(data);
 
 	return idn_db;
 }
 
 static bool tlv_hash(void *data, const struct tlv *tlv)
 {
-	struct crypto_hash *ch = data;
-	size_t tag_len;
-	unsigned char *tag;
+	struct emv_pki_hash_iov *hv = data;
+	unsigned char *tl;
 
 	if (tlv_is_constructed(tlv))
 		return true;
@@ -330,9 +338,13 @@ static bool tlv_hash(void *data, const struct tlv *tlv)
 	if (tlv->tag == 0x9f4b)
 		return true;
 
-	tag = tlv_encode(tlv, &tag_len);
-	crypto_hash_write(ch, tag, tag_len);
-	free(tag);
+	/* Header and value go in together, so that tl[] is never reused early */
+	if (hv->n > EMV_PKI_HASH_IOV - 2)
+		emv_pki_hash_flush(hv);
+
+	tl = hv->tl[hv->n / 2];
+	emv_pki_hash_add(hv, tl, tlv_encode_tl(tlv, tl));
+	emv_pki_hash_add(hv, tlv->value, tlv->len);
 
 	return true;
 }
@@ -349,52 +361,47 @@ struct tlvdb *emv_pki_perform_cda(const struct emv_pk *enc_pk, const struct tlvd
 	if (!un_tlv || !cid_tlv)
 		return NULL;
 
+	unsigned char data[EMV_PK_MAX_MODULUS];
 	size_t data_len;
-	unsigned char *data = emv_pki_decode_message(enc_pk, 5, &data_len,
+
+	if (!emv_pki_decode_message(enc_pk, 5, data, &data_len,
 			tlvdb_get(this_db, 0x9f4b, NULL),
 			un_tlv,
-			NULL);
-	if (!data || data_len < 3)
+			NULL) ||
+	    data_len < 3)
 		return NULL;
 
-	if (data[3] < 30 || data[3] > data_len - 4) {
-		free(data);
+	if (data[3] < 30 || data[3] > data_len - 4)
 		return NULL;
-	}
 
-	if (!cid_tlv || cid_tlv->len != 1 || cid_tlv->value[0] != data[5 + data[4]]) {
-		free(data);
+	if (!cid_tlv || cid_tlv->len != 1 || cid_tlv->value[0] != data[5 + data[4]])
 		return NULL;
-	}
 
 	struct crypto_hash *ch;
 	ch = crypto_hash_open(enc_pk->hash_algo);
-	if (!ch) {
-		free(data);
+	if (!ch)
 		return NULL;
-	}
 
-	crypto_hash_write(ch, pdol_data, pdol_data_len);
-	crypto_hash_write(ch, crm1_data, crm1_data_len);
-	crypto_hash_write(ch, crm2_data, crm2_data_len);
+	struct emv_pki_hash_iov hv = { .ch = ch };
+
+	emv_pki_hash_add(&hv, pdol_data, pdol_data_len);
+	emv_pki_hash_add(&hv, crm1_data, crm1_data_len);
+	emv_pki_hash_add(&hv, crm2_data, crm2_data_len);
 
-	tlvdb_visit(this_db, tlv_hash, ch);
+	tlvdb_visit(this_db, tlv_hash, &hv);
+	emv_pki_hash_flush(&hv);
 
 	if (memcmp(data + 5 + data[4] + 1 + 8, crypto_hash_read(ch), 20)) {
 		crypto_hash_close(ch);
-		free(data);
 		return NULL;
 	}
 	crypto_hash_close(ch);
 
 	size_t idn_len = data[4];
-	if (idn_len > data[3] - 1) {
-		free(data);
+	if (idn_len > data[3] - 1)
 		return NULL;
-	}
 
 	struct tlvdb *idn_db = tlvdb_fixed(0x9f4c, idn_len, data + 5);
-	free(data);
 
 	return idn_db;
 }
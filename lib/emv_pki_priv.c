@@ -86,17 +86,14 @@ static struct tlvdb *emv_pki_sign_message(const struct crypto_pk *cp,
 		)
 {
 	size_t tmp_len = (crypto_pk_get_nbits(cp) + 7) / 8;
-	unsigned char *tmp = malloc(tmp_len);
-	if (!tmp)
+	unsigned char tmp[EMV_PK_MAX_MODULUS];
+	if (tmp_len > sizeof(tmp))
 		return NULL;
 
 	// XXX
 	struct crypto_hash *ch = crypto_hash_open(HASH_SHA_1);
-	if (!ch) {
-		free(tmp);
-
+	if (!ch)
 		return NULL;
-	}
 
 	tmp[0] = 0x6a;
 	tmp[tmp_len - 1] = 0xbc;
@@ -134,7 +131,6 @@ static struct tlvdb *emv_pki_sign_message(const struct crypto_pk *cp,
 	unsigned char *h = crypto_hash_read(ch);
 	if (!h) {
 		crypto_hash_close(ch);
-		free(tmp);
 
 		return NULL;
 	}
@@ -142,15 +138,12 @@ static struct tlvdb *emv_pki_sign_message(const struct crypto_pk *cp,
 	memcpy(tmp + 1 + part_len, h, hash_len);
 	crypto_hash_close(ch);
 
-	size_t cert_len;
-	unsigned char *cert = crypto_pk_decrypt(cp, tmp, tmp_len, &cert_len);
-	free(tmp);
-
-	if (!cert)
+	/* The signature can be computed in place */
+	size_t cert_len = crypto_pk_decrypt_into(cp, tmp, tmp_len, tmp, sizeof(tmp));
+	if (!cert_len)
 		return NULL;
 
-	struct tlvdb *db = tlvdb_fixed(cert_tag, cert_len, cert);
-	free(cert);
+	struct tlvdb *db = tlvdb_fixed(cert_tag, cert_len, tmp);
 	if (!db)
 		return NULL;
 
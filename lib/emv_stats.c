@@ -0,0 +1,481 @@
+/*
+ * libopenemv - a library to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "openemv/emv_stats.h"
+#include "emv_tags_priv.h"
+#include "outbuf.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Every distinct value of up to EMV_STATS_VALUE_LEN bytes is counted
+ * exactly, so that merged partial aggregates match a single pass. Only
+ * the EMV_STATS_VALUES most common are written out; the rest, and
+ * longer values, count as "other".
+ */
+#define EMV_STATS_VALUES	16
+#define EMV_STATS_VALUE_LEN	8
+
+struct emv_stats_value {
+	unsigned long count;
+	unsigned char len;
+	unsigned char value[EMV_STATS_VALUE_LEN];
+};
+
+struct emv_stats_tag {
+	tlv_tag_t tag;
+	unsigned long count;
+	unsigned long cards;
+	/* Card which last contained the tag, so repeats count once */
+	unsigned long last_card;
+	size_t min_len;
+	size_t max_len;
+	unsigned long long total_len;
+	/* Values longer than EMV_STATS_VALUE_LEN */
+	unsigned long other;
+	/* Open addressing on the value, like the tags */
+	struct emv_stats_value *values;
+	unsigned nvalues;
+	unsigned vsize;
+};
+
+/* Open addressing on the tag; an entry with no occurrences is free */
+struct emv_stats {
+	struct emv_stats_tag *tags;
+	unsigned ntags;
+	unsigned size;
+	unsigned long cards;
+	bool failed;
+};
+
+#define EMV_STATS_MIN_SIZE 64
+#define EMV_STATS_MIN_VALUES 8
+
+struct emv_stats *emv_stats_new(void)
+{
+	struct emv_stats *stats = calloc(1, sizeof(*stats));
+
+	if (!stats)
+		return NULL;
+
+	stats->tags = calloc(EMV_STATS_MIN_SIZE, sizeof(*stats->tags));
+	if (!stats->tags) {
+		free(stats);
+		return NULL;
+	}
+	stats->size = EMV_STATS_MIN_SIZE;
+
+	return stats;
+}
+
+void emv_stats_free(struct emv_stats *stats)
+{
+	unsigned i;
+
+	if (!stats)
+		return;
+
+	for (i = 0; i < stats->size; i++)
+		free(stats->tags[i].values);
+	free(stats->tags);
+	free(stats);
+}
+
+unsigned long emv_stats_cards(const struct emv_stats *stats)
+{
+	return stats->cards;
+}
+
+static struct emv_stats_tag *emv_stats_slot(struct emv_stats_tag *tags, unsigned size, tlv_tag_t tag)
+{
+	unsigned i = emv_tags_hash_mix(tag, 0) & (size - 1);
+
+	while (tags[i].count && tags[i].tag != tag)
+		i = (i + 1) & (size - 1);
+
+	return &tags[i];
+}
+
+static bool emv_stats_grow(struct emv_stats *stats)
+{
+	unsigned size = stats->size * 2, i;
+	struct emv_stats_tag *tags = calloc(size, sizeof(*tags));
+
+	if (!tags)
+		return false;
+
+	for (i = 0; i < stats->size; i++)
+		if (stats->tags[i].count)
+			*emv_stats_slot(tags, size, stats->tags[i].tag) = stats->tags[i];
+
+	free(stats->tags);
+	stats->tags = tags;
+	stats->size = size;
+
+	return true;
+}
+
+/* Find the entry for a tag, adding an empty one (which must then be counted) */
+static struct emv_stats_tag *emv_stats_get(struct emv_stats *stats, tlv_tag_t tag)
+{
+	struct emv_stats_tag *t = emv_stats_slot(stats->tags, stats->size, tag);
+
+	if (t->count)
+		return t;
+
+	/* Keep the load factor under 3/4 */
+	if ((stats->ntags + 1) * 4 > stats->size * 3) {
+		if (!emv_stats_grow(stats))
+			return NULL;
+		t = emv_stats_slot(stats->tags, stats->size, tag);
+	}
+
+	memset(t, 0, sizeof(*t));
+	t->tag = tag;
+	t->min_len = (size_t)-1;
+	stats->ntags++;
+
+	return t;
+}
+
+/* FNV-1a */
+static uint32_t emv_stats_value_hash(const unsigned char *value, size_t len)
+{
+	uint32_t h = 0x811c9dc5u ^ len;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ value[i]) * 0x01000193u;
+
+	return h;
+}
+
+static struct emv_stats_value *emv_stats_value_slot(struct emv_stats_value *values, unsigned size, const unsigned char *value, size_t len)
+{
+	unsigned i = emv_stats_value_hash(value, len) & (size - 1);
+
+	while (values[i].count &&
+	       (values[i].len != len || memcmp(values[i].value, value, len)))
+		i = (i + 1) & (size - 1);
+
+	return &values[i];
+}
+
+static bool emv_stats_grow_values(struct emv_stats_tag *t)
+{
+	unsigned size = t->vsize ? t->vsize * 2 : EMV_STATS_MIN_VALUES, i;
+	struct emv_stats_value *values = calloc(size, sizeof(*values));
+
+	if (!values)
+		return false;
+
+	for (i = 0; i < t->vsize; i++)
+		if (t->values[i].count)
+			*emv_stats_value_slot(values, size, t->values[i].value, t->values[i].len) = t->values[i];
+
+	free(t->values);
+	t->values = values;
+	t->vsize = size;
+
+	return true;
+}
+
+static bool emv_stats_add_value(struct emv_stats_tag *t, const unsigned char *value, size_t len, unsigned long count)
+{
+	struct emv_stats_value *v;
+
+	if (len > EMV_STATS_VALUE_LEN) {
+		t->other += count;
+		return true;
+	}
+
+	if ((t->nvalues + 1) * 4 > t->vsize * 3 && !emv_stats_grow_values(t))
+		return false;
+
+	v = emv_stats_value_slot(t->values, t->vsize, value, len);
+	if (!v->count) {
+		v->len = len;
+		memcpy(v->value, value, len);
+		t->nvalues++;
+	}
+	v->count += count;
+
+	return true;
+}
+
+static bool emv_stats_cb(void *data, const struct tlv *tlv)
+{
+	struct emv_stats *stats = data;
+	struct emv_stats_tag *t = emv_stats_get(stats, tlv->tag);
+
+	if (!t) {
+		stats->failed = true;
+		return false;
+	}
+
+	t->count++;
+	if (t->last_card != stats->cards) {
+		t->last_card = stats->cards;
+		t->cards++;
+	}
+
+	if (tlv->len < t->min_len)
+		t->min_len = tlv->len;
+	if (tlv->len > t->max_len)
+		t->max_len = tlv->len;
+	t->total_len += tlv->len;
+
+	/* Constructed values are described by their children */
+	if (!tlv_is_constructed(tlv) &&
+	    !emv_stats_add_value(t, tlv->value, tlv->len, 1)) {
+		stats->failed = true;
+		return false;
+	}
+
+	return true;
+}
+
+bool emv_stats_add_tlvdb(struct emv_stats *stats, const struct tlvdb *tlvdb)
+{
+	stats->cards++;
+	tlvdb_visit(tlvdb, emv_stats_cb, stats);
+
+	return !stats->failed;
+}
+
+bool emv_stats_merge(struct emv_stats *stats, const struct emv_stats *other)
+{
+	unsigned i, j;
+
+	for (i = 0; i < other->size; i++) {
+		const struct emv_stats_tag *src = &other->tags[i];
+		struct emv_stats_tag *t;
+
+		if (!src->count)
+			continue;
+
+		t = emv_stats_get(stats, src->tag);
+		if (!t) {
+			stats->failed = true;
+			return false;
+		}
+
+		t->count += src->count;
+		t->cards += src->cards;
+		if (src->min_len < t->min_len)
+			t->min_len = src->min_len;
+		if (src->max_len > t->max_len)
+			t->max_len = src->max_len;
+		t->total_len += src->total_len;
+		t->other += src->other;
+
+		for (j = 0; j < src->vsize; j++) {
+			const struct emv_stats_value *v = &src->values[j];
+
+			if (v->count && !emv_stats_add_value(t, v->value, v->len, v->count)) {
+				stats->failed = true;
+				return false;
+			}
+		}
+	}
+
+	stats->cards += other->cards;
+
+	return !stats->failed;
+}
+
+static int emv_stats_cmp_tag(const void *a, const void *b)
+{
+	const struct emv_stats_tag *ta = *(const struct emv_stats_tag **)a;
+	const struct emv_stats_tag *tb = *(const struct emv_stats_tag **)b;
+
+	return ta->tag < tb->tag ? -1 : ta->tag > tb->tag;
+}
+
+static int emv_stats_cmp_value(const void *a, const void *b)
+{
+	const struct emv_stats_value *va = *(const struct emv_stats_value **)a;
+	const struct emv_stats_value *vb = *(const struct emv_stats_value **)b;
+
+	if (va->count != vb->count)
+		return va->count > vb->count ? -1 : 1;
+	if (va->len != vb->len)
+		return va->len < vb->len ? -1 : 1;
+
+	return memcmp(va->value, vb->value, va->len);
+}
+
+static const struct emv_stats_tag **emv_stats_sorted(const struct emv_stats *stats)
+{
+	const struct emv_stats_tag **sorted;
+	unsigned i, n = 0;
+
+	sorted = malloc((stats->ntags ? stats->ntags : 1) * sizeof(*sorted));
+	if (!sorted)
+		return NULL;
+
+	for (i = 0; i < stats->size; i++)
+		if (stats->tags[i].count)
+			sorted[n++] = &stats->tags[i];
+
+	qsort(sorted, n, sizeof(*sorted), emv_stats_cmp_tag);
+
+	return sorted;
+}
+
+/*
+ * The EMV_STATS_VALUES most common values, ties in value order, with
+ * *other counting everything else. NULL if out of memory.
+ */
+static const struct emv_stats_value **emv_stats_values(const struct emv_stats_tag *t, unsigned *n, unsigned long *other)
+{
+	const struct emv_stats_value **values;
+	unsigned i, nvalues = 0;
+
+	values = malloc((t->nvalues ? t->nvalues : 1) * sizeof(*values));
+	if (!values)
+		return NULL;
+
+	for (i = 0; i < t->vsize; i++)
+		if (t->values[i].count)
+			values[nvalues++] = &t->values[i];
+
+	qsort(values, nvalues, sizeof(*values), emv_stats_cmp_value);
+
+	*n = nvalues < EMV_STATS_VALUES ? nvalues : EMV_STATS_VALUES;
+	*other = t->other;
+	for (i = *n; i < nvalues; i++)
+		*other += values[i]->count;
+
+	return values;
+}
+
+static const char *emv_stats_name(tlv_tag_t tag)
+{
+	struct tlv tlv = { .tag = tag };
+
+	return emv_get_tag(&tlv)->name;
+}
+
+static void emv_stats_csv_string(struct outbuf *ob, const char *str)
+{
+	outbuf_putc(ob, '"');
+	for (; *str; str++) {
+		if (*str == '"')
+			outbuf_putc(ob, '"');
+		outbuf_putc(ob, *str);
+	}
+	outbuf_putc(ob, '"');
+}
+
+bool emv_stats_write_csv(const struct emv_stats *stats, FILE *f)
+{
+	const struct emv_stats_tag **sorted = emv_stats_sorted(stats);
+	const struct emv_stats_value **values;
+	struct outbuf ob;
+	unsigned long other;
+	unsigned i, j, n;
+	bool ret = false;
+
+	if (!sorted)
+		return false;
+
+	outbuf_init(&ob, NULL, 0);
+	outbuf_puts(&ob, "tag,name,count,cards,min_len,max_len,mean_len,values,other_values\n");
+
+	for (i = 0; i < stats->ntags; i++) {
+		const struct emv_stats_tag *t = sorted[i];
+
+		outbuf_printf(&ob, "%04hx,", t->tag);
+		emv_stats_csv_string(&ob, emv_stats_name(t->tag));
+		outbuf_printf(&ob, ",%lu,%lu,%zu,%zu,%.2f,", t->count, t->cards,
+				t->min_len, t->max_len, (double)t->total_len / t->count);
+
+		/* Values as space separated hex=count pairs */
+		values = emv_stats_values(t, &n, &other);
+		if (!values)
+			goto out;
+		for (j = 0; j < n; j++) {
+			if (j)
+				outbuf_putc(&ob, ' ');
+			outbuf_hex(&ob, values[j]->value, values[j]->len);
+			outbuf_printf(&ob, "=%lu", values[j]->count);
+		}
+		free(values);
+
+		outbuf_printf(&ob, ",%lu\n", other);
+	}
+
+	ret = outbuf_write(&ob, f);
+out:
+	outbuf_free(&ob);
+	free(sorted);
+
+	return ret;
+}
+
+bool emv_stats_write_json(const struct emv_stats *stats, FILE *f)
+{
+	const struct emv_stats_tag **sorted = emv_stats_sorted(stats);
+	const struct emv_stats_value **values;
+	struct outbuf ob;
+	unsigned long other;
+	unsigned i, j, n;
+	bool ret = false;
+
+	if (!sorted)
+		return false;
+
+	outbuf_init(&ob, NULL, 0);
+	outbuf_printf(&ob, "{\"cards\":%lu,\"tags\":[", stats->cards);
+
+	for (i = 0; i < stats->ntags; i++) {
+		const struct emv_stats_tag *t = sorted[i];
+		const char *name = emv_stats_name(t->tag);
+
+		outbuf_printf(&ob, "%s{\"tag\":\"%04hx\",\"name\":", i ? "," : "", t->tag);
+		outbuf_json_string(&ob, (const unsigned char *)name, strlen(name));
+		outbuf_printf(&ob, ",\"count\":%lu,\"cards\":%lu,\"min_len\":%zu,\"max_len\":%zu,\"mean_len\":%.2f,\"values\":[",
+				t->count, t->cards, t->min_len, t->max_len,
+				(double)t->total_len / t->count);
+
+		values = emv_stats_values(t, &n, &other);
+		if (!values)
+			goto out;
+		for (j = 0; j < n; j++) {
+			outbuf_printf(&ob, "%s{\"value\":\"", j ? "," : "");
+			outbuf_hex(&ob, values[j]->value, values[j]->len);
+			outbuf_printf(&ob, "\",\"count\":%lu}", values[j]->count);
+		}
+		free(values);
+
+		outbuf_printf(&ob, "],\"other_values\":%lu}", other);
+	}
+
+	outbuf_puts(&ob, "]}\n");
+
+	ret = outbuf_write(&ob, f);
+out:
+	outbuf_free(&ob);
+	free(sorted);
+
+	return ret;
+}
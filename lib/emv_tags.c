@@ -17,206 +17,143 @@
 #include <config.h>
 #endif
 
+#include "openemv/bcd.h"
+#include "openemv/config.h"
 #include "openemv/tlv.h"
 #include "openemv/emv_tags.h"
+#include "emv_tags_priv.h"
+#include "emv_tags_table.h"
+#include "emv_tags_phf.h"
+#include "outbuf.h"
 
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-enum emv_tag_t {
-	EMV_TAG_GENERIC,
-	EMV_TAG_BITMASK,
-	EMV_TAG_DOL,
-	EMV_TAG_CVM_LIST,
-	EMV_TAG_STRING,
-	EMV_TAG_NUMERIC,
-	EMV_TAG_YYMMDD,
-};
+static const struct emv_tag emv_tag_unknown = { 0x00, "Unknown ???" };
 
-struct emv_tag {
-	tlv_tag_t tag;
-	char *name;
-	enum emv_tag_t type;
-	const void *data;
+static const struct emv_tags_hash emv_tags_builtin = {
+	.tags = emv_tags,
+	.ntags = sizeof(emv_tags) / sizeof(emv_tags[0]),
+	.nbuckets = sizeof(emv_tags_phf_disp) / sizeof(emv_tags_phf_disp[0]),
+	.disp = emv_tags_phf_disp,
+	.index = emv_tags_phf_index,
 };
 
-struct emv_tag_bit {
-	unsigned bit;
-	const char *name;
-};
+static struct emv_tags_hash emv_tags_loaded;
+static const struct emv_tags_hash *emv_tags_active = &emv_tags_builtin;
+/* Flag name tables, parallel to emv_tags_active->tags */
+static const struct emv_tag_flags **emv_tags_flags;
+static pthread_once_t emv_tags_once = PTHREAD_ONCE_INIT;
+/* Set after the first lookup, the active table is fixed from then on */
+static bool emv_tags_ready;
 
-#define EMV_BIT(byte, bit) ((byte - 1) * 8 + (8 - bit))
-#define EMV_BIT_FINISH { (~0), NULL }
-
-static const struct emv_tag_bit EMV_AIP[] = {
-	{ EMV_BIT(1, 7), "SDA supported" },
-	{ EMV_BIT(1, 6), "DDA supported" },
-	{ EMV_BIT(1, 5), "Cardholder verification is supported" },
-	{ EMV_BIT(1, 4), "Terminal risk management is to be performed" },
-	{ EMV_BIT(1, 3), "Issuer authentication is supported" },
-	{ EMV_BIT(1, 2), "Reserved for use by the EMV Contactless Specifications" },
-	{ EMV_BIT(1, 1), "CDA supported" },
-	{ EMV_BIT(2, 8), "Reserved for use by the EMV Contactless Specifications" },
-	{ EMV_BIT(2, 7), "Reserved for use by the EMV Contactless Specifications" },
-	{ EMV_BIT(2, 6), "Reserved for use by the EMV Contactless Specifications" },
-	{ EMV_BIT(2, 1), "Reserved for use by the EMV Contactless Specifications" },
-	EMV_BIT_FINISH,
-};
+bool emv_tags_load(const char *fname)
+{
+	const struct emv_tag_flags **flags;
+	struct emv_tags_hash h;
 
-static const struct emv_tag_bit EMV_AUC[] = {
-	{ EMV_BIT(1, 8), "Valid for domestic cash transactions" },
-	{ EMV_BIT(1, 7), "Valid for international cash transactions" },
-	{ EMV_BIT(1, 6), "Valid for domestic goods" },
-	{ EMV_BIT(1, 5), "Valid for international goods" },
-	{ EMV_BIT(1, 4), "Valid for domestic services" },
-	{ EMV_BIT(1, 3), "Valid for international services" },
-	{ EMV_BIT(1, 2), "Valid for ATMs" },
-	{ EMV_BIT(1, 1), "Valid at terminals other than ATMs" },
-	{ EMV_BIT(2, 8), "Domestic cashback allowed" },
-	{ EMV_BIT(2, 7), "International cashback allowed" },
-	EMV_BIT_FINISH,
-};
+	/* Tags and flag tables handed out so far stay valid */
+	if (emv_tags_ready || emv_tags_active != &emv_tags_builtin)
+		return false;
 
-static const struct emv_tag_bit EMV_TVR[] = {
-	{ EMV_BIT(1, 8), "Offline data authentication was not performed" },
-	{ EMV_BIT(1, 7), "SDA failed" },
-	{ EMV_BIT(1, 6), "ICC data missing" },
-	{ EMV_BIT(1, 5), "Card appears on terminal exception file" },
-	{ EMV_BIT(1, 4), "DDA failed" },
-	{ EMV_BIT(1, 3), "CDA failed" },
-	{ EMV_BIT(1, 2), "SDA selected" },
-	{ EMV_BIT(2, 8), "ICC and terminal have different application versions" },
-	{ EMV_BIT(2, 7), "Expired application" },
-	{ EMV_BIT(2, 6), "Application not yet effective" },
-	{ EMV_BIT(2, 5), "Requested service not allowed for card product" },
-	{ EMV_BIT(2, 4), "New card" },
-	{ EMV_BIT(3, 8), "Cardholder verification was not successful" },
-	{ EMV_BIT(3, 7), "Unrecognised CVM" },
-	{ EMV_BIT(3, 6), "PIN Try Limit exceeded" },
-	{ EMV_BIT(3, 5), "PIN entry required and PIN pad not present or not working" },
-	{ EMV_BIT(3, 4), "PIN entry required, PIN pad present, but PIN was not entered" },
-	{ EMV_BIT(3, 3), "Online PIN entered" },
-	{ EMV_BIT(4, 8), "Transaction exceeds floor limit" },
-	{ EMV_BIT(4, 7), "Lower consecutive offline limit exceeded" },
-	{ EMV_BIT(4, 6), "Upper consecutive offline limit exceeded" },
-	{ EMV_BIT(4, 5), "Transaction selected randomly for online processing" },
-	{ EMV_BIT(4, 4), "Merchant forced transaction online" },
-	{ EMV_BIT(5, 8), "Default TDOL used" },
-	{ EMV_BIT(5, 7), "Issuer authentication failed" },
-	{ EMV_BIT(5, 6), "Script processing failed before final GENERATE AC" },
-	{ EMV_BIT(5, 5), "Script processing failed after final GENERATE AC" },
-	{ EMV_BIT(5, 4), "Reserved for use by the EMV Contactless Specifications" },
-	{ EMV_BIT(5, 3), "Reserved for use by the EMV Contactless Specifications" },
-	{ EMV_BIT(5, 2), "Reserved for use by the EMV Contactless Specifications" },
-	{ EMV_BIT(5, 1), "Reserved for use by the EMV Contactless Specifications" },
-	EMV_BIT_FINISH,
-};
+	if (!emv_tags_dict_load(fname, emv_tags_builtin.tags, emv_tags_builtin.ntags, &h))
+		return false;
 
-static const struct emv_tag emv_tags[] = {
-	{ 0x00  , "Unknown ???" },
-	{ 0x4f  , "Application Dedicated File (ADF) Name" },
-	{ 0x50  , "Application Label", EMV_TAG_STRING },
-	{ 0x56  , "Track 1 Data" },
-	{ 0x57  , "Track 2 Equivalent Data" },
-	{ 0x5a  , "Application Primary Account Number (PAN)" },
-	{ 0x5f20, "Cardholder Name", EMV_TAG_STRING },
-	{ 0x5f24, "Application Expiration Date", EMV_TAG_YYMMDD },
-	{ 0x5f25, "Application Effective Date", EMV_TAG_YYMMDD },
-	{ 0x5f28, "Issuer Country Code", EMV_TAG_NUMERIC },
-	{ 0x5f2a, "Transaction Currency Code", EMV_TAG_NUMERIC },
-	{ 0x5f2d, "Language Preference", EMV_TAG_STRING },
-	{ 0x5f30, "Service Code", EMV_TAG_NUMERIC },
-	{ 0x5f34, "Application Primary Account Number (PAN) Sequence Number", EMV_TAG_NUMERIC },
-	{ 0x61  , "Application Template" },
-	{ 0x6f  , "File Control Information (FCI) Template" },
-	{ 0x70  , "READ RECORD Response Message Template" },
-	{ 0x77  , "Response Message Template Format 2" },
-	{ 0x80  , "Response Message Template Format 1" },
-	{ 0x82  , "Application Interchange Profile", EMV_TAG_BITMASK, &EMV_AIP },
-	{ 0x83  , "Command Template" },
-	{ 0x84  , "Dedicated File (DF) Name" },
-	{ 0x87  , "Application Priority Indicator" },
-	{ 0x88  , "Short File Identifier (SFI)" },
-	{ 0x8a  , "Authorisation Response Code" },
-	{ 0x8c  , "Card Risk Management Data Object List 1 (CDOL1)", EMV_TAG_DOL },
-	{ 0x8d  , "Card Risk Management Data Object List 2 (CDOL2)", EMV_TAG_DOL },
-	{ 0x8e  , "Cardholder Verification Method (CVM) List", EMV_TAG_CVM_LIST },
-	{ 0x8f  , "Certification Authority Public Key Index" },
-	{ 0x90  , "Issuer Public Key Certificate" },
-	{ 0x91  , "Issuer Authentication Data" },
-	{ 0x92  , "Issuer Public Key Remainder" },
-	{ 0x93  , "Signed Static Application Data" },
-	{ 0x94  , "Application File Locator (AFL)" },
-	{ 0x95  , "Terminal Verification Results" },
-	{ 0x9a  , "Transaction Date", EMV_TAG_YYMMDD },
-	{ 0x9c  , "Transaction Type" },
-	{ 0x9f02, "Amount, Authorised (Numeric)", EMV_TAG_NUMERIC },
-	{ 0x9f03, "Amount, Other (Numeric)", EMV_TAG_NUMERIC, },
-	{ 0x9f07, "Application Usage Control", EMV_TAG_BITMASK, &EMV_AUC },
-	{ 0x9f08, "Application Version Number" },
-	{ 0x9f0d, "Issuer Action Code - Default", EMV_TAG_BITMASK, &EMV_TVR },
-	{ 0x9f0e, "Issuer Action Code - Denial", EMV_TAG_BITMASK, &EMV_TVR },
-	{ 0x9f0f, "Issuer Action Code - Online", EMV_TAG_BITMASK, &EMV_TVR },
-	{ 0x9f10, "Issuer Application Data" },
-	{ 0x9f11, "Issuer Code Table Index", EMV_TAG_NUMERIC },
-	{ 0x9f12, "Application Preferred Name", EMV_TAG_STRING },
-	{ 0x9f13, "Last Online Application Transaction Counter (ATC) Register" },
-	{ 0x9f17, "Personal Identification Number (PIN) Try Counter" },
-	{ 0x9f1a, "Terminal Country Code" },
-	{ 0x9f1f, "Track 1 Discretionary Data", EMV_TAG_STRING },
-	{ 0x9f21, "Transaction Time" },
-	{ 0x9f26, "Application Cryptogram" },
-	{ 0x9f27, "Cryptogram Information Data" },
-	{ 0x9f2d, "ICC PIN Encipherment Public Key Certificate" },
-	{ 0x9f2e, "ICC PIN Encipherment Public Key Exponent" },
-	{ 0x9f2f, "ICC PIN Encipherment Public Key Remainder" },
-	{ 0x9f32, "Issuer Public Key Exponent" },
-	{ 0x9f34, "Cardholder Verification Method (CVM) Results" },
-	{ 0x9f35, "Terminal Type" },
-	{ 0x9f36, "Application Transaction Counter (ATC)" },
-	{ 0x9f37, "Unpredictable Number" },
-	{ 0x9f38, "Processing Options Data Object List (PDOL)", EMV_TAG_DOL },
-	{ 0x9f42, "Application Currency Code", EMV_TAG_NUMERIC },
-	{ 0x9f44, "Application Currency Exponent", EMV_TAG_NUMERIC },
-	{ 0x9f45, "Data Authentication Code" },
-	{ 0x9f46, "ICC Public Key Certificate" },
-	{ 0x9f47, "ICC Public Key Exponent" },
-	{ 0x9f48, "ICC Public Key Remainder" },
-	{ 0x9f49, "Dynamic Data Authentication Data Object List (DDOL)", EMV_TAG_DOL },
-	{ 0x9f4a, "Static Data Authentication Tag List" },
-	{ 0x9f4b, "Signed Dynamic Application Data" },
-	{ 0x9f4c, "ICC Dynamic Number" },
-	{ 0x9f4d, "Log Entry" },
-	{ 0x9f4f, "Log Format", EMV_TAG_DOL },
-	{ 0x9f62, "PCVC3(Track1)" },
-	{ 0x9f63, "PUNATC(Track1)" },
-	{ 0x9f64, "NATC(Track1)" },
-	{ 0x9f65, "PCVC3(Track2)" },
-	{ 0x9f66, "PUNATC(Track2)" },
-	{ 0x9f67, "NATC(Track2)" },
-	{ 0x9f6b, "Track 2 Data" },
-	{ 0xa5  , "File Control Information (FCI) Proprietary Template" },
-	{ 0xbf0c, "File Control Information (FCI) Issuer Discretionary Data" },
-};
+	flags = emv_tag_flags_build(h.tags, h.ntags);
+	if (!flags) {
+		free((void *)h.index);
+		free((void *)h.disp);
+		free((void *)h.tags);
+		return false;
+	}
+
+	emv_tags_loaded = h;
+	emv_tags_active = &emv_tags_loaded;
+	emv_tags_flags = flags;
+
+	return true;
+}
+
+static void emv_tags_init_once(void)
+{
+	const char *fname = openemv_config_get("tags");
+
+	emv_tag_byte_bits_init();
+
+	/* A dictionary loaded by the application takes precedence */
+	if (fname && emv_tags_active == &emv_tags_builtin)
+		emv_tags_load(fname);
+
+	if (!emv_tags_flags)
+		emv_tags_flags = emv_tag_flags_build(emv_tags_builtin.tags, emv_tags_builtin.ntags);
+
+	emv_tags_ready = true;
+}
 
-static int emv_sort_tag(tlv_tag_t tag)
+/* Safe to call from several threads, unlike an explicit emv_tags_load() */
+static const struct emv_tags_hash *emv_tags_init(void)
 {
-	return (int)(tag >= 0x100 ? tag : tag << 8);
+	pthread_once(&emv_tags_once, emv_tags_init_once);
+
+	return emv_tags_active;
 }
 
-static int emv_tlv_compare(const void *a, const void *b)
+const struct emv_tag *emv_get_tag(const struct tlv *tlv)
 {
-	const struct tlv *tlv = a;
-	const struct emv_tag *tag = b;
+	const struct emv_tag *tag = emv_tags_hash_find(emv_tags_init(), tlv->tag);
 
-	return emv_sort_tag(tlv->tag) - (emv_sort_tag(tag->tag));
+	return tag ? tag : &emv_tag_unknown;
 }
 
-static const struct emv_tag *emv_get_tag(const struct tlv *tlv)
+/* Name of a flag of a bitmask tag, NULL if it is not known */
+static const char *emv_tag_flag_lookup(const struct emv_tag *tag, unsigned flag)
 {
-	struct emv_tag *tag = bsearch(tlv, emv_tags, sizeof(emv_tags)/sizeof(emv_tags[0]),
-			sizeof(emv_tags[0]), emv_tlv_compare);
+	const struct emv_tag_flags *f;
+
+	/* Bitmask tags always come from the active table */
+	if (tag->type != EMV_TAG_BITMASK || !emv_tags_flags)
+		return NULL;
 
-	return tag ? tag : &emv_tags[0];
+	f = emv_tags_flags[tag - emv_tags_active->tags];
+
+	return flag < f->nflags ? f->name[flag] : NULL;
+}
+
+size_t emv_tag_decode_flags(const struct tlv *tlv, unsigned *flags, size_t max)
+{
+	const struct emv_tag *tag = emv_get_tag(tlv);
+	size_t i, n = 0;
+	unsigned j;
+
+	if (tag->type != EMV_TAG_BITMASK)
+		return 0;
+
+	for (i = 0; i < tlv->len; i++) {
+		const struct emv_tag_byte_bits *b = &emv_tag_byte_bits[tlv->value[i]];
+
+		/* With enough room, store all eight slots and keep count of them */
+		if (n <= max && max - n >= 8) {
+			for (j = 0; j < 8; j++)
+				flags[n + j] = i * 8 + b->flag[j];
+			n += b->count;
+			continue;
+		}
+
+		for (j = 0; j < b->count; j++, n++)
+			if (n < max)
+				flags[n] = i * 8 + b->flag[j];
+	}
+
+	return n;
+}
+
+const char *emv_tag_flag_name(tlv_tag_t tag, unsigned flag)
+{
+	struct tlv tlv = { .tag = tag };
+
+	return emv_tag_flag_lookup(emv_get_tag(&tlv), flag);
 }
 
 static const char *bitstrings[] = {
@@ -230,25 +167,25 @@ static const char *bitstrings[] = {
 	"1.......",
 };
 
-static void emv_tag_dump_bitmask(const struct tlv *tlv, const struct emv_tag *tag, FILE *f)
+static void emv_tag_dump_bitmask(const struct tlv *tlv, const struct emv_tag *tag, struct outbuf *ob)
 {
-	const struct emv_tag_bit *bits = tag->data;
-	unsigned bit, byte;
+	unsigned byte, i;
 
 	for (byte = 1; byte <= tlv->len; byte ++) {
 		unsigned char val = tlv->value[byte - 1];
-		fprintf(f, "\tByte %u (%02x)\n", byte, val);
-		for (bit = 8; bit > 0; bit--, val <<= 1) {
-			if (val & 0x80)
-				fprintf(f, "\t\t%s - '%s'\n", bitstrings[bit - 1],
-						bits->bit == EMV_BIT(byte, bit) ? bits->name : "Unknown");
-			if (bits->bit == EMV_BIT(byte, bit))
-				bits ++;
+		const struct emv_tag_byte_bits *b = &emv_tag_byte_bits[val];
+
+		outbuf_printf(ob, "\tByte %u (%02x)\n", byte, val);
+		for (i = 0; i < b->count; i++) {
+			const char *name = emv_tag_flag_lookup(tag, (byte - 1) * 8 + b->flag[i]);
+
+			outbuf_printf(ob, "\t\t%s - '%s'\n", bitstrings[7 - b->flag[i]],
+					name ? name : "Unknown");
 		}
 	}
 }
 
-static void emv_tag_dump_dol(const struct tlv *tlv, const struct emv_tag *tag, FILE *f)
+static void emv_tag_dump_dol(const struct tlv *tlv, const struct emv_tag *tag, struct outbuf *ob)
 {
 	const unsigned char *buf = tlv->value;
 	size_t left = tlv->len;
@@ -258,26 +195,27 @@ static void emv_tag_dump_dol(const struct tlv *tlv, const struct emv_tag *tag, F
 		const struct emv_tag *doltag;
 
 		if (!tlv_parse_tl(&buf, &left, &doltlv)) {
-			fprintf(f, "Invalid Tag-Len\n");
+			outbuf_puts(ob, "Invalid Tag-Len\n");
 			continue;
 		}
 
 		doltag = emv_get_tag(&doltlv);
 
-		fprintf(f, "\tTag %4hx len %02zx ('%s')\n", doltlv.tag, doltlv.len, doltag->name);
+		outbuf_printf(ob, "\tTag %4hx len %02zx ('%s')\n", doltlv.tag, doltlv.len, doltag->name);
 	}
 }
 
-static void emv_tag_dump_string(const struct tlv *tlv, const struct emv_tag *tag, FILE *f)
+static void emv_tag_dump_string(const struct tlv *tlv, const struct emv_tag *tag, struct outbuf *ob)
 {
-	fprintf(f, "\tString value '");
-	fwrite(tlv->value, 1, tlv->len, f);
-	fprintf(f, "'\n");
+	outbuf_puts(ob, "\tString value '");
+	outbuf_append(ob, tlv->value, tlv->len);
+	outbuf_puts(ob, "'\n");
 }
 
-static unsigned long emv_value_numeric(const struct tlv *tlv, unsigned start, unsigned end)
+unsigned long emv_value_numeric(const struct tlv *tlv, unsigned start, unsigned end)
 {
 	unsigned long ret = 0;
+	uint64_t value;
 	int i;
 
 	if (end > tlv->len * 2)
@@ -285,6 +223,11 @@ static unsigned long emv_value_numeric(const struct tlv *tlv, unsigned start, un
 	if (start >= end)
 		return ret;
 
+	/* Whole bytes of valid BCD take the fast path */
+	if (!(start & 1) && !(end & 1) &&
+	    bcd_decode(tlv->value + start / 2, (end - start) / 2, &value))
+		return value;
+
 	if (start & 1) {
 		ret += tlv->value[start/2] & 0xf;
 		i = start + 1;
@@ -306,14 +249,14 @@ static unsigned long emv_value_numeric(const struct tlv *tlv, unsigned start, un
 	return ret;
 }
 
-static void emv_tag_dump_numeric(const struct tlv *tlv, const struct emv_tag *tag, FILE *f)
+static void emv_tag_dump_numeric(const struct tlv *tlv, const struct emv_tag *tag, struct outbuf *ob)
 {
-	fprintf(f, "\tNumeric value %lu\n", emv_value_numeric(tlv, 0, tlv->len * 2));
+	outbuf_printf(ob, "\tNumeric value %lu\n", emv_value_numeric(tlv, 0, tlv->len * 2));
 }
 
-static void emv_tag_dump_yymmdd(const struct tlv *tlv, const struct emv_tag *tag, FILE *f)
+static void emv_tag_dump_yymmdd(const struct tlv *tlv, const struct emv_tag *tag, struct outbuf *ob)
 {
-	fprintf(f, "\tDate: 20%02ld.%ld.%ld\n",
+	outbuf_printf(ob, "\tDate: 20%02ld.%ld.%ld\n",
 			emv_value_numeric(tlv, 0, 2),
 			emv_value_numeric(tlv, 2, 4),
 			emv_value_numeric(tlv, 4, 6));
@@ -324,134 +267,350 @@ static uint32_t emv_get_binary(const unsigned char *S)
 	return (S[0] << 24) | (S[1] << 16) | (S[2] << 8) | (S[3] << 0);
 }
 
-static void emv_tag_dump_cvm_list(const struct tlv *tlv, const struct emv_tag *tag, FILE *f)
+static const char *emv_cvm_method(unsigned char code)
+{
+	switch (code & 0x3f) {
+	case 0x0:
+		return "Fail CVM processing";
+	case 0x1:
+		return "Plaintext PIN verification performed by ICC";
+	case 0x2:
+		return "Enciphered PIN verified online";
+	case 0x3:
+		return "Plaintext PIN verification performed by ICC and signature (paper)";
+	case 0x4:
+		return "Enciphered PIN verification performed by ICC";
+	case 0x5:
+		return "Enciphered PIN verification performed by ICC and signature (paper)";
+	case 0x1e:
+		return "Signature (paper)";
+	case 0x1f:
+		return "No CVM required";
+	case 0x3f:
+		return "NOT AVAILABLE!";
+	default:
+		return "Unknown";
+	}
+}
+
+static const char *emv_cvm_condition(unsigned char code)
+{
+	switch (code) {
+	case 0x00:
+		return "Always";
+	case 0x01:
+		return "If unattended cash";
+	case 0x02:
+		return "If not unattended cash and not manual cash and not purchase with cashback";
+	case 0x03:
+		return "If terminal supports the CVM";
+	case 0x04:
+		return "If manual cash";
+	case 0x05:
+		return "If purchase with cashback";
+	case 0x06:
+		return "If transaction is in the application currency and is under X value";
+	case 0x07:
+		return "If transaction is in the application currency and is over X value";
+	case 0x08:
+		return "If transaction is in the application currency and is under Y value";
+	case 0x09:
+		return "If transaction is in the application currency and is over Y value";
+	default:
+		return "Unknown";
+	}
+}
+
+static void emv_tag_dump_cvm_list(const struct tlv *tlv, const struct emv_tag *tag, struct outbuf *ob)
 {
 	uint32_t X, Y;
 	int i;
 
 	if (tlv->len < 10 || tlv->len % 2) {
-		fprintf(f, "\tINVALID!\n");
+		outbuf_puts(ob, "\tINVALID!\n");
 		return;
 	}
 
 	X = emv_get_binary(tlv->value);
 	Y = emv_get_binary(tlv->value + 4);
 
-	fprintf(f, "\tX: %d\n", X);
-	fprintf(f, "\tY: %d\n", Y);
+	outbuf_printf(ob, "\tX: %d\n", X);
+	outbuf_printf(ob, "\tY: %d\n", Y);
 
 	for (i = 8; i < tlv->len; i+= 2) {
-		const char *method;
-		const char *condition;
-
-		switch (tlv->value[i] & 0x3f) {
-		case 0x0:
-			method = "Fail CVM processing";
-			break;
-		case 0x1:
-			method = "Plaintext PIN verification performed by ICC";
-			break;
-		case 0x2:
-			method = "Enciphered PIN verified online";
-			break;
-		case 0x3:
-			method = "Plaintext PIN verification performed by ICC and signature (paper)";
-			break;
-		case 0x4:
-			method = "Enciphered PIN verification performed by ICC";
-			break;
-		case 0x5:
-			method = "Enciphered PIN verification performed by ICC and signature (paper)";
-			break;
-		case 0x1e:
-			method = "Signature (paper)";
-			break;
-		case 0x1f:
-			method = "No CVM required";
-			break;
-		case 0x3f:
-			method = "NOT AVAILABLE!";
-			break;
-		default:
-			method = "Unknown";
-			break;
-		}
+		outbuf_printf(ob, "\t%02x %02x: '%s' '%s' and '%s' if this CVM is unsuccessful\n",
+				tlv->value[i], tlv->value[i+1],
+				emv_cvm_method(tlv->value[i]),
+				emv_cvm_condition(tlv->value[i+1]),
+				(tlv->value[i] & 0x40) ? "continue" : "fail");
+	}
+}
+
+static void emv_tag_render_text(const struct tlv *tlv, struct outbuf *ob)
+{
+	const struct emv_tag *tag = emv_get_tag(tlv);
+
+	outbuf_printf(ob, "Got tag %4hx len %02zx '%s':\n", tlv->tag, tlv->len, tag->name);
+
+	switch (tag->type) {
+	case EMV_TAG_GENERIC:
+		break;
+	case EMV_TAG_BITMASK:
+		emv_tag_dump_bitmask(tlv, tag, ob);
+		break;
+	case EMV_TAG_DOL:
+		emv_tag_dump_dol(tlv, tag, ob);
+		break;
+	case EMV_TAG_CVM_LIST:
+		emv_tag_dump_cvm_list(tlv, tag, ob);
+		break;
+	case EMV_TAG_STRING:
+		emv_tag_dump_string(tlv, tag, ob);
+		break;
+	case EMV_TAG_NUMERIC:
+		emv_tag_dump_numeric(tlv, tag, ob);
+		break;
+	case EMV_TAG_YYMMDD:
+		emv_tag_dump_yymmdd(tlv, tag, ob);
+		break;
+	};
+}
+
+static void emv_tag_json_bitmask(const struct tlv *tlv, const struct emv_tag *tag, struct outbuf *ob)
+{
+	unsigned byte, i;
+	bool first = true;
 
-		switch (tlv->value[i+1]) {
-		case 0x00:
-			condition = "Always";
-			break;
-		case 0x01:
-			condition = "If unattended cash";
-			break;
-		case 0x02:
-			condition = "If not unattended cash and not manual cash and not purchase with cashback";
-			break;
-		case 0x03:
-			condition = "If terminal supports the CVM";
-			break;
-		case 0x04:
-			condition = "If manual cash";
-			break;
-		case 0x05:
-			condition = "If purchase with cashback";
-			break;
-		case 0x06:
-			condition = "If transaction is in the application currency and is under X value";
-			break;
-		case 0x07:
-			condition = "If transaction is in the application currency and is over X value";
-			break;
-		case 0x08:
-			condition = "If transaction is in the application currency and is under Y value";
-			break;
-		case 0x09:
-			condition = "If transaction is in the application currency and is over Y value";
-			break;
-		default:
-			condition = "Unknown";
-			break;
+	outbuf_puts(ob, ",\"flags\":[");
+	for (byte = 1; byte <= tlv->len; byte ++) {
+		const struct emv_tag_byte_bits *b = &emv_tag_byte_bits[tlv->value[byte - 1]];
+
+		for (i = 0; i < b->count; i++) {
+			const char *name = emv_tag_flag_lookup(tag, (byte - 1) * 8 + b->flag[i]);
+
+			outbuf_printf(ob, "%s{\"byte\":%u,\"bit\":%u,\"name\":", first ? "" : ",", byte, 8 - b->flag[i]);
+			if (name)
+				outbuf_json_string(ob, (const unsigned char *)name, strlen(name));
+			else
+				outbuf_puts(ob, "null");
+			outbuf_putc(ob, '}');
+			first = false;
 		}
+	}
+	outbuf_putc(ob, ']');
+}
 
-		fprintf(f, "\t%02x %02x: '%s' '%s' and '%s' if this CVM is unsuccessful\n",
-				tlv->value[i], tlv->value[i+1],
-				method, condition, (tlv->value[i] & 0x40) ? "continue" : "fail");
+static void emv_tag_json_dol(const struct tlv *tlv, const struct emv_tag *tag, struct outbuf *ob)
+{
+	const unsigned char *buf = tlv->value;
+	size_t left = tlv->len;
+	bool first = true;
+
+	outbuf_puts(ob, ",\"dol\":[");
+	while (left) {
+		struct tlv doltlv;
+		const struct emv_tag *doltag;
+
+		if (!tlv_parse_tl(&buf, &left, &doltlv))
+			continue;
+
+		doltag = emv_get_tag(&doltlv);
+
+		outbuf_printf(ob, "%s{\"tag\":\"%x\",\"len\":%zu,\"name\":", first ? "" : ",", doltlv.tag, doltlv.len);
+		outbuf_json_string(ob, (const unsigned char *)doltag->name, strlen(doltag->name));
+		outbuf_putc(ob, '}');
+		first = false;
 	}
+	outbuf_putc(ob, ']');
 }
 
-bool emv_tag_dump(const struct tlv *tlv, FILE *f)
+static void emv_tag_json_cvm_list(const struct tlv *tlv, const struct emv_tag *tag, struct outbuf *ob)
 {
-	if (!tlv) {
-		fprintf(f, "NULL\n");
-		return false;
+	int i;
+
+	if (tlv->len < 10 || tlv->len % 2)
+		return;
+
+	outbuf_printf(ob, ",\"cvm\":{\"x\":%u,\"y\":%u,\"rules\":[",
+			emv_get_binary(tlv->value),
+			emv_get_binary(tlv->value + 4));
+
+	for (i = 8; i < tlv->len; i+= 2) {
+		const char *method = emv_cvm_method(tlv->value[i]);
+		const char *condition = emv_cvm_condition(tlv->value[i+1]);
+
+		outbuf_printf(ob, "%s{\"code\":\"%02x%02x\",\"method\":", i == 8 ? "" : ",",
+				tlv->value[i], tlv->value[i+1]);
+		outbuf_json_string(ob, (const unsigned char *)method, strlen(method));
+		outbuf_puts(ob, ",\"condition\":");
+		outbuf_json_string(ob, (const unsigned char *)condition, strlen(condition));
+		outbuf_printf(ob, ",\"on_failure\":\"%s\"}", (tlv->value[i] & 0x40) ? "continue" : "fail");
 	}
+	outbuf_puts(ob, "]}");
+}
+
+static const char *emv_tag_type_names[] = {
+	[EMV_TAG_GENERIC] = "generic",
+	[EMV_TAG_BITMASK] = "bitmask",
+	[EMV_TAG_DOL] = "dol",
+	[EMV_TAG_CVM_LIST] = "cvm_list",
+	[EMV_TAG_STRING] = "string",
+	[EMV_TAG_NUMERIC] = "numeric",
+	[EMV_TAG_YYMMDD] = "date",
+};
 
+static void emv_tag_render_json(const struct tlv *tlv, struct outbuf *ob)
+{
 	const struct emv_tag *tag = emv_get_tag(tlv);
 
-	fprintf(f, "Got tag %4hx len %02zx '%s':\n", tlv->tag, tlv->len, tag->name);
+	outbuf_printf(ob, "{\"tag\":\"%x\",\"len\":%zu,\"name\":", tlv->tag, tlv->len);
+	outbuf_json_string(ob, (const unsigned char *)tag->name, strlen(tag->name));
+	outbuf_printf(ob, ",\"type\":\"%s\",\"value\":\"", emv_tag_type_names[tag->type]);
+	outbuf_hex(ob, tlv->value, tlv->len);
+	outbuf_putc(ob, '"');
 
 	switch (tag->type) {
 	case EMV_TAG_GENERIC:
 		break;
 	case EMV_TAG_BITMASK:
-		emv_tag_dump_bitmask(tlv, tag, f);
+		emv_tag_json_bitmask(tlv, tag, ob);
 		break;
 	case EMV_TAG_DOL:
-		emv_tag_dump_dol(tlv, tag, f);
+		emv_tag_json_dol(tlv, tag, ob);
 		break;
 	case EMV_TAG_CVM_LIST:
-		emv_tag_dump_cvm_list(tlv, tag, f);
+		emv_tag_json_cvm_list(tlv, tag, ob);
 		break;
 	case EMV_TAG_STRING:
-		emv_tag_dump_string(tlv, tag, f);
+		outbuf_puts(ob, ",\"string\":");
+		outbuf_json_string(ob, tlv->value, tlv->len);
 		break;
 	case EMV_TAG_NUMERIC:
-		emv_tag_dump_numeric(tlv, tag, f);
+		outbuf_printf(ob, ",\"numeric\":%lu", emv_value_numeric(tlv, 0, tlv->len * 2));
 		break;
 	case EMV_TAG_YYMMDD:
-		emv_tag_dump_yymmdd(tlv, tag, f);
+		outbuf_printf(ob, ",\"date\":\"20%02lu-%02lu-%02lu\"",
+				emv_value_numeric(tlv, 0, 2),
+				emv_value_numeric(tlv, 2, 4),
+				emv_value_numeric(tlv, 4, 6));
 		break;
 	};
 
+	outbuf_puts(ob, "}\n");
+}
+
+bool emv_tag_dump(const struct tlv *tlv, FILE *f)
+{
+	char storage[1024];
+	struct outbuf ob;
+
+	if (!tlv) {
+		fprintf(f, "NULL\n");
+		return false;
+	}
+
+	outbuf_init(&ob, storage, sizeof(storage));
+	emv_tag_render_text(tlv, &ob);
+	outbuf_write(&ob, f);
+	outbuf_free(&ob);
+
 	return true;
 }
+
+/* Flush to the stream once this much output has been collected */
+#define EMV_TAG_EMITTER_FLUSH	(64 * 1024)
+
+struct emv_tag_emitter {
+	FILE *f;
+	enum emv_tag_format format;
+	bool ok;
+	struct outbuf ob;
+};
+
+struct emv_tag_emitter *emv_tag_emitter_new(FILE *f, enum emv_tag_format format)
+{
+	struct emv_tag_emitter *e = malloc(sizeof(*e));
+
+	if (!e)
+		return NULL;
+
+	e->f = f;
+	e->format = format;
+	e->ok = true;
+	outbuf_init(&e->ob, NULL, 0);
+
+	return e;
+}
+
+bool emv_tag_emitter_flush(struct emv_tag_emitter *e)
+{
+	if (!e->f)
+		return e->ok && !outbuf_error(&e->ob);
+
+	if (!outbuf_write(&e->ob, e->f))
+		e->ok = false;
+
+	if (fflush(e->f))
+		e->ok = false;
+
+	return e->ok;
+}
+
+void emv_tag_emitter_free(struct emv_tag_emitter *e)
+{
+	if (!e)
+		return;
+
+	emv_tag_emitter_flush(e);
+	outbuf_free(&e->ob);
+	free(e);
+}
+
+bool emv_tag_emit(struct emv_tag_emitter *e, const struct tlv *tlv)
+{
+	if (!tlv)
+		return false;
+
+	if (e->format == EMV_TAG_FORMAT_NDJSON) {
+		emv_tag_render_json(tlv, &e->ob);
+	} else {
+		emv_tag_render_text(tlv, &e->ob);
+		outbuf_hexdump(&e->ob, tlv->value, tlv->len);
+	}
+
+	if (e->f && e->ob.len >= EMV_TAG_EMITTER_FLUSH && !outbuf_write(&e->ob, e->f))
+		e->ok = false;
+
+	return !outbuf_error(&e->ob);
+}
+
+bool emv_tag_emitter_append(struct emv_tag_emitter *e, const char *data, size_t len)
+{
+	outbuf_append(&e->ob, data, len);
+
+	return !outbuf_error(&e->ob);
+}
+
+static bool emv_tag_emit_cb(void *data, const struct tlv *tlv)
+{
+	return emv_tag_emit(data, tlv);
+}
+
+bool emv_tag_emit_tlvdb(struct emv_tag_emitter *e, const struct tlvdb *tlvdb)
+{
+	tlvdb_visit(tlvdb, emv_tag_emit_cb, e);
+
+	return !outbuf_error(&e->ob);
+}
+
+const char *emv_tag_emitter_data(const struct emv_tag_emitter *e, size_t *len)
+{
+	*len = e->ob.len;
+
+	return e->ob.buf;
+}
+
+void emv_tag_emitter_reset(struct emv_tag_emitter *e)
+{
+	outbuf_reset(&e->ob);
+}
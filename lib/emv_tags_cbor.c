@@ -0,0 +1,268 @@
+/*
+ * libopenemv - a library to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "openemv/tlv.h"
+#include "openemv/emv_tags.h"
+#include "emv_tags_priv.h"
+
+#include <string.h>
+
+#define CBOR_UINT	0
+#define CBOR_BYTES	2
+#define CBOR_TEXT	3
+#define CBOR_ARRAY	4
+#define CBOR_TAG	6
+
+#define CBOR_INDEFINITE	0x1f
+#define CBOR_BREAK	0xff
+
+/* RFC 8943 full-date string */
+#define CBOR_TAG_FULL_DATE	1004
+
+/*
+ * Output is only stored while it fits, but the length keeps counting so
+ * that the caller learns how much space the full record needs.
+ */
+struct cbor_writer {
+	unsigned char *buf;
+	size_t size;
+	size_t len;
+};
+
+static void cbor_put(struct cbor_writer *w, const void *data, size_t len)
+{
+	if (w->len + len <= w->size)
+		memcpy(w->buf + w->len, data, len);
+	w->len += len;
+}
+
+static void cbor_byte(struct cbor_writer *w, unsigned char b)
+{
+	cbor_put(w, &b, 1);
+}
+
+static void cbor_head(struct cbor_writer *w, unsigned major, uint64_t val)
+{
+	unsigned char head[9];
+	size_t len, i;
+
+	if (val < 24) {
+		head[0] = val;
+		len = 1;
+	} else {
+		if (val <= UINT8_MAX) {
+			head[0] = 24;
+			len = 2;
+		} else if (val <= UINT16_MAX) {
+			head[0] = 25;
+			len = 3;
+		} else if (val <= UINT32_MAX) {
+			head[0] = 26;
+			len = 5;
+		} else {
+			head[0] = 27;
+			len = 9;
+		}
+
+		for (i = len - 1; i > 0; i--, val >>= 8)
+			head[i] = val & 0xff;
+	}
+
+	head[0] |= major << 5;
+	cbor_put(w, head, len);
+}
+
+static void cbor_indefinite(struct cbor_writer *w, unsigned major)
+{
+	cbor_byte(w, (major << 5) | CBOR_INDEFINITE);
+}
+
+static void cbor_string(struct cbor_writer *w, unsigned major, const void *data, size_t len)
+{
+	cbor_head(w, major, len);
+	cbor_put(w, data, len);
+}
+
+static bool emv_cbor_is_ascii(const unsigned char *value, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		if (value[i] & 0x80)
+			return false;
+
+	return true;
+}
+
+static void emv_cbor_bitmask(struct cbor_writer *w, const struct tlv *tlv)
+{
+	unsigned i, count = 0;
+
+	for (i = 0; i < tlv->len; i++)
+		count += __builtin_popcount(tlv->value[i]);
+
+	cbor_head(w, CBOR_ARRAY, count);
+	for (i = 0; i < tlv->len * 8; i++)
+		if (tlv->value[i / 8] & (0x80 >> (i % 8)))
+			cbor_head(w, CBOR_UINT, i);
+}
+
+static void emv_cbor_date(struct cbor_writer *w, const struct tlv *tlv)
+{
+	char date[11];
+	unsigned long yy = emv_value_numeric(tlv, 0, 2);
+	unsigned long mm = emv_value_numeric(tlv, 2, 4);
+	unsigned long dd = emv_value_numeric(tlv, 4, 6);
+
+	if (tlv->len != 3 || yy > 99 || mm > 99 || dd > 99) {
+		cbor_string(w, CBOR_BYTES, tlv->value, tlv->len);
+		return;
+	}
+
+	date[0] = '2';
+	date[1] = '0';
+	date[2] = '0' + yy / 10;
+	date[3] = '0' + yy % 10;
+	date[4] = '-';
+	date[5] = '0' + mm / 10;
+	date[6] = '0' + mm % 10;
+	date[7] = '-';
+	date[8] = '0' + dd / 10;
+	date[9] = '0' + dd % 10;
+
+	cbor_head(w, CBOR_TAG, CBOR_TAG_FULL_DATE);
+	cbor_string(w, CBOR_TEXT, date, 10);
+}
+
+/* Check that the value of a constructed tag splits cleanly into TLVs */
+static bool emv_cbor_children_valid(const struct tlv *tlv)
+{
+	const unsigned char *buf = tlv->value;
+	size_t left = tlv->len;
+	struct tlv child;
+
+	while (left) {
+		if (!tlv_parse_tl(&buf, &left, &child) || child.len > left)
+			return false;
+		buf += child.len;
+		left -= child.len;
+	}
+
+	return true;
+}
+
+static void emv_cbor_tlv(struct cbor_writer *w, const struct tlv *tlv);
+
+static void emv_cbor_children(struct cbor_writer *w, const struct tlv *tlv)
+{
+	const unsigned char *buf = tlv->value;
+	size_t left = tlv->len;
+	struct tlv child;
+
+	cbor_indefinite(w, CBOR_ARRAY);
+	while (left) {
+		tlv_parse_tl(&buf, &left, &child);
+		child.value = buf;
+		buf += child.len;
+		left -= child.len;
+
+		emv_cbor_tlv(w, &child);
+	}
+	cbor_byte(w, CBOR_BREAK);
+}
+
+static void emv_cbor_tlv(struct cbor_writer *w, const struct tlv *tlv)
+{
+	const struct emv_tag *tag = emv_get_tag(tlv);
+
+	cbor_head(w, CBOR_ARRAY, 2);
+	cbor_head(w, CBOR_UINT, tlv->tag);
+
+	if (tlv_is_constructed(tlv) && emv_cbor_children_valid(tlv)) {
+		emv_cbor_children(w, tlv);
+		return;
+	}
+
+	switch (tag->type) {
+	case EMV_TAG_NUMERIC:
+		cbor_head(w, CBOR_UINT, emv_value_numeric(tlv, 0, tlv->len * 2));
+		break;
+	case EMV_TAG_YYMMDD:
+		emv_cbor_date(w, tlv);
+		break;
+	case EMV_TAG_STRING:
+		if (emv_cbor_is_ascii(tlv->value, tlv->len)) {
+			cbor_string(w, CBOR_TEXT, tlv->value, tlv->len);
+			break;
+		}
+		/* fallthrough */
+	default:
+		cbor_string(w, CBOR_BYTES, tlv->value, tlv->len);
+		break;
+	case EMV_TAG_BITMASK:
+		emv_cbor_bitmask(w, tlv);
+		break;
+	}
+}
+
+struct emv_cbor_visit {
+	struct cbor_writer *w;
+	const unsigned char *skip_start;
+	const unsigned char *skip_end;
+};
+
+static bool emv_cbor_cb(void *data, const struct tlv *tlv)
+{
+	struct emv_cbor_visit *v = data;
+
+	/*
+	 * tlvdb_visit() also walks into the parsed children of constructed
+	 * tags. Those were already encoded as part of their parent, and
+	 * their values point inside the parent's value.
+	 */
+	if (v->skip_end && tlv->value >= v->skip_start && tlv->value + tlv->len <= v->skip_end)
+		return true;
+
+	emv_cbor_tlv(v->w, tlv);
+
+	if (tlv_is_constructed(tlv)) {
+		v->skip_start = tlv->value;
+		v->skip_end = tlv->value + tlv->len;
+	}
+
+	return true;
+}
+
+size_t emv_tags_encode_cbor(const struct tlvdb *tlvdb, unsigned char *buf, size_t size)
+{
+	struct cbor_writer w = {
+		.buf = buf,
+		.size = buf ? size : 0,
+		.len = 0,
+	};
+	struct emv_cbor_visit v = {
+		.w = &w,
+	};
+
+	cbor_indefinite(&w, CBOR_ARRAY);
+	tlvdb_visit(tlvdb, emv_cbor_cb, &v);
+	cbor_byte(&w, CBOR_BREAK);
+
+	return w.len;
+}
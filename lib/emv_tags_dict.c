@@ -0,0 +1,334 @@
+/*
+ * libopenemv - a library to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Tag dictionary files. Each non-indented line describes a tag:
+ *
+ *	9f6c bitmask Card Transaction Qualifiers (CTQ)
+ *
+ * and indented lines following a bitmask tag name its bits:
+ *
+ *	1.8 Online PIN Required
+ *
+ * The file is mapped privately and names are terminated in place, so
+ * they point straight into the mapping, which is never unmapped.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "emv_tags_priv.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct emv_tags_dict {
+	struct emv_tag *tags;
+	unsigned ntags;
+	unsigned size;
+
+	struct emv_tag_bit *bits;
+	unsigned nbits;
+	unsigned bits_size;
+
+	/* Whether the last tag line was accepted */
+	bool current;
+};
+
+static const struct {
+	const char *name;
+	enum emv_tag_t type;
+} emv_tags_dict_types[] = {
+	{ "generic", EMV_TAG_GENERIC },
+	{ "bitmask", EMV_TAG_BITMASK },
+	{ "dol", EMV_TAG_DOL },
+	{ "cvm_list", EMV_TAG_CVM_LIST },
+	{ "string", EMV_TAG_STRING },
+	{ "numeric", EMV_TAG_NUMERIC },
+	{ "date", EMV_TAG_YYMMDD },
+};
+
+static char *emv_tags_dict_skip_space(char *p)
+{
+	while (*p == ' ' || *p == '\t')
+		p++;
+
+	return p;
+}
+
+/* Split off the next blank-separated word, terminating it in place */
+static char *emv_tags_dict_word(char **p)
+{
+	char *word = emv_tags_dict_skip_space(*p);
+	char *end = word;
+
+	while (*end && *end != ' ' && *end != '\t')
+		end++;
+
+	if (*end)
+		*end++ = 0;
+
+	*p = end;
+
+	return word;
+}
+
+static int emv_tags_dict_cmp_bit(const void *a, const void *b)
+{
+	const struct emv_tag_bit *ba = a, *bb = b;
+
+	return ba->bit < bb->bit ? -1 : ba->bit > bb->bit;
+}
+
+/* Sort the bits collected for the last tag and terminate the list */
+static bool emv_tags_dict_finish_bits(struct emv_tags_dict *d, unsigned first)
+{
+	struct emv_tag_bit *bits;
+
+	if (!d->current || d->tags[d->ntags - 1].type != EMV_TAG_BITMASK)
+		return true;
+
+	bits = malloc((d->nbits - first + 1) * sizeof(*bits));
+	if (!bits)
+		return false;
+
+	memcpy(bits, d->bits + first, (d->nbits - first) * sizeof(*bits));
+	qsort(bits, d->nbits - first, sizeof(*bits), emv_tags_dict_cmp_bit);
+	bits[d->nbits - first].bit = ~0;
+	bits[d->nbits - first].name = NULL;
+
+	d->tags[d->ntags - 1].data = bits;
+	d->nbits = first;
+
+	return true;
+}
+
+static bool emv_tags_dict_add_tag(struct emv_tags_dict *d, char *line)
+{
+	char *hex, *type, *end;
+	unsigned long tag;
+	unsigned i;
+
+	hex = emv_tags_dict_word(&line);
+	type = emv_tags_dict_word(&line);
+	line = emv_tags_dict_skip_space(line);
+
+	tag = strtoul(hex, &end, 16);
+	if (*end || !tag || tag > 0xffff || !*line)
+		return false;
+
+	for (i = 0; i < sizeof(emv_tags_dict_types) / sizeof(emv_tags_dict_types[0]); i++)
+		if (!strcmp(type, emv_tags_dict_types[i].name))
+			break;
+	if (i == sizeof(emv_tags_dict_types) / sizeof(emv_tags_dict_types[0]))
+		return false;
+
+	if (d->ntags == d->size) {
+		unsigned size = d->size ? d->size * 2 : 64;
+		struct emv_tag *tags = realloc(d->tags, size * sizeof(*tags));
+
+		if (!tags)
+			return false;
+
+		d->tags = tags;
+		d->size = size;
+	}
+
+	d->tags[d->ntags].tag = tag;
+	d->tags[d->ntags].name = line;
+	d->tags[d->ntags].type = emv_tags_dict_types[i].type;
+	d->tags[d->ntags].data = NULL;
+	d->ntags++;
+
+	return true;
+}
+
+static bool emv_tags_dict_add_bit(struct emv_tags_dict *d, char *line)
+{
+	unsigned long byte, bit;
+	char *end;
+
+	if (!d->current || d->tags[d->ntags - 1].type != EMV_TAG_BITMASK)
+		return false;
+
+	byte = strtoul(line, &end, 10);
+	if (*end != '.' || !byte || byte > 255)
+		return false;
+
+	bit = strtoul(end + 1, &end, 10);
+	if (bit < 1 || bit > 8 || (*end != ' ' && *end != '\t'))
+		return false;
+
+	line = emv_tags_dict_skip_space(end);
+	if (!*line)
+		return false;
+
+	if (d->nbits == d->bits_size) {
+		unsigned size = d->bits_size ? d->bits_size * 2 : 64;
+		struct emv_tag_bit *bits = realloc(d->bits, size * sizeof(*bits));
+
+		if (!bits)
+			return false;
+
+		d->bits = bits;
+		d->bits_size = size;
+	}
+
+	d->bits[d->nbits].bit = EMV_BIT(byte, bit);
+	d->bits[d->nbits].name = line;
+	d->nbits++;
+
+	return true;
+}
+
+static bool emv_tags_dict_parse(struct emv_tags_dict *d, const char *fname, char *buf, size_t len)
+{
+	char *line = buf, *eol;
+	unsigned lineno = 0, first_bit = 0;
+
+	for (; (eol = memchr(line, '\n', buf + len - line)) != NULL; line = eol + 1) {
+		char *p;
+		bool ok;
+
+		lineno++;
+		*eol = 0;
+		if (eol > line && eol[-1] == '\r')
+			eol[-1] = 0;
+
+		p = emv_tags_dict_skip_space(line);
+		if (!*p || *p == '#')
+			continue;
+
+		if (p == line) {
+			if (!emv_tags_dict_finish_bits(d, first_bit))
+				return false;
+			ok = d->current = emv_tags_dict_add_tag(d, p);
+			first_bit = d->nbits;
+		} else {
+			ok = emv_tags_dict_add_bit(d, p);
+		}
+
+		if (!ok)
+			fprintf(stderr, "%s:%u: invalid tag definition, skipping\n", fname, lineno);
+	}
+
+	if (line != buf + len)
+		fprintf(stderr, "%s: last line is not terminated, skipping\n", fname);
+
+	return emv_tags_dict_finish_bits(d, first_bit);
+}
+
+/*
+ * Merge the dictionary with the built-in table (later definitions of a
+ * tag replace earlier ones) and build the lookup hash over the result.
+ */
+static bool emv_tags_dict_merge(struct emv_tags_dict *d,
+		const struct emv_tag *builtin, unsigned nbuiltin,
+		struct emv_tags_hash *h)
+{
+	struct emv_tag *tags;
+	uint16_t *disp, *index;
+	unsigned ntags = 0, nbuckets, i, j;
+
+	tags = malloc((nbuiltin + d->ntags) * sizeof(*tags));
+	if (!tags)
+		return false;
+
+	for (i = 0; i < nbuiltin + d->ntags; i++) {
+		const struct emv_tag *tag = i < nbuiltin ? &builtin[i] : &d->tags[i - nbuiltin];
+
+		for (j = 0; j < ntags; j++)
+			if (tags[j].tag == tag->tag)
+				break;
+
+		tags[j] = *tag;
+		if (j == ntags)
+			ntags++;
+	}
+
+	nbuckets = emv_tags_hash_nbuckets(ntags);
+	disp = malloc(nbuckets * sizeof(*disp));
+	index = malloc(ntags * sizeof(*index));
+	if (!disp || !index || !emv_tags_hash_build(tags, ntags, disp, nbuckets, index)) {
+		free(index);
+		free(disp);
+		free(tags);
+
+		return false;
+	}
+
+	h->tags = tags;
+	h->ntags = ntags;
+	h->nbuckets = nbuckets;
+	h->disp = disp;
+	h->index = index;
+
+	return true;
+}
+
+bool emv_tags_dict_load(const char *fname,
+		const struct emv_tag *builtin, unsigned nbuiltin,
+		struct emv_tags_hash *h)
+{
+	struct emv_tags_dict d = {};
+	struct stat st;
+	char *buf;
+	unsigned i;
+	int fd;
+	bool ret = false;
+
+	fd = open(fname, O_RDONLY);
+	if (fd < 0) {
+		perror(fname);
+		return false;
+	}
+
+	if (fstat(fd, &st) < 0 || !st.st_size) {
+		close(fd);
+		return false;
+	}
+
+	/* Private writable mapping: names are NUL-terminated in place */
+	buf = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (buf == MAP_FAILED) {
+		perror(fname);
+		return false;
+	}
+
+	if (!emv_tags_dict_parse(&d, fname, buf, st.st_size))
+		goto out;
+
+	ret = emv_tags_dict_merge(&d, builtin, nbuiltin, h);
+
+out:
+	/* Names and bit lists stay referenced by the merged table */
+	if (!ret) {
+		for (i = 0; i < d.ntags; i++)
+			if (d.tags[i].type == EMV_TAG_BITMASK)
+				free((void *)d.tags[i].data);
+		munmap(buf, st.st_size);
+	}
+	free(d.tags);
+	free(d.bits);
+
+	return ret;
+}
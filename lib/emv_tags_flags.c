@@ -0,0 +1,101 @@
+/*
+ * libopenemv - a library to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Decoding tables for bitmask tags. One table, shared by all tags, lists
+ * the set bits of every byte value; each bitmask tag then gets a flat
+ * array of flag names indexed by flag number. Decoding a byte of a TVR
+ * is one lookup, plus one name lookup per set bit.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "emv_tags_priv.h"
+
+#include <stdlib.h>
+
+struct emv_tag_byte_bits emv_tag_byte_bits[256];
+
+void emv_tag_byte_bits_init(void)
+{
+	unsigned val, bit;
+
+	for (val = 0; val < 256; val++) {
+		struct emv_tag_byte_bits *b = &emv_tag_byte_bits[val];
+
+		b->count = 0;
+		for (bit = 0; bit < 8; bit++)
+			if (val & (0x80 >> bit))
+				b->flag[b->count++] = bit;
+	}
+}
+
+/* Whole bytes up to the highest named bit */
+static unsigned emv_tag_flags_count(const struct emv_tag_bit *bits)
+{
+	unsigned nflags = 0;
+
+	for (; bits->name; bits++)
+		if (bits->bit >= nflags)
+			nflags = (bits->bit / 8 + 1) * 8;
+
+	return nflags;
+}
+
+static size_t emv_tag_flags_size(unsigned nflags)
+{
+	return sizeof(struct emv_tag_flags) + nflags * sizeof(const char *);
+}
+
+/*
+ * Returns an array, parallel to tags, pointing to the name tables of the
+ * bitmask tags (NULL for other tags). Everything is allocated at once and
+ * released with a single free().
+ */
+const struct emv_tag_flags **emv_tag_flags_build(const struct emv_tag *tags, unsigned ntags)
+{
+	const struct emv_tag_flags **flags;
+	size_t size = ntags * sizeof(*flags);
+	char *p;
+	unsigned i;
+
+	for (i = 0; i < ntags; i++)
+		if (tags[i].type == EMV_TAG_BITMASK)
+			size += emv_tag_flags_size(emv_tag_flags_count(tags[i].data));
+
+	flags = calloc(1, size);
+	if (!flags)
+		return NULL;
+
+	p = (char *)(flags + ntags);
+	for (i = 0; i < ntags; i++) {
+		const struct emv_tag_bit *bits = tags[i].data;
+		struct emv_tag_flags *f = (struct emv_tag_flags *)p;
+
+		if (tags[i].type != EMV_TAG_BITMASK)
+			continue;
+
+		f->nflags = emv_tag_flags_count(bits);
+		for (; bits->name; bits++)
+			f->name[bits->bit] = bits->name;
+
+		flags[i] = f;
+		p += emv_tag_flags_size(f->nflags);
+	}
+
+	return flags;
+}
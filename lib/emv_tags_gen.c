@@ -0,0 +1,63 @@
+/*
+ * libopenemv - a library to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Build-time helper: computes the perfect hash over the built-in tag
+ * table and prints it as C arrays for emv_tags.c. It runs on the build
+ * host, so it only uses libc.
+ */
+
+#include "emv_tags_priv.h"
+#include "emv_tags_table.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static void print_array(const char *name, const uint16_t *arr, unsigned n)
+{
+	unsigned i;
+
+	printf("static const uint16_t %s[%u] = {", name, n);
+	for (i = 0; i < n; i++)
+		printf("%s%u,", i % 12 ? " " : "\n\t", arr[i]);
+	printf("\n};\n\n");
+}
+
+int main(void)
+{
+	unsigned ntags = sizeof(emv_tags) / sizeof(emv_tags[0]);
+	unsigned nbuckets = emv_tags_hash_nbuckets(ntags);
+	uint16_t *disp = malloc(nbuckets * sizeof(*disp));
+	uint16_t *index = malloc(ntags * sizeof(*index));
+
+	if (!disp || !index)
+		return 1;
+
+	if (!emv_tags_hash_build(emv_tags, ntags, disp, nbuckets, index)) {
+		fprintf(stderr, "emv_tags_gen: cannot build hash (duplicate tags?)\n");
+		return 1;
+	}
+
+	printf("/* Generated by emv_tags_gen from emv_tags_table.h, do not edit. */\n\n");
+	printf("#ifndef EMV_TAGS_PHF_H\n#define EMV_TAGS_PHF_H\n\n");
+	print_array("emv_tags_phf_disp", disp, nbuckets);
+	print_array("emv_tags_phf_index", index, ntags);
+	printf("#endif\n");
+
+	free(index);
+	free(disp);
+
+	return 0;
+}
@@ -0,0 +1,167 @@
+/*
+ * libopenemv - a library to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * This file is compiled both into the library and into the build-time
+ * emv_tags_gen helper, so it should not depend on anything but libc.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "emv_tags_priv.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static int emv_tags_hash_cmp_tag(const void *a, const void *b)
+{
+	const tlv_tag_t *ta = a, *tb = b;
+
+	return (int)*ta - (int)*tb;
+}
+
+static bool emv_tags_hash_has_dups(const struct emv_tag *tags, unsigned ntags)
+{
+	tlv_tag_t *sorted;
+	unsigned i;
+	bool ret = false;
+
+	sorted = malloc(ntags * sizeof(*sorted));
+	if (!sorted)
+		return true;
+
+	for (i = 0; i < ntags; i++)
+		sorted[i] = tags[i].tag;
+
+	qsort(sorted, ntags, sizeof(*sorted), emv_tags_hash_cmp_tag);
+
+	for (i = 1; i < ntags; i++)
+		if (sorted[i] == sorted[i - 1])
+			ret = true;
+
+	free(sorted);
+
+	return ret;
+}
+
+struct emv_tags_hash_bucket {
+	unsigned size;
+	unsigned bucket;
+};
+
+/* Largest buckets are placed first, while the table is still empty */
+static int emv_tags_hash_cmp_bucket(const void *a, const void *b)
+{
+	const struct emv_tags_hash_bucket *ba = a, *bb = b;
+
+	if (ba->size != bb->size)
+		return ba->size > bb->size ? -1 : 1;
+
+	return ba->bucket < bb->bucket ? -1 : ba->bucket > bb->bucket;
+}
+
+bool emv_tags_hash_build(const struct emv_tag *tags, unsigned ntags,
+		uint16_t *disp, unsigned nbuckets,
+		uint16_t *index)
+{
+	struct emv_tags_hash_bucket *order;
+	unsigned *size, *start, *members, *slots;
+	bool *taken;
+	unsigned i, j;
+	bool ret = false;
+
+	if (!ntags)
+		return true;
+
+	if (!nbuckets || ntags > UINT16_MAX)
+		return false;
+
+	if (emv_tags_hash_has_dups(tags, ntags))
+		return false;
+
+	size = calloc(nbuckets, sizeof(*size));
+	start = calloc(nbuckets + 1, sizeof(*start));
+	members = malloc(ntags * sizeof(*members));
+	order = malloc(nbuckets * sizeof(*order));
+	slots = malloc(ntags * sizeof(*slots));
+	taken = calloc(ntags, sizeof(*taken));
+	if (!size || !start || !members || !order || !slots || !taken)
+		goto out;
+
+	for (i = 0; i < ntags; i++)
+		size[emv_tags_hash_reduce(emv_tags_hash_mix(tags[i].tag, 0), nbuckets)]++;
+
+	for (i = 0; i < nbuckets; i++)
+		start[i + 1] = start[i] + size[i];
+
+	memset(size, 0, nbuckets * sizeof(*size));
+	for (i = 0; i < ntags; i++) {
+		unsigned b = emv_tags_hash_reduce(emv_tags_hash_mix(tags[i].tag, 0), nbuckets);
+
+		members[start[b] + size[b]++] = i;
+	}
+
+	for (i = 0; i < nbuckets; i++) {
+		order[i].size = size[i];
+		order[i].bucket = i;
+		disp[i] = 0;
+	}
+
+	qsort(order, nbuckets, sizeof(*order), emv_tags_hash_cmp_bucket);
+
+	for (i = 0; i < nbuckets && order[i].size; i++) {
+		unsigned b = order[i].bucket;
+		uint32_t d;
+
+		for (d = 1; d <= UINT16_MAX; d++) {
+			for (j = 0; j < size[b]; j++) {
+				unsigned tag = members[start[b] + j];
+
+				slots[j] = emv_tags_hash_reduce(emv_tags_hash_mix(tags[tag].tag, d), ntags);
+				if (taken[slots[j]])
+					break;
+				taken[slots[j]] = true;
+			}
+
+			if (j == size[b])
+				break;
+
+			/* Roll back the slots tentatively taken by this bucket */
+			while (j--)
+				taken[slots[j]] = false;
+		}
+
+		if (d > UINT16_MAX)
+			goto out;
+
+		disp[b] = d;
+		for (j = 0; j < size[b]; j++)
+			index[slots[j]] = members[start[b] + j];
+	}
+
+	ret = true;
+
+out:
+	free(taken);
+	free(slots);
+	free(order);
+	free(members);
+	free(start);
+	free(size);
+
+	return ret;
+}
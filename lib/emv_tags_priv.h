@@ -0,0 +1,128 @@
+/*
+ * libopenemv - a library to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef EMV_TAGS_PRIV_H
+#define EMV_TAGS_PRIV_H
+
+#include "openemv/tlv.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum emv_tag_t {
+	EMV_TAG_GENERIC,
+	EMV_TAG_BITMASK,
+	EMV_TAG_DOL,
+	EMV_TAG_CVM_LIST,
+	EMV_TAG_STRING,
+	EMV_TAG_NUMERIC,
+	EMV_TAG_YYMMDD,
+};
+
+struct emv_tag {
+	tlv_tag_t tag;
+	const char *name;
+	enum emv_tag_t type;
+	const void *data;
+};
+
+struct emv_tag_bit {
+	unsigned bit;
+	const char *name;
+};
+
+#define EMV_BIT(byte, bit) ((byte - 1) * 8 + (8 - bit))
+#define EMV_BIT_FINISH { (~0), NULL }
+
+/* Set bits of a byte value, as flag numbers within the byte (0 is bit 8) */
+struct emv_tag_byte_bits {
+	uint8_t count;
+	uint8_t flag[8];
+};
+
+extern struct emv_tag_byte_bits emv_tag_byte_bits[256];
+
+void emv_tag_byte_bits_init(void);
+
+/* Flag names of a bitmask tag, indexed by EMV_BIT() */
+struct emv_tag_flags {
+	unsigned nflags;
+	const char *name[];
+};
+
+const struct emv_tag_flags **emv_tag_flags_build(const struct emv_tag *tags, unsigned ntags);
+
+/*
+ * Minimal perfect hash over a tag table (hash and displace). Every tag
+ * is first sent to a bucket, then each bucket gets a displacement which
+ * moves all of its tags into distinct free slots. A lookup is two hash
+ * evaluations and a single integer compare.
+ */
+struct emv_tags_hash {
+	const struct emv_tag *tags;
+	unsigned ntags;
+	unsigned nbuckets;
+	const uint16_t *disp;
+	const uint16_t *index;
+};
+
+static inline uint32_t emv_tags_hash_mix(tlv_tag_t tag, uint32_t seed)
+{
+	uint32_t h = tag * 0x9e3779b1u ^ seed * 0x85ebca6bu;
+
+	h ^= h >> 15;
+	h *= 0x2c1b3c6du;
+	h ^= h >> 12;
+
+	return h;
+}
+
+static inline unsigned emv_tags_hash_reduce(uint32_t h, unsigned n)
+{
+	return ((uint64_t)h * n) >> 32;
+}
+
+static inline unsigned emv_tags_hash_nbuckets(unsigned ntags)
+{
+	return ntags / 2 + 1;
+}
+
+static inline const struct emv_tag *emv_tags_hash_find(const struct emv_tags_hash *h, tlv_tag_t tag)
+{
+	unsigned bucket, slot;
+	const struct emv_tag *t;
+
+	if (!h->ntags)
+		return NULL;
+
+	bucket = emv_tags_hash_reduce(emv_tags_hash_mix(tag, 0), h->nbuckets);
+	slot = emv_tags_hash_reduce(emv_tags_hash_mix(tag, h->disp[bucket]), h->ntags);
+	t = &h->tags[h->index[slot]];
+
+	return t->tag == tag ? t : NULL;
+}
+
+const struct emv_tag *emv_get_tag(const struct tlv *tlv);
+unsigned long emv_value_numeric(const struct tlv *tlv, unsigned start, unsigned end);
+
+bool emv_tags_dict_load(const char *fname,
+		const struct emv_tag *builtin, unsigned nbuiltin,
+		struct emv_tags_hash *h);
+
+bool emv_tags_hash_build(const struct emv_tag *tags, unsigned ntags,
+		uint16_t *disp, unsigned nbuckets,
+		uint16_t *index);
+
+#endif
@@ -0,0 +1,47 @@
+/*
+ * libopenemv - a library to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef BCD_H
+#define BCD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Longest packed BCD field that always fits into 64 bits (18 digits) */
+#define BCD_MAX_LEN	9
+
+/*
+ * Decode an EMV 'n' (packed BCD) field. Fails on digits above 9 and on
+ * fields longer than BCD_MAX_LEN.
+ */
+bool bcd_decode(const unsigned char *buf, size_t len, uint64_t *value);
+
+/*
+ * Decode count fields of len bytes each, the i-th one starting at
+ * buf + i * stride. Invalid fields decode as 0 and get a false entry in
+ * valid, if that is passed. Returns the number of valid fields.
+ */
+size_t bcd_decode_batch(const unsigned char *buf, size_t stride, size_t len,
+		size_t count, uint64_t *values, bool *valid);
+
+/*
+ * Make bcd_decode_batch() use one kernel, "c", "ssse3" or "avx2", mostly
+ * for testing; "auto" goes back to the fastest one. A kernel the CPU
+ * lacks gets the portable one. Returns false on an unknown name.
+ */
+bool bcd_decode_batch_init(const char *impl);
+
+#endif
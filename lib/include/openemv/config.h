@@ -18,5 +18,6 @@
 
 const char *openemv_config_get_def(const char *path, const char *def);
 #define openemv_config_get(path)	openemv_config_get_def(path, NULL)
+int openemv_config_get_int(const char *path, int def);
 
 #endif
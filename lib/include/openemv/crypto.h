@@ -18,17 +18,32 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <sys/uio.h>
 
 enum crypto_algo_hash {
 	HASH_INVALID,
 	HASH_SHA_1,
 };
 
+/*
+ * Closed contexts are kept in a small per-thread pool and handed out again
+ * by crypto_hash_open(), so steady state hashing does not allocate.
+ */
 struct crypto_hash *crypto_hash_open(enum crypto_algo_hash hash);
 void crypto_hash_close(struct crypto_hash *ch);
 void crypto_hash_write(struct crypto_hash *ch, const unsigned char *buf, size_t len);
+/* The same as writing each of the n buffers in turn */
+void crypto_hash_writev(struct crypto_hash *ch, const struct iovec *iov, int n);
 unsigned char *crypto_hash_read(struct crypto_hash *ch);
+/* Start a new hash with the same context */
+void crypto_hash_reset(struct crypto_hash *ch);
 size_t crypto_hash_get_size(const struct crypto_hash *ch);
+/*
+ * Digests of n independent messages, the one of bufs[i] going to
+ * digests + i * digest size. Several messages are hashed in parallel
+ * where possible; this is fastest for messages of similar length.
+ */
+bool crypto_hash_many(enum crypto_algo_hash hash, const unsigned char *const *bufs, const size_t *lens, size_t n, unsigned char *digests);
 
 enum crypto_algo_pk {
 	PK_INVALID,
@@ -38,11 +53,79 @@ enum crypto_algo_pk {
 struct crypto_pk *crypto_pk_open(enum crypto_algo_pk pk, ...);
 struct crypto_pk *crypto_pk_open_priv(enum crypto_algo_pk pk, ...);
 struct crypto_pk *crypto_pk_genkey(enum crypto_algo_pk pk, ...);
+struct crypto_pk *crypto_pk_ref(struct crypto_pk *cp);
 void crypto_pk_close(struct crypto_pk *cp);
+/*
+ * Speed up later operations on a long lived key. Must be called before
+ * the handle is shared with other threads. For private keys this also
+ * prepares repeated signing: CRT parameters are kept in the backend's
+ * own form and blinding factors are reused (updated after each use)
+ * instead of set up for every signature, which is then checked against
+ * the public key before being returned.
+ */
+bool crypto_pk_precompute(struct crypto_pk *cp);
 unsigned char *crypto_pk_encrypt(const struct crypto_pk *cp, const unsigned char *buf, size_t len, size_t *clen);
 unsigned char *crypto_pk_decrypt(const struct crypto_pk *cp, const unsigned char *buf, size_t len, size_t *clen);
+/*
+ * Same, but the result (as long as the modulus) goes to the caller's
+ * buffer, which may be the input one. Return the result length, 0 on
+ * error or if out is too short.
+ */
+size_t crypto_pk_encrypt_into(const struct crypto_pk *cp, const unsigned char *buf, size_t len, unsigned char *out, size_t outlen);
+size_t crypto_pk_decrypt_into(const struct crypto_pk *cp, const unsigned char *buf, size_t len, unsigned char *out, size_t outlen);
+/*
+ * Public key operation on n independent inputs, spread over the crypto
+ * worker threads. out[i] needs room for the modulus of keys[i]; lens[i]
+ * holds the length of in[i] and is replaced by the result length, 0 if
+ * the operation failed. Returns false if any of them did.
+ */
+bool crypto_pk_encrypt_batch(const struct crypto_pk **keys, const unsigned char **in, size_t *lens, unsigned char **out, size_t n);
 enum crypto_algo_pk crypto_pk_get_algo(const struct crypto_pk *cp);
 size_t crypto_pk_get_nbits(const struct crypto_pk *cp);
+/*
+ * For RSA, 0 and 1 are n and e. Private keys also have 2 to 7: d, p, q,
+ * d mod (p - 1), d mod (q - 1) and q^-1 mod p, as for crypto_pk_open_priv().
+ */
 unsigned char *crypto_pk_get_parameter(const struct crypto_pk *cp, unsigned param, size_t *plen);
 
+/*
+ * Operations queued to a background thread. Inputs are copied and keys
+ * referenced, so they need not outlive the call. The callback, if any,
+ * runs on the background thread with the result (NULL on failure) once
+ * the job is over, but before it is seen as done.
+ */
+struct crypto_job;
+typedef void (*crypto_job_cb)(void *data, const unsigned char *res, size_t len);
+
+struct crypto_job *crypto_pk_encrypt_async(struct crypto_pk *cp, const unsigned char *buf, size_t len, crypto_job_cb cb, void *data);
+struct crypto_job *crypto_pk_decrypt_async(struct crypto_pk *cp, const unsigned char *buf, size_t len, crypto_job_cb cb, void *data);
+struct crypto_job *crypto_hash_async(enum crypto_algo_hash hash, const unsigned char *buf, size_t len, crypto_job_cb cb, void *data);
+bool crypto_job_done(const struct crypto_job *job);
+void crypto_job_wait(struct crypto_job *job);
+/* Waits for the job; the result stays valid until crypto_job_free() */
+const unsigned char *crypto_job_result(struct crypto_job *job, size_t *len);
+/* Waits for the job if it is still pending */
+void crypto_job_free(struct crypto_job *job);
+/*
+ * An eventfd which becomes readable when jobs complete, for event loops,
+ * or -1 if not supported. Clear it before checking the jobs.
+ */
+int crypto_job_fd(void);
+void crypto_job_fd_clear(void);
+
+/*
+ * Key pairs generated ahead of time on background threads, for the
+ * sizes and exponents listed in "crypto.keypool.keys" ("1024/3 1152/3").
+ * With "crypto.keypool.spool" and "crypto.keypool.master_key" set, ready
+ * keys are also kept, encrypted, in the spool directory and picked up
+ * again by the next crypto_keypool_start(). "crypto.keypool.depth" keys
+ * of each kind are kept ready, at most 1024. Start returns false if no
+ * keys are configured or the depth is not positive.
+ */
+bool crypto_keypool_start(void);
+void crypto_keypool_stop(void);
+/* A ready key if there is one, otherwise one generated right away */
+struct crypto_pk *crypto_keypool_get(enum crypto_algo_pk pk, unsigned nbits, unsigned exp);
+unsigned crypto_keypool_ready(enum crypto_algo_pk pk, unsigned nbits, unsigned exp);
+
 #endif
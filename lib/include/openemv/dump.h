@@ -21,4 +21,12 @@
 void dump_buffer_simple(const unsigned char *ptr, size_t len, FILE *f);
 void dump_buffer(const unsigned char *ptr, size_t len, FILE *f);
 
+/*
+ * Same output as above, written into buf like snprintf() does: at most
+ * size bytes including the terminating NUL are stored and the length of
+ * the complete output is returned.
+ */
+size_t dump_buffer_simple_mem(const unsigned char *ptr, size_t len, char *buf, size_t size);
+size_t dump_buffer_mem(const unsigned char *ptr, size_t len, char *buf, size_t size);
+
 #endif
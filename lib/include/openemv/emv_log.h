@@ -0,0 +1,82 @@
+/*
+ * libopenemv - a library to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef EMV_LOG_H
+#define EMV_LOG_H
+
+#include "openemv/scard.h"
+#include "openemv/tlv.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum emv_log_column {
+	EMV_LOG_AMOUNT,		/* 9f02, in minor units */
+	EMV_LOG_AMOUNT_OTHER,	/* 9f03, in minor units */
+	EMV_LOG_CURRENCY,	/* 5f2a, ISO 4217 numeric */
+	EMV_LOG_COUNTRY,	/* 9f1a, ISO 3166 numeric */
+	EMV_LOG_DATE,		/* 9a, YYMMDD as a decimal number */
+	EMV_LOG_TIME,		/* 9f21, HHMMSS as a decimal number */
+	EMV_LOG_TYPE,		/* 9c */
+	EMV_LOG_ATC,		/* 9f36 */
+	EMV_LOG_CID,		/* 9f27 */
+	EMV_LOG_COLUMNS,
+};
+
+/* Log Format (9f4f) compiled into fixed offsets within a log record */
+struct emv_log_plan;
+
+struct emv_log_plan *emv_log_plan_compile(const struct tlv *format);
+void emv_log_plan_free(struct emv_log_plan *plan);
+size_t emv_log_plan_entry_len(const struct emv_log_plan *plan);
+bool emv_log_plan_has(const struct emv_log_plan *plan, enum emv_log_column column);
+bool emv_log_plan_field(const struct emv_log_plan *plan, tlv_tag_t tag, size_t *offset, size_t *len);
+const struct tlv *emv_log_plan_format(const struct emv_log_plan *plan);
+
+/*
+ * Decoded transaction log, one array per column. Columns missing from
+ * the log format read as zero. Raw records are kept in raw, entry_len
+ * bytes apiece, for the fields that have no column.
+ */
+struct emv_log {
+	const struct emv_log_plan *plan;
+	unsigned count;
+	unsigned capacity;
+	size_t entry_len;
+	/* Records read by emv_log_read() but not of entry_len bytes */
+	unsigned skipped;
+
+	uint64_t *amount;
+	uint64_t *amount_other;
+	uint16_t *currency;
+	uint16_t *country;
+	uint32_t *date;
+	uint32_t *time;
+	uint8_t *type;
+	uint16_t *atc;
+	uint8_t *cid;
+
+	unsigned char *raw;
+};
+
+struct emv_log *emv_log_new(const struct emv_log_plan *plan, unsigned capacity);
+void emv_log_free(struct emv_log *log);
+bool emv_log_decode(struct emv_log *log, const unsigned char *rec, size_t len);
+
+/* Read the log announced by Log Entry (9f4d) in db */
+struct emv_log *emv_log_read(struct sc *sc, const struct tlvdb *db);
+
+#endif
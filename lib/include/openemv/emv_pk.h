@@ -36,6 +36,9 @@ struct emv_pk {
 
 #define EXPIRE(yy, mm, dd)	0x ## yy ## mm ## dd
 
+/* EMV limits RSA keys to 1984 bits */
+#define EMV_PK_MAX_MODULUS	(1984 / 8)
+
 struct emv_pk *emv_pk_parse_pk(char *buf);
 struct emv_pk *emv_pk_new(size_t modlen, size_t explen);
 void emv_pk_free(struct emv_pk *pk);
@@ -43,4 +46,13 @@ unsigned char *emv_pk_dump_pk(const struct emv_pk *pk);
 bool emv_pk_verify(const struct emv_pk *pk);
 
 struct emv_pk *emv_pk_get_ca_pk(const unsigned char *rid, unsigned char idx);
+
+/*
+ * Crypto handle for the key. Recently used keys are kept open in a small
+ * cache shared between threads; release the handle with crypto_pk_close().
+ */
+struct crypto_pk;
+struct crypto_pk *emv_pk_crypto_open(const struct emv_pk *pk);
+/* Drop all cached handles */
+void emv_pk_cache_flush(void);
 #endif
@@ -0,0 +1,44 @@
+/*
+ * libopenemv - a library to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef EMV_STATS_H
+#define EMV_STATS_H
+
+#include "openemv/tlv.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/*
+ * Tag statistics over many cards: for every tag, how often it occurs,
+ * on how many cards, its lengths and the most common values of short
+ * tags. An aggregate is not thread safe; give each thread its own and
+ * merge them at the end.
+ */
+struct emv_stats;
+
+struct emv_stats *emv_stats_new(void);
+void emv_stats_free(struct emv_stats *stats);
+
+/* Account all tags of one card (or trace), including nested ones */
+bool emv_stats_add_tlvdb(struct emv_stats *stats, const struct tlvdb *tlvdb);
+bool emv_stats_merge(struct emv_stats *stats, const struct emv_stats *other);
+unsigned long emv_stats_cards(const struct emv_stats *stats);
+
+/* Results are sorted by tag */
+bool emv_stats_write_csv(const struct emv_stats *stats, FILE *f);
+bool emv_stats_write_json(const struct emv_stats *stats, FILE *f);
+
+#endif
@@ -21,4 +21,62 @@
 
 bool emv_tag_dump(const struct tlv *tlv, FILE *f);
 
+/*
+ * Load a tag dictionary and merge it over the built-in table. By default
+ * the file named by the "tags" configuration key is loaded on first use.
+ * Only one dictionary can be loaded, and only before the first tag
+ * lookup; later calls fail.
+ */
+bool emv_tags_load(const char *fname);
+
+/*
+ * Flags of bitmask tags (TVR, AIP, AUC, Issuer Action Codes) are numbered
+ * from bit 8 of the first byte: bit b of byte n is flag (n - 1) * 8 + 8 - b.
+ */
+#define EMV_TAG_FLAG(byte, bit) (((byte) - 1) * 8 + (8 - (bit)))
+
+/*
+ * Decode the set bits of a bitmask tag into flag numbers, in order. At
+ * most max flags are stored; the number of set bits is returned, or 0 if
+ * the tag is not a bitmask.
+ */
+size_t emv_tag_decode_flags(const struct tlv *tlv, unsigned *flags, size_t max);
+/* Name of a flag of a bitmask tag, NULL if it is not known */
+const char *emv_tag_flag_name(tlv_tag_t tag, unsigned flag);
+
+enum emv_tag_format {
+	EMV_TAG_FORMAT_TEXT,
+	EMV_TAG_FORMAT_NDJSON,
+};
+
+/*
+ * Buffered tag emitter. Output is collected in memory and written to the
+ * stream in large chunks; with a NULL stream it is only accumulated and
+ * can be fetched with emv_tag_emitter_data().
+ */
+struct emv_tag_emitter;
+
+struct emv_tag_emitter *emv_tag_emitter_new(FILE *f, enum emv_tag_format format);
+void emv_tag_emitter_free(struct emv_tag_emitter *e);
+bool emv_tag_emit(struct emv_tag_emitter *e, const struct tlv *tlv);
+bool emv_tag_emit_tlvdb(struct emv_tag_emitter *e, const struct tlvdb *tlvdb);
+/* Text as is, e.g. a header between records */
+bool emv_tag_emitter_append(struct emv_tag_emitter *e, const char *data, size_t len);
+bool emv_tag_emitter_flush(struct emv_tag_emitter *e);
+const char *emv_tag_emitter_data(const struct emv_tag_emitter *e, size_t *len);
+void emv_tag_emitter_reset(struct emv_tag_emitter *e);
+
+/*
+ * Encode the tlvdb as CBOR: an array of [tag, value] pairs, where the
+ * value of a constructed tag is again such an array. Numeric tags become
+ * integers, dates are RFC 8943 full-date strings, strings are text and
+ * bitmasks are arrays of set bit numbers (0 being bit 8 of the first
+ * byte); everything else is kept as a byte string.
+ *
+ * At most size bytes are written to buf. The full length of the record
+ * is returned, so a result larger than size means the buffer was too
+ * short.
+ */
+size_t emv_tags_encode_cbor(const struct tlvdb *tlvdb, unsigned char *buf, size_t size);
+
 #endif
@@ -43,6 +43,9 @@ const struct tlv *tlvdb_get(const struct tlvdb *tlvdb, tlv_tag_t tag, const stru
 
 bool tlv_parse_tl(const unsigned char **buf, size_t *len, struct tlv *tlv);
 unsigned char *tlv_encode(const struct tlv *tlv, size_t *len);
+/* Tag and length only, as tlv_encode() would put them; returns their size */
+#define TLV_TL_MAX 4
+size_t tlv_encode_tl(const struct tlv *tlv, unsigned char tl[TLV_TL_MAX]);
 bool tlv_is_constructed(const struct tlv *tlv);
 
 #endif
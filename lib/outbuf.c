@@ -0,0 +1,192 @@
+/*
+ * libopenemv - a library to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "openemv/dump.h"
+#include "outbuf.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OUTBUF_MIN_HEAP 4096
+
+void outbuf_init(struct outbuf *ob, char *storage, size_t size)
+{
+	ob->buf = storage;
+	ob->size = storage ? size : 0;
+	ob->len = 0;
+	ob->heap = false;
+	ob->error = false;
+}
+
+void outbuf_free(struct outbuf *ob)
+{
+	if (ob->heap)
+		free(ob->buf);
+
+	outbuf_init(ob, NULL, 0);
+}
+
+bool outbuf_reserve(struct outbuf *ob, size_t len)
+{
+	size_t size;
+	char *buf;
+
+	if (ob->error)
+		return false;
+
+	if (ob->size - ob->len >= len)
+		return true;
+
+	size = ob->size ? ob->size : OUTBUF_MIN_HEAP;
+	while (size - ob->len < len)
+		size *= 2;
+
+	if (ob->heap) {
+		buf = realloc(ob->buf, size);
+	} else {
+		buf = malloc(size);
+		if (buf && ob->len)
+			memcpy(buf, ob->buf, ob->len);
+	}
+
+	if (!buf) {
+		ob->error = true;
+		return false;
+	}
+
+	ob->buf = buf;
+	ob->size = size;
+	ob->heap = true;
+
+	return true;
+}
+
+void outbuf_append(struct outbuf *ob, const void *data, size_t len)
+{
+	if (!outbuf_reserve(ob, len))
+		return;
+
+	memcpy(ob->buf + ob->len, data, len);
+	ob->len += len;
+}
+
+void outbuf_puts(struct outbuf *ob, const char *str)
+{
+	outbuf_append(ob, str, strlen(str));
+}
+
+void outbuf_printf(struct outbuf *ob, const char *fmt, ...)
+{
+	va_list vl;
+	int len;
+
+	if (ob->error)
+		return;
+
+	va_start(vl, fmt);
+	len = vsnprintf(ob->buf + ob->len, ob->size - ob->len, fmt, vl);
+	va_end(vl);
+
+	if (len < 0) {
+		ob->error = true;
+		return;
+	}
+
+	if (ob->size - ob->len > (size_t)len) {
+		ob->len += len;
+		return;
+	}
+
+	/* Did not fit, grow (including space for the trailing NUL) and redo */
+	if (!outbuf_reserve(ob, len + 1))
+		return;
+
+	va_start(vl, fmt);
+	vsnprintf(ob->buf + ob->len, ob->size - ob->len, fmt, vl);
+	va_end(vl);
+
+	ob->len += len;
+}
+
+static const char outbuf_hexdigits[] = "0123456789abcdef";
+
+void outbuf_json_string(struct outbuf *ob, const unsigned char *str, size_t len)
+{
+	size_t i;
+
+	/* Worst case: every byte becomes \u00XX */
+	if (!outbuf_reserve(ob, len * 6 + 2))
+		return;
+
+	ob->buf[ob->len++] = '"';
+	for (i = 0; i < len; i++) {
+		unsigned char c = str[i];
+
+		if (c == '"' || c == '\\') {
+			ob->buf[ob->len++] = '\\';
+			ob->buf[ob->len++] = c;
+		} else if (c >= 0x20 && c < 0x7f) {
+			ob->buf[ob->len++] = c;
+		} else {
+			memcpy(ob->buf + ob->len, "\\u00", 4);
+			ob->len += 4;
+			ob->buf[ob->len++] = outbuf_hexdigits[c >> 4];
+			ob->buf[ob->len++] = outbuf_hexdigits[c & 0xf];
+		}
+	}
+	ob->buf[ob->len++] = '"';
+}
+
+void outbuf_hex(struct outbuf *ob, const unsigned char *data, size_t len)
+{
+	size_t i;
+
+	if (!outbuf_reserve(ob, len * 2))
+		return;
+
+	for (i = 0; i < len; i++) {
+		ob->buf[ob->len++] = outbuf_hexdigits[data[i] >> 4];
+		ob->buf[ob->len++] = outbuf_hexdigits[data[i] & 0xf];
+	}
+}
+
+void outbuf_hexdump(struct outbuf *ob, const unsigned char *ptr, size_t len)
+{
+	size_t need = dump_buffer_mem(ptr, len, NULL, 0);
+
+	if (!outbuf_reserve(ob, need + 1))
+		return;
+
+	ob->len += dump_buffer_mem(ptr, len, ob->buf + ob->len, need + 1);
+}
+
+bool outbuf_write(struct outbuf *ob, FILE *f)
+{
+	bool ret = !ob->error;
+
+	if (ob->len && fwrite(ob->buf, 1, ob->len, f) != ob->len)
+		ret = false;
+
+	ob->len = 0;
+	ob->error = false;
+
+	return ret;
+}
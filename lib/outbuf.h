@@ -0,0 +1,68 @@
+/*
+ * libopenemv - a library to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Growable output buffer. It can start on caller-provided (e.g. stack)
+ * storage and moves to the heap only when that is exhausted. Allocation
+ * failures are sticky: further appends are ignored and outbuf_error()
+ * reports them.
+ */
+struct outbuf {
+	char *buf;
+	size_t len;
+	size_t size;
+	bool heap;
+	bool error;
+};
+
+void outbuf_init(struct outbuf *ob, char *storage, size_t size);
+void outbuf_free(struct outbuf *ob);
+
+bool outbuf_reserve(struct outbuf *ob, size_t len);
+void outbuf_append(struct outbuf *ob, const void *data, size_t len);
+void outbuf_puts(struct outbuf *ob, const char *str);
+void outbuf_printf(struct outbuf *ob, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+void outbuf_json_string(struct outbuf *ob, const unsigned char *str, size_t len);
+void outbuf_hex(struct outbuf *ob, const unsigned char *data, size_t len);
+/* Same layout as dump_buffer() */
+void outbuf_hexdump(struct outbuf *ob, const unsigned char *ptr, size_t len);
+
+bool outbuf_write(struct outbuf *ob, FILE *f);
+
+static inline void outbuf_putc(struct outbuf *ob, char c)
+{
+	if (ob->len < ob->size || outbuf_reserve(ob, 1))
+		ob->buf[ob->len++] = c;
+}
+
+static inline void outbuf_reset(struct outbuf *ob)
+{
+	ob->len = 0;
+}
+
+static inline bool outbuf_error(const struct outbuf *ob)
+{
+	return ob->error;
+}
+
+#endif
@@ -314,42 +314,40 @@ const struct tlv *tlvdb_get(const struct tlvdb *tlvdb, tlv_tag_t tag, const stru
 	return NULL;
 }
 
+size_t tlv_encode_tl(const struct tlv *tlv, unsigned char tl[TLV_TL_MAX])
+{
+	size_t pos = 0;
+
+	if (tlv->tag > 0x100) {
+		tl[pos++] = tlv->tag >> 8;
+		tl[pos++] = tlv->tag & 0xff;
+	} else
+		tl[pos++] = tlv->tag;
+
+	if (tlv->len > 0x7f) {
+		tl[pos++] = 0x81;
+		tl[pos++] = tlv->len;
+	} else
+		tl[pos++] = tlv->len;
+
+	return pos;
+}
+
 unsigned char *tlv_encode(const struct tlv *tlv, size_t *len)
 {
-	size_t size = tlv->len;
+	unsigned char tl[TLV_TL_MAX];
 	unsigned char *data;
 	size_t pos;
 
-	if (tlv->tag > 0x100)
-		size += 2;
-	else
-		size += 1;
-
-	if (tlv->len > 0x7f)
-		size += 2;
-	else
-		size += 1;
+	pos = tlv_encode_tl(tlv, tl);
 
-	data = malloc(size);
+	data = malloc(pos + tlv->len);
 	if (!data) {
 		*len = 0;
 		return NULL;
 	}
 
-	pos = 0;
-
-	if (tlv->tag > 0x100) {
-		data[pos++] = tlv->tag >> 8;
-		data[pos++] = tlv->tag & 0xff;
-	} else
-		data[pos++] = tlv->tag;
-
-	if (tlv->len > 0x7f) {
-		data[pos++] = 0x81;
-		data[pos++] = tlv->len;
-	} else
-		data[pos++] = tlv->len;
-
+	memcpy(data, tl, pos);
 	memcpy(data + pos, tlv->value, tlv->len);
 	pos += tlv->len;
 
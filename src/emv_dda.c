@@ -138,9 +138,7 @@ static bool verify_offline_enc(struct tlvdb *db, struct sc *sc, struct emv_pk *p
 	free(challenge);
 
 	struct crypto_pk *kcp;
-	kcp = crypto_pk_open(pk->pk_algo,
-			pk->modulus, pk->mlen,
-			pk->exp, pk->elen);
+	kcp = emv_pk_crypto_open(pk);
 	if (!kcp)
 		return false;
 
@@ -22,22 +22,13 @@
 #include "openemv/tlv.h"
 #include "openemv/emv_tags.h"
 #include "openemv/dol.h"
-#include "openemv/dump.h"
 #include "openemv/emv_commands.h"
+#include "openemv/emv_log.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-static bool print_cb(void *data, const struct tlv *tlv)
-{
-//	if (tlv_is_constructed(tlv)) return true;
-	emv_tag_dump(tlv, stdout);
-	dump_buffer(tlv->value, tlv->len, stdout);
-
-	return true;
-}
-
 const struct {
 	size_t name_len;
 	const unsigned char name[16];
@@ -49,10 +40,19 @@ const struct {
 	{ 0, {}},
 };
 
-int main(void)
+int main(int argc, char **argv)
 {
 	int i;
 	struct sc *sc;
+	struct emv_tag_emitter *e;
+	enum emv_tag_format format = EMV_TAG_FORMAT_TEXT;
+
+	if (argc > 1 && !strcmp(argv[1], "--json"))
+		format = EMV_TAG_FORMAT_NDJSON;
+
+	e = emv_tag_emitter_new(stdout, format);
+	if (!e)
+		return 1;
 
 	sc = scard_init(NULL);
 	if (!sc) {
@@ -112,29 +112,30 @@ int main(void)
 	tlvdb_add(s, emv_get_data(sc, 0x9f17));
 	tlvdb_add(s, emv_get_data(sc, 0x9f4f));
 
-	tlvdb_visit(s, print_cb, NULL);
-
-	const struct tlv *logent_tlv = tlvdb_get(s, 0x9f4d, NULL);
-	const struct tlv *logent_dol = tlvdb_get(s, 0x9f4f, NULL);
-	if (logent_tlv && logent_tlv->len == 2 && logent_dol) {
-		for (i = 1; i <= logent_tlv->value[1]; i++) {
-			unsigned short sw;
-			size_t log_len;
-			unsigned char *log = emv_read_record(sc, logent_tlv->value[0], i, &sw, &log_len);
-			if (!log)
-				continue;
-
-			if (sw == 0x9000) {
-				printf("Log #%d\n", i);
-				struct tlvdb *log_db = dol_parse(logent_dol, log, log_len);
-				tlvdb_visit(log_db, print_cb, NULL);
-				tlvdb_free(log_db);
+	emv_tag_emit_tlvdb(e, s);
+
+	struct emv_log *log = emv_log_read(sc, s);
+	if (log) {
+		const struct tlv *log_format = emv_log_plan_format(log->plan);
+
+		for (i = 0; i < log->count; i++) {
+			if (format == EMV_TAG_FORMAT_TEXT) {
+				emv_tag_emitter_flush(e);
+				printf("Log #%d\n", i + 1);
 			}
-			free(log);
+			struct tlvdb *log_db = dol_parse(log_format, log->raw + i * log->entry_len, log->entry_len);
+			emv_tag_emit_tlvdb(e, log_db);
+			tlvdb_free(log_db);
+		}
+		if (log->skipped) {
+			emv_tag_emitter_flush(e);
+			fprintf(stderr, "Skipped %u log records not matching the log format\n", log->skipped);
 		}
+		emv_log_free(log);
 	}
 
 	tlvdb_free(s);
+	emv_tag_emitter_free(e);
 
 	scard_disconnect(sc);
 	if (scard_is_error(sc)) {
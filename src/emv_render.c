@@ -0,0 +1,485 @@
+/*
+ * emv-tools - a set of tools to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Render an archive of captured card sessions. The archive holds one
+ * session per line, as hex-encoded BER-TLV data. Sessions are read in
+ * batches, rendered by a pool of workers into private buffers and
+ * written out in archive order. With -s, tag statistics are collected
+ * instead, per worker, and merged at the end.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "openemv/tlv.h"
+#include "openemv/emv_tags.h"
+#include "openemv/emv_stats.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RENDER_BATCH		256
+#define RENDER_MAX_WORKERS	256
+
+enum render_state {
+	RENDER_EMPTY,
+	RENDER_READY,
+	RENDER_BUSY,
+	RENDER_DONE,
+};
+
+struct render_job {
+	enum render_state state;
+	unsigned long first;
+	unsigned nlines;
+	char *lines[RENDER_BATCH];
+
+	/* Rendered batch, created by the first worker to take the job */
+	struct emv_tag_emitter *out;
+};
+
+struct render {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	enum emv_tag_format format;
+	/* Merged statistics of all workers, in -s mode */
+	struct emv_stats *stats;
+
+	struct render_job *jobs;
+	unsigned njobs;
+	unsigned long next_read;
+	unsigned long next_render;
+	unsigned long next_write;
+	bool eof;
+	bool failed;
+};
+
+static int hexval(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+
+	return -1;
+}
+
+static unsigned char *session_decode(const char *line, size_t *len)
+{
+	size_t size = strlen(line) / 2;
+	unsigned char *buf = malloc(size ? size : 1);
+	int hi = -1;
+
+	if (!buf)
+		return NULL;
+
+	*len = 0;
+	for (; *line; line++) {
+		int v = hexval(*line);
+
+		if (v < 0) {
+			if (*line == ' ' || *line == ':' || *line == '\t' ||
+			    *line == '\r' || *line == '\n')
+				continue;
+			goto err;
+		}
+
+		if (hi < 0) {
+			hi = v;
+		} else {
+			buf[(*len)++] = (hi << 4) | v;
+			hi = -1;
+		}
+	}
+
+	if (hi >= 0)
+		goto err;
+
+	return buf;
+
+err:
+	free(buf);
+
+	return NULL;
+}
+
+/* A session is a sequence of top-level TLV objects */
+static struct tlvdb *session_parse(const unsigned char *buf, size_t len)
+{
+	struct tlvdb *db = NULL;
+
+	while (len) {
+		const unsigned char *tmp = buf;
+		size_t left = len, elm;
+		struct tlv tlv;
+		struct tlvdb *t;
+
+		if (!tlv_parse_tl(&tmp, &left, &tlv) || tlv.len > left)
+			goto err;
+
+		elm = tmp - buf + tlv.len;
+		t = tlvdb_parse(buf, elm);
+		if (!t)
+			goto err;
+
+		if (db)
+			tlvdb_add(db, t);
+		else
+			db = t;
+
+		buf += elm;
+		len -= elm;
+	}
+
+	return db;
+
+err:
+	tlvdb_free(db);
+
+	return NULL;
+}
+
+static bool render_job_stats(struct render_job *job, struct emv_stats *stats)
+{
+	unsigned i;
+
+	for (i = 0; i < job->nlines; i++) {
+		unsigned char *buf;
+		struct tlvdb *db = NULL;
+		size_t len;
+		bool ok;
+
+		buf = session_decode(job->lines[i], &len);
+		if (buf)
+			db = session_parse(buf, len);
+
+		ok = !db || emv_stats_add_tlvdb(stats, db);
+
+		tlvdb_free(db);
+		free(buf);
+
+		if (!ok)
+			return false;
+	}
+
+	return true;
+}
+
+static bool render_job(struct render *r, struct render_job *job)
+{
+	unsigned i;
+
+	if (!job->out)
+		job->out = emv_tag_emitter_new(NULL, r->format);
+	if (!job->out)
+		return false;
+
+	emv_tag_emitter_reset(job->out);
+
+	for (i = 0; i < job->nlines; i++) {
+		unsigned long session = job->first + i + 1;
+		unsigned char *buf;
+		struct tlvdb *db = NULL;
+		char header[64];
+		size_t len;
+		int hlen;
+		bool ok;
+
+		buf = session_decode(job->lines[i], &len);
+		if (buf)
+			db = session_parse(buf, len);
+
+		if (r->format == EMV_TAG_FORMAT_NDJSON)
+			hlen = snprintf(header, sizeof(header), "{\"session\":%lu%s}\n",
+					session, db ? "" : ",\"error\":\"invalid data\"");
+		else
+			hlen = snprintf(header, sizeof(header), "Session %lu%s\n",
+					session, db ? ":" : ": invalid data");
+
+		ok = emv_tag_emitter_append(job->out, header, hlen) &&
+			(!db || emv_tag_emit_tlvdb(job->out, db));
+
+		tlvdb_free(db);
+		free(buf);
+
+		if (!ok)
+			return false;
+	}
+
+	return true;
+}
+
+static void *render_worker(void *data)
+{
+	struct render *r = data;
+	struct emv_stats *stats = NULL;
+	struct render_job *job;
+	bool ok;
+
+	if (r->stats)
+		stats = emv_stats_new();
+
+	pthread_mutex_lock(&r->lock);
+	if (r->stats && !stats)
+		r->failed = true;
+
+	while (!r->failed) {
+		if (r->next_render == r->next_read) {
+			if (r->eof)
+				break;
+			pthread_cond_wait(&r->cond, &r->lock);
+			continue;
+		}
+
+		job = &r->jobs[r->next_render++ % r->njobs];
+		job->state = RENDER_BUSY;
+		pthread_mutex_unlock(&r->lock);
+
+		if (stats)
+			ok = render_job_stats(job, stats);
+		else
+			ok = render_job(r, job);
+
+		pthread_mutex_lock(&r->lock);
+		job->state = RENDER_DONE;
+		if (!ok)
+			r->failed = true;
+		pthread_cond_broadcast(&r->cond);
+	}
+
+	if (stats && !r->failed && !emv_stats_merge(r->stats, stats))
+		r->failed = true;
+
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+
+	emv_stats_free(stats);
+
+	return NULL;
+}
+
+/* Emit rendered batches strictly in archive order */
+static void *render_writer(void *data)
+{
+	struct render *r = data;
+	struct render_job *job;
+	const char *out;
+	size_t len;
+	unsigned i;
+	bool ok;
+
+	pthread_mutex_lock(&r->lock);
+	while (!r->failed) {
+		job = &r->jobs[r->next_write % r->njobs];
+
+		if (r->next_write == r->next_read && r->eof)
+			break;
+
+		if (r->next_write == r->next_read || job->state != RENDER_DONE) {
+			pthread_cond_wait(&r->cond, &r->lock);
+			continue;
+		}
+		pthread_mutex_unlock(&r->lock);
+
+		/* Nothing to write in -s mode */
+		out = job->out ? emv_tag_emitter_data(job->out, &len) : NULL;
+		ok = !out || fwrite(out, 1, len, stdout) == len;
+
+		for (i = 0; i < job->nlines; i++)
+			free(job->lines[i]);
+		job->nlines = 0;
+
+		pthread_mutex_lock(&r->lock);
+		job->state = RENDER_EMPTY;
+		if (!ok)
+			r->failed = true;
+		r->next_write++;
+		pthread_cond_broadcast(&r->cond);
+	}
+	pthread_mutex_unlock(&r->lock);
+
+	fflush(stdout);
+
+	return NULL;
+}
+
+static bool render_read(struct render *r, FILE *f)
+{
+	unsigned long lines = 0;
+	struct render_job *job;
+	char *line = NULL;
+	size_t size = 0;
+	bool more = true, failed;
+
+	while (more) {
+		pthread_mutex_lock(&r->lock);
+		job = &r->jobs[r->next_read % r->njobs];
+		while (!r->failed && job->state != RENDER_EMPTY)
+			pthread_cond_wait(&r->cond, &r->lock);
+		failed = r->failed;
+		pthread_mutex_unlock(&r->lock);
+
+		if (failed)
+			break;
+
+		job->first = lines;
+		job->nlines = 0;
+		while (job->nlines < RENDER_BATCH) {
+			if (getline(&line, &size, f) < 0) {
+				more = false;
+				break;
+			}
+
+			job->lines[job->nlines++] = line;
+			line = NULL;
+			size = 0;
+		}
+		lines += job->nlines;
+
+		pthread_mutex_lock(&r->lock);
+		if (job->nlines) {
+			job->state = RENDER_READY;
+			r->next_read++;
+		}
+		if (!more)
+			r->eof = true;
+		pthread_cond_broadcast(&r->cond);
+		pthread_mutex_unlock(&r->lock);
+	}
+
+	free(line);
+
+	return !ferror(f);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-j workers] [-J] [-s] [archive]\n", name);
+	fprintf(stderr, "\t-j workers\tnumber of rendering threads (default: one per CPU)\n");
+	fprintf(stderr, "\t-J\t\temit NDJSON instead of text (JSON statistics with -s)\n");
+	fprintf(stderr, "\t-s\t\tprint tag statistics as CSV instead of rendering\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct render r = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+		.format = EMV_TAG_FORMAT_TEXT,
+	};
+	pthread_t workers[RENDER_MAX_WORKERS], writer;
+	long nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+	FILE *f = stdin;
+	bool ok, stats = false;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "j:Js")) != -1) {
+		switch (opt) {
+		case 'j':
+			nworkers = atol(optarg);
+			break;
+		case 'J':
+			r.format = EMV_TAG_FORMAT_NDJSON;
+			break;
+		case 's':
+			stats = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (nworkers < 1)
+		nworkers = 1;
+	if (nworkers > RENDER_MAX_WORKERS)
+		nworkers = RENDER_MAX_WORKERS;
+
+	if (optind < argc && strcmp(argv[optind], "-")) {
+		f = fopen(argv[optind], "r");
+		if (!f) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+
+	/* Enough batches in flight to keep every worker busy */
+	r.njobs = 2 * nworkers;
+	r.jobs = calloc(r.njobs, sizeof(*r.jobs));
+	if (!r.jobs)
+		return 1;
+
+	if (stats) {
+		r.stats = emv_stats_new();
+		if (!r.stats)
+			return 1;
+	}
+
+	if (pthread_create(&writer, NULL, render_writer, &r))
+		return 1;
+
+	for (i = 0; i < nworkers; i++)
+		if (pthread_create(&workers[i], NULL, render_worker, &r))
+			break;
+	nworkers = i;
+
+	if (nworkers)
+		ok = render_read(&r, f);
+	else
+		ok = false;
+
+	pthread_mutex_lock(&r.lock);
+	r.eof = true;
+	if (!ok)
+		r.failed = true;
+	pthread_cond_broadcast(&r.cond);
+	pthread_mutex_unlock(&r.lock);
+
+	for (i = 0; i < nworkers; i++)
+		pthread_join(workers[i], NULL);
+	pthread_join(writer, NULL);
+
+	ok = !r.failed;
+
+	if (ok && r.stats) {
+		if (r.format == EMV_TAG_FORMAT_NDJSON)
+			ok = emv_stats_write_json(r.stats, stdout);
+		else
+			ok = emv_stats_write_csv(r.stats, stdout);
+	}
+	emv_stats_free(r.stats);
+
+	for (i = 0; i < r.njobs; i++) {
+		unsigned j;
+
+		for (j = 0; j < r.jobs[i].nlines; j++)
+			free(r.jobs[i].lines[j]);
+		emv_tag_emitter_free(r.jobs[i].out);
+	}
+	free(r.jobs);
+
+	if (f != stdin)
+		fclose(f);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,19 @@
+#!/bin/sh
+# Crypto dependent tests with the driver picked on startup, first by
+# timing the drivers, then from the remembered choice
+
+OPENEMV_CONFIG="../data/notinst-auto.txt"
+export OPENEMV_CONFIG
+
+STATE="../data/crypto-auto"
+
+rm -f "$STATE"
+./crypto-test || exit 1
+test -s "$STATE" || exit 1
+
+cp "$STATE" "$STATE.old"
+for t in crypto-test sda-test dda-test cda-test; do
+	./$t || exit 1
+done
+cmp -s "$STATE" "$STATE.old" || exit 1
+rm -f "$STATE.old"
@@ -0,0 +1,153 @@
+/*
+ * emv-tools - a set of tools to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "openemv/bcd.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#define COUNT 1001
+
+static bool reference(const unsigned char *buf, size_t len, uint64_t *value)
+{
+	size_t i;
+
+	*value = 0;
+	for (i = 0; i < len; i++) {
+		if ((buf[i] >> 4) > 9 || (buf[i] & 0xf) > 9)
+			return false;
+		*value = *value * 100 + (buf[i] >> 4) * 10 + (buf[i] & 0xf);
+	}
+
+	return true;
+}
+
+static int single_test(void)
+{
+	static const struct {
+		size_t len;
+		unsigned char buf[BCD_MAX_LEN + 1];
+		bool ok;
+		uint64_t value;
+	} tests[] = {
+		{ 0, {}, true, 0 },
+		{ 2, { 0x09, 0x78 }, true, 978 },
+		{ 3, { 0x25, 0x12, 0x31 }, true, 251231 },
+		{ 6, { 0x00, 0x00, 0x00, 0x01, 0x23, 0x45 }, true, 12345 },
+		{ 8, { 0x99, 0x99, 0x99, 0x99, 0x99, 0x99, 0x99, 0x99 }, true, 9999999999999999ULL },
+		{ 9, { 0x12, 0x34, 0x56, 0x78, 0x90, 0x12, 0x34, 0x56, 0x78 }, true, 123456789012345678ULL },
+		{ 2, { 0x1a, 0x00 }, false, 0 },
+		{ 6, { 0x00, 0x00, 0x00, 0x00, 0x00, 0xf0 }, false, 0 },
+		{ 10, { }, false, 0 },
+	};
+	unsigned i;
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		uint64_t value;
+		bool ok = bcd_decode(tests[i].buf, tests[i].len, &value);
+
+		if (ok != tests[i].ok || (ok && value != tests[i].value)) {
+			printf("Single test %u failed\n", i);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int batch_run(const unsigned char *buf, const char *impl, size_t count)
+{
+	static uint64_t values[COUNT];
+	static bool valid[COUNT];
+	size_t len, i, ok;
+
+	for (len = 1; len <= BCD_MAX_LEN; len++) {
+		size_t expected = 0;
+
+		ok = bcd_decode_batch(buf + 1, 16, len, count, values, valid);
+
+		for (i = 0; i < count; i++) {
+			uint64_t value;
+			bool v = reference(buf + 1 + i * 16, len, &value);
+
+			if (!v)
+				value = 0;
+			expected += v;
+
+			if (v != valid[i] || value != values[i]) {
+				printf("Batch test failed: %s count %zu len %zu field %zu\n", impl, count, len, i);
+				return 1;
+			}
+		}
+
+		if (ok != expected) {
+			printf("Batch test failed: %s count %zu len %zu valid %zu vs %zu\n",
+					impl, count, len, ok, expected);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int batch_test(void)
+{
+	static const char *impls[] = { "c", "ssse3", "avx2", "auto" };
+	/* Odd counts, so that every vector kernel leaves a tail */
+	static const size_t counts[] = { 1, 3, 5, 7, 17, 33, COUNT };
+	static unsigned char buf[COUNT * 16];
+	size_t i, j;
+
+	srand(1);
+	for (i = 0; i < sizeof(buf); i++) {
+		buf[i] = (rand() % 10) << 4 | (rand() % 10);
+		/* Sprinkle some invalid digits */
+		if (rand() % 97 == 0)
+			buf[i] |= 0x0a << (rand() % 2 ? 4 : 0);
+	}
+
+	for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+		if (!bcd_decode_batch_init(impls[i])) {
+			printf("Batch test failed: no %s kernel\n", impls[i]);
+			return 1;
+		}
+
+		for (j = 0; j < sizeof(counts) / sizeof(counts[0]); j++)
+			if (batch_run(buf, impls[i], counts[j]))
+				return 1;
+	}
+
+	if (bcd_decode_batch_init("mmx")) {
+		printf("Batch test failed: unknown kernel accepted\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	if (single_test())
+		return 1;
+
+	if (batch_test())
+		return 1;
+
+	return 0;
+}
@@ -0,0 +1,90 @@
+/*
+ * emv-tools - a set of tools to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "openemv/tlv.h"
+#include "openemv/emv_tags.h"
+#include "openemv/dump.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+static const unsigned char fci[] = {
+	0x6f, 0x1a, 0x84, 0x0e, 0x31, 0x50, 0x41, 0x59, 0x2e, 0x53, 0x59, 0x53,
+	0x2e, 0x44, 0x44, 0x46, 0x30, 0x31, 0xa5, 0x08, 0x88, 0x01, 0x02, 0x5f,
+	0x2d, 0x02, 0x65, 0x6e,
+};
+
+static const unsigned char expected[] = {
+	0x9f,
+	/* 6f: [84: h'315041592e5359532e4444463031', a5: [88: h'02', 5f2d: "en"]] */
+	0x82, 0x18, 0x6f, 0x9f,
+		0x82, 0x18, 0x84, 0x4e, 0x31, 0x50, 0x41, 0x59, 0x2e, 0x53, 0x59, 0x53,
+		0x2e, 0x44, 0x44, 0x46, 0x30, 0x31,
+		0x82, 0x18, 0xa5, 0x9f,
+			0x82, 0x18, 0x88, 0x41, 0x02,
+			0x82, 0x19, 0x5f, 0x2d, 0x62, 0x65, 0x6e,
+		0xff,
+	0xff,
+	/* 9f02: 1234 */
+	0x82, 0x19, 0x9f, 0x02, 0x19, 0x04, 0xd2,
+	/* 5f24: 1004("2025-12-31") */
+	0x82, 0x19, 0x5f, 0x24, 0xd9, 0x03, 0xec, 0x6a,
+	0x32, 0x30, 0x32, 0x35, 0x2d, 0x31, 0x32, 0x2d, 0x33, 0x31,
+	/* 82: [1, 8] */
+	0x82, 0x18, 0x82, 0x82, 0x01, 0x08,
+	0xff,
+};
+
+int main(void)
+{
+	struct tlvdb *db;
+	unsigned char buf[sizeof(expected)];
+	size_t len;
+
+	db = tlvdb_parse(fci, sizeof(fci));
+	if (!db)
+		return 1;
+
+	tlvdb_add(db, tlvdb_fixed(0x9f02, 6, (const unsigned char *)"\x00\x00\x00\x00\x12\x34"));
+	tlvdb_add(db, tlvdb_fixed(0x5f24, 3, (const unsigned char *)"\x25\x12\x31"));
+	tlvdb_add(db, tlvdb_fixed(0x82, 2, (const unsigned char *)"\x40\x80"));
+
+	len = emv_tags_encode_cbor(db, NULL, 0);
+	if (len != sizeof(expected)) {
+		printf("Length mismatch: %zu vs %zu\n", len, sizeof(expected));
+		return 1;
+	}
+
+	if (emv_tags_encode_cbor(db, buf, sizeof(buf) - 1) != len) {
+		printf("Short buffer changed the length\n");
+		return 1;
+	}
+
+	len = emv_tags_encode_cbor(db, buf, sizeof(buf));
+	if (len != sizeof(expected) || memcmp(buf, expected, len)) {
+		printf("Data mismatch\n");
+		dump_buffer(buf, len, stdout);
+		return 1;
+	}
+
+	tlvdb_free(db);
+
+	return 0;
+}
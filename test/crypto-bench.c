@@ -0,0 +1,307 @@
+/*
+ * emv-tools - a set of tools to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * SHA-1, public key operation (certificate recovery) and signing
+ * throughput of the configured crypto driver, for the usual EMV sizes
+ * and exponents, one at a time and as batches over the crypto worker
+ * threads.
+ * Not run as part of the test suite.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "openemv/crypto.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_TIME 0.5
+#define BENCH_MAX_BYTES (1984 / 8)
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The timing does not depend on the modulus being a real RSA one */
+static void random_bytes(unsigned char *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = rand();
+}
+
+static int bench_pk(size_t nbits, const unsigned char *exp, size_t elen, bool precompute)
+{
+	size_t mlen = nbits / 8;
+	unsigned char mod[BENCH_MAX_BYTES], data[BENCH_MAX_BYTES];
+	struct crypto_pk *cp;
+	unsigned long ops = 0;
+	double start, elapsed;
+
+	if (mlen < 2 || mlen > BENCH_MAX_BYTES)
+		return 1;
+
+	random_bytes(mod, mlen);
+	mod[0] |= 0x80;
+	mod[mlen - 1] |= 1;
+	random_bytes(data, mlen);
+	data[0] &= 0x7f;
+
+	cp = crypto_pk_open(PK_RSA, mod, mlen, exp, elen);
+	if (!cp)
+		return 1;
+
+	if (precompute && !crypto_pk_precompute(cp)) {
+		crypto_pk_close(cp);
+		return 1;
+	}
+
+	start = now();
+	do {
+		size_t clen;
+		unsigned char *out = crypto_pk_encrypt(cp, data, mlen, &clen);
+
+		if (!out) {
+			crypto_pk_close(cp);
+			return 1;
+		}
+		free(out);
+		ops++;
+		elapsed = now() - start;
+	} while (elapsed < BENCH_TIME);
+
+	printf("%4zu bits e=%-5lu %-11s %9.0f ops/s %8.2f us/op\n", nbits,
+			elen == 1 ? (unsigned long)exp[0] : 65537UL,
+			precompute ? "precomputed" : "",
+			ops / elapsed, elapsed * 1e6 / ops);
+
+	crypto_pk_close(cp);
+
+	return 0;
+}
+
+/* The same, for one key, with the operations submitted as a batch */
+static int bench_pk_batch(size_t nbits, const unsigned char *exp, size_t elen)
+{
+	enum { N = 256 };
+	size_t mlen = nbits / 8;
+	static unsigned char data[N][BENCH_MAX_BYTES], res[N][BENCH_MAX_BYTES];
+	const struct crypto_pk *keys[N];
+	const unsigned char *in[N];
+	unsigned char *out[N];
+	unsigned char mod[BENCH_MAX_BYTES];
+	size_t lens[N];
+	struct crypto_pk *cp;
+	unsigned long ops = 0;
+	double start, elapsed;
+	unsigned i;
+
+	if (mlen < 2 || mlen > BENCH_MAX_BYTES)
+		return 1;
+
+	random_bytes(mod, mlen);
+	mod[0] |= 0x80;
+	mod[mlen - 1] |= 1;
+
+	cp = crypto_pk_open(PK_RSA, mod, mlen, exp, elen);
+	if (!cp)
+		return 1;
+
+	if (!crypto_pk_precompute(cp)) {
+		crypto_pk_close(cp);
+		return 1;
+	}
+
+	for (i = 0; i < N; i++) {
+		random_bytes(data[i], mlen);
+		data[i][0] &= 0x7f;
+		keys[i] = cp;
+		in[i] = data[i];
+		out[i] = res[i];
+	}
+
+	start = now();
+	do {
+		for (i = 0; i < N; i++)
+			lens[i] = mlen;
+		if (!crypto_pk_encrypt_batch(keys, in, lens, out, N)) {
+			crypto_pk_close(cp);
+			return 1;
+		}
+		ops += N;
+		elapsed = now() - start;
+	} while (elapsed < BENCH_TIME);
+
+	printf("%4zu bits e=%-5lu %-11s %9.0f ops/s %8.2f us/op\n", nbits,
+			elen == 1 ? (unsigned long)exp[0] : 65537UL,
+			"batched", ops / elapsed, elapsed * 1e6 / ops);
+
+	crypto_pk_close(cp);
+
+	return 0;
+}
+
+/* Signatures with one private key, as when personalizing cards */
+static int bench_sign(size_t nbits, bool precompute)
+{
+	size_t mlen = nbits / 8;
+	unsigned char data[BENCH_MAX_BYTES], sig[BENCH_MAX_BYTES];
+	struct crypto_pk *cp;
+	unsigned long ops = 0;
+	double start, elapsed;
+
+	if (mlen > BENCH_MAX_BYTES)
+		return 1;
+
+	cp = crypto_pk_genkey(PK_RSA, 1, nbits, 3);
+	if (!cp)
+		return 1;
+
+	if (precompute && !crypto_pk_precompute(cp)) {
+		crypto_pk_close(cp);
+		return 1;
+	}
+
+	random_bytes(data, mlen);
+	data[0] = 0x6a;
+
+	start = now();
+	do {
+		if (!crypto_pk_decrypt_into(cp, data, mlen, sig, sizeof(sig))) {
+			crypto_pk_close(cp);
+			return 1;
+		}
+		ops++;
+		elapsed = now() - start;
+	} while (elapsed < BENCH_TIME);
+
+	printf("%4zu bits sign    %-11s %9.0f ops/s %8.2f us/op\n", nbits,
+			precompute ? "precomputed" : "",
+			ops / elapsed, elapsed * 1e6 / ops);
+
+	crypto_pk_close(cp);
+
+	return 0;
+}
+
+/* Open, write, read and close, as done for each signature check */
+static int bench_hash(size_t len)
+{
+	static unsigned char data[16384];
+	unsigned long ops = 0;
+	double start, elapsed;
+
+	if (len > sizeof(data))
+		return 1;
+
+	random_bytes(data, len);
+
+	start = now();
+	do {
+		struct crypto_hash *ch = crypto_hash_open(HASH_SHA_1);
+
+		if (!ch)
+			return 1;
+		crypto_hash_write(ch, data, len);
+		crypto_hash_read(ch);
+		crypto_hash_close(ch);
+		ops++;
+		elapsed = now() - start;
+	} while (elapsed < BENCH_TIME);
+
+	printf("SHA-1 %5zu bytes %9.0f ops/s %8.1f MB/s\n", len,
+			ops / elapsed, ops * len / elapsed / 1e6);
+
+	return 0;
+}
+
+/* Certificate sized messages, submitted as one batch */
+static int bench_hash_many(size_t len)
+{
+	enum { N = 64 };
+	static unsigned char data[N][BENCH_MAX_BYTES];
+	static unsigned char digests[N * 20];
+	const unsigned char *bufs[N];
+	size_t lens[N];
+	unsigned long ops = 0;
+	double start, elapsed;
+	unsigned i;
+
+	if (len > BENCH_MAX_BYTES)
+		return 1;
+
+	for (i = 0; i < N; i++) {
+		random_bytes(data[i], len);
+		bufs[i] = data[i];
+		lens[i] = len;
+	}
+
+	start = now();
+	do {
+		if (!crypto_hash_many(HASH_SHA_1, bufs, lens, N, digests))
+			return 1;
+		ops += N;
+		elapsed = now() - start;
+	} while (elapsed < BENCH_TIME);
+
+	printf("SHA-1 %5zu bytes %9.0f ops/s %8.1f MB/s batched\n", len,
+			ops / elapsed, ops * len / elapsed / 1e6);
+
+	return 0;
+}
+
+int main(void)
+{
+	static const unsigned char e3[] = { 0x03 };
+	static const unsigned char e65537[] = { 0x01, 0x00, 0x01 };
+	static const size_t sizes[] = { 1024, 1152, 1408, 1984 };
+	static const size_t hash_sizes[] = { 64, 1024, 16384 };
+	unsigned i;
+
+	for (i = 0; i < sizeof(hash_sizes) / sizeof(hash_sizes[0]); i++)
+		if (bench_hash(hash_sizes[i]))
+			return 1;
+
+	if (bench_hash_many(BENCH_MAX_BYTES))
+		return 1;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		if (bench_pk(sizes[i], e3, sizeof(e3), false) ||
+		    bench_pk(sizes[i], e3, sizeof(e3), true) ||
+		    bench_pk(sizes[i], e65537, sizeof(e65537), false) ||
+		    bench_pk(sizes[i], e65537, sizeof(e65537), true) ||
+		    bench_pk_batch(sizes[i], e3, sizeof(e3)))
+			return 1;
+	}
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		if (bench_sign(sizes[i], false) ||
+		    bench_sign(sizes[i], true))
+			return 1;
+	}
+
+	return 0;
+}
@@ -20,6 +20,7 @@
 #include "openemv/crypto.h"
 #include "openemv/dump.h"
 
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -48,9 +49,28 @@ static int test_genkey(unsigned int keylength, unsigned char *msg, size_t msg_le
 	if (!tmp2)
 		goto free_tmp;
 
-	if (tmp2_len == msg_len && !memcmp(tmp2, msg, tmp2_len))
+	if (tmp2_len != msg_len || memcmp(tmp2, msg, tmp2_len))
+		goto free_tmp2;
+
+	/* The same round trip in place, through the caller buffer API */
+	if (crypto_pk_decrypt_into(pk, tmp2, tmp2_len, tmp2, tmp2_len - 1))
+		goto free_tmp2;
+
+	if (crypto_pk_decrypt_into(pk, tmp2, tmp2_len, tmp2, tmp2_len) != tmp_len ||
+	    memcmp(tmp2, tmp, tmp_len))
+		goto free_tmp2;
+
+	if (crypto_pk_encrypt_into(pk, tmp2, tmp_len, tmp2, tmp2_len) != msg_len ||
+	    memcmp(tmp2, msg, msg_len))
+		goto free_tmp2;
+
+	/* And once more with the signing state set up */
+	if (crypto_pk_precompute(pk) &&
+	    crypto_pk_decrypt_into(pk, msg, msg_len, tmp2, tmp2_len) == tmp_len &&
+	    !memcmp(tmp2, tmp, tmp_len))
 		ret = 0;
 
+free_tmp2:
 	free(tmp2);
 free_tmp:
 	free(tmp);
@@ -177,6 +197,206 @@ static unsigned char pk_I[] = {
 	0xd4, 0x42, 0xc9, 0x17, 0xb2, 0x2c, 0x92, 0x12, 0x37, 0x1b, 0xd3, 0xc5, 0x79, 0xd2, 0x65, 0x61,
 };
 
+static int test_hash(void)
+{
+	static const unsigned char abc_sha1[] = {
+		0xa9, 0x99, 0x3e, 0x36, 0x47, 0x06, 0x81, 0x6a, 0xba, 0x3e,
+		0x25, 0x71, 0x78, 0x50, 0xc2, 0x6c, 0x9c, 0xd0, 0xd8, 0x9d,
+	};
+	struct crypto_hash *ch;
+	int i, ret = 1;
+
+	/* Second round gets the finalized context back from the pool */
+	for (i = 0; i < 2; i++) {
+		ch = crypto_hash_open(HASH_SHA_1);
+		if (!ch)
+			return 1;
+
+		crypto_hash_write(ch, (const unsigned char *)"xyz", 3);
+		crypto_hash_reset(ch);
+		crypto_hash_write(ch, (const unsigned char *)"abc", 3);
+		ret = crypto_hash_get_size(ch) != sizeof(abc_sha1) ||
+			memcmp(crypto_hash_read(ch), abc_sha1, sizeof(abc_sha1));
+
+		crypto_hash_close(ch);
+		if (ret)
+			break;
+	}
+
+	return ret;
+}
+
+/* Lengths around the padding boundaries, more messages than vector lanes */
+static int test_hash_many(void)
+{
+	static const size_t lens[] = { 0, 3, 55, 56, 63, 64, 65, 119, 120, 200, 300 };
+	enum { N = sizeof(lens) / sizeof(lens[0]) };
+	const unsigned char *bufs[N];
+	unsigned char data[300 + N], digests[N * 20];
+	struct crypto_hash *ch;
+	int i, ret = 0;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = i * 7;
+	for (i = 0; i < N; i++)
+		bufs[i] = data + i;
+
+	if (!crypto_hash_many(HASH_SHA_1, bufs, lens, N, digests))
+		return 1;
+
+	ch = crypto_hash_open(HASH_SHA_1);
+	if (!ch)
+		return 1;
+
+	for (i = 0; i < N && !ret; i++) {
+		crypto_hash_reset(ch);
+		crypto_hash_write(ch, bufs[i], lens[i]);
+		ret = memcmp(crypto_hash_read(ch), digests + i * 20, 20) != 0;
+	}
+
+	crypto_hash_close(ch);
+
+	return ret;
+}
+
+/* Pieces straddling block boundaries, including empty ones */
+static int test_hash_writev(void)
+{
+	static const size_t lens[] = { 3, 0, 61, 64, 1, 0, 100 };
+	enum { N = sizeof(lens) / sizeof(lens[0]) };
+	struct iovec iov[N];
+	unsigned char data[229], digest[20];
+	struct crypto_hash *ch;
+	size_t pos = 0;
+	int i, ret;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = i * 13;
+	for (i = 0; i < N; i++) {
+		iov[i].iov_base = data + pos;
+		iov[i].iov_len = lens[i];
+		pos += lens[i];
+	}
+
+	ch = crypto_hash_open(HASH_SHA_1);
+	if (!ch)
+		return 1;
+
+	crypto_hash_write(ch, data, pos);
+	memcpy(digest, crypto_hash_read(ch), sizeof(digest));
+
+	crypto_hash_reset(ch);
+	crypto_hash_writev(ch, iov, N);
+	ret = memcmp(crypto_hash_read(ch), digest, sizeof(digest)) != 0;
+
+	crypto_hash_close(ch);
+
+	return ret;
+}
+
+/* Results of a batch mixing two handles come back in input order */
+static int test_pk_batch(struct crypto_pk *pubk, struct crypto_pk *privk, const unsigned char *msg, size_t msg_len)
+{
+	enum { N = 37 };
+	const struct crypto_pk *keys[N];
+	const unsigned char *in[N];
+	unsigned char *out[N];
+	unsigned char data[N][sizeof(pk_N)], res[N][sizeof(pk_N)], ref[sizeof(pk_N)];
+	size_t lens[N];
+	int i;
+
+	if (msg_len != sizeof(pk_N))
+		return 1;
+
+	for (i = 0; i < N; i++) {
+		memcpy(data[i], msg, msg_len);
+		data[i][msg_len - 1] ^= i;
+		keys[i] = i % 2 ? privk : pubk;
+		in[i] = data[i];
+		lens[i] = msg_len;
+		out[i] = res[i];
+	}
+
+	if (!crypto_pk_encrypt_batch(keys, in, lens, out, N))
+		return 1;
+
+	for (i = 0; i < N; i++)
+		if (crypto_pk_encrypt_into(pubk, data[i], msg_len, ref, sizeof(ref)) != lens[i] ||
+		    memcmp(ref, res[i], lens[i]))
+			return 1;
+
+	return 0;
+}
+
+static void test_async_cb(void *data, const unsigned char *res, size_t len)
+{
+	int *calls = data;
+
+	(*calls)++;
+}
+
+/* Decryption, then encryption of its result, queued at once */
+static int test_pk_async(struct crypto_pk *pubk, struct crypto_pk *privk, const unsigned char *msg, size_t msg_len)
+{
+	struct crypto_job *dec, *enc = NULL;
+	const unsigned char *res;
+	size_t res_len;
+	int calls = 0, ret = 1;
+	struct pollfd pfd;
+
+	dec = crypto_pk_decrypt_async(privk, msg, msg_len, test_async_cb, &calls);
+	if (!dec)
+		return 1;
+
+	res = crypto_job_result(dec, &res_len);
+	if (!res || !crypto_job_done(dec))
+		goto out;
+
+	/*
+	 * The first job signals the eventfd right after it is done, so wait
+	 * for that and clear it: only the second job can make it readable.
+	 */
+	pfd.fd = crypto_job_fd();
+	pfd.events = POLLIN;
+	if (pfd.fd >= 0 && poll(&pfd, 1, -1) != 1)
+		goto out;
+	crypto_job_fd_clear();
+
+	enc = crypto_pk_encrypt_async(pubk, res, res_len, test_async_cb, &calls);
+	if (!enc)
+		goto out;
+
+	if (pfd.fd >= 0 && poll(&pfd, 1, -1) != 1)
+		goto out;
+
+	res = crypto_job_result(enc, &res_len);
+	if (res && res_len == msg_len && !memcmp(res, msg, msg_len) && calls == 2)
+		ret = 0;
+
+out:
+	crypto_job_free(enc);
+	crypto_job_free(dec);
+
+	return ret;
+}
+
+/* Past a few renewals of the blinding factors, results stay the same */
+static int test_pk_sign(struct crypto_pk *privk, const unsigned char *msg, size_t msg_len, const unsigned char *sig, size_t sig_len)
+{
+	unsigned char out[sizeof(pk_N)];
+	int i;
+
+	if (!crypto_pk_precompute(privk))
+		return 1;
+
+	for (i = 0; i < 100; i++)
+		if (crypto_pk_decrypt_into(privk, msg, msg_len, out, sizeof(out)) != sig_len ||
+		    memcmp(out, sig, sig_len))
+			return 1;
+
+	return 0;
+}
+
 static int test_pk(void)
 {
 	int ret = 1;
@@ -253,7 +473,9 @@ static int test_pk(void)
 		goto free_tmp;
 
 	if (tmp2_len == msg_len && !memcmp(tmp2, msg, tmp2_len))
-		ret = 0;
+		ret = test_pk_batch(pubk, privk, msg, msg_len) ||
+			test_pk_async(pubk, privk, msg, msg_len) ||
+			test_pk_sign(privk, msg, msg_len, tmp, tmp_len);
 
 	free(tmp2);
 free_tmp:
@@ -273,6 +495,18 @@ int main(void)
 	int i;
 	int ret;
 
+	ret = test_hash();
+	if (ret)
+		return ret;
+
+	ret = test_hash_many();
+	if (ret)
+		return ret;
+
+	ret = test_hash_writev();
+	if (ret)
+		return ret;
+
 	ret = test_pk();
 	if (ret)
 		return ret;
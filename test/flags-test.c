@@ -0,0 +1,115 @@
+/*
+ * emv-tools - a set of tools to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "openemv/config.h"
+#include "openemv/tlv.h"
+#include "openemv/emv_tags.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* TVR: no ODA, expired, online PIN entered, random online, bit 5.1 */
+static const unsigned char tvr[] = { 0x80, 0x40, 0x04, 0x10, 0x01 };
+
+static const unsigned expected[] = {
+	EMV_TAG_FLAG(1, 8),
+	EMV_TAG_FLAG(2, 7),
+	EMV_TAG_FLAG(3, 3),
+	EMV_TAG_FLAG(4, 5),
+	EMV_TAG_FLAG(5, 1),
+};
+
+int main(void)
+{
+	struct tlv tlv = { .tag = 0x95, .len = sizeof(tvr), .value = tvr };
+	unsigned flags[16];
+	const char *name, *dict, *out;
+	struct emv_tag_emitter *e;
+	char text[4096];
+	size_t n, i, len;
+
+	n = emv_tag_decode_flags(&tlv, flags, 16);
+	if (n != sizeof(expected) / sizeof(expected[0])) {
+		printf("Got %zu flags\n", n);
+		return 1;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (flags[i] != expected[i]) {
+			printf("Flag %zu: %u vs %u\n", i, flags[i], expected[i]);
+			return 1;
+		}
+	}
+
+	/* A short array still reports all set bits */
+	memset(flags, 0xff, sizeof(flags));
+	if (emv_tag_decode_flags(&tlv, flags, 2) != n || flags[0] != expected[0] ||
+	    flags[1] != expected[1] || flags[2] != ~0U) {
+		printf("Short array mishandled\n");
+		return 1;
+	}
+
+	name = emv_tag_flag_name(0x95, EMV_TAG_FLAG(2, 7));
+	if (!name || strcmp(name, "Expired application")) {
+		printf("Wrong name: %s\n", name ? name : "(null)");
+		return 1;
+	}
+
+	/* The Issuer Action Codes share the TVR layout */
+	if (emv_tag_flag_name(0x9f0e, EMV_TAG_FLAG(2, 7)) != name) {
+		printf("IAC names differ\n");
+		return 1;
+	}
+
+	if (emv_tag_flag_name(0x95, EMV_TAG_FLAG(1, 1)) ||
+	    emv_tag_flag_name(0x95, EMV_TAG_FLAG(6, 8))) {
+		printf("Unnamed flag has a name\n");
+		return 1;
+	}
+
+	/* TVR is rendered bit by bit, like the Issuer Action Codes */
+	e = emv_tag_emitter_new(NULL, EMV_TAG_FORMAT_TEXT);
+	if (!e || !emv_tag_emit(e, &tlv))
+		return 1;
+	out = emv_tag_emitter_data(e, &len);
+	if (len >= sizeof(text))
+		return 1;
+	memcpy(text, out, len);
+	text[len] = 0;
+	if (!strstr(text, "- 'Expired application'")) {
+		printf("TVR not rendered as a bitmask\n");
+		return 1;
+	}
+	emv_tag_emitter_free(e);
+
+	tlv.tag = 0x9f02;
+	if (emv_tag_decode_flags(&tlv, flags, 16)) {
+		printf("Non-bitmask tag decoded\n");
+		return 1;
+	}
+
+	/* Tags are in use, the table can not change under them */
+	dict = openemv_config_get("tags");
+	if (dict && emv_tags_load(dict)) {
+		printf("Dictionary loaded after first use\n");
+		return 1;
+	}
+
+	return 0;
+}
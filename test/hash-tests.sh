@@ -0,0 +1,27 @@
+#!/bin/sh
+# Crypto dependent tests once more for each hash implementation: those of
+# the drivers, then every built-in SHA-1 kernel forced in turn. A kernel
+# the CPU lacks falls back to the portable one.
+
+run() {
+	OPENEMV_CONFIG="hash-$1-$2.txt"
+	export OPENEMV_CONFIG
+
+	sed -e "/^crypto:/,/^};/s|driver = \"[^\"]*\"|driver = \"$1\"|" \
+		-e "s|hash = \"native\"|hash = \"$2\"|" \
+		../data/notinst.txt > "$OPENEMV_CONFIG" || exit 1
+
+	for t in crypto-test sda-test dda-test cda-test; do
+		./$t || exit 1
+	done
+}
+
+default=`sed -n '/^crypto:/,/^};/s|^[[:space:]]*driver = "\([^"]*\)";|\1|p' ../data/notinst.txt`
+
+for driver in $HASH_DRIVERS; do
+	run $driver driver
+done
+
+for hash in native-c native-ssse3 native-sha; do
+	run $default $hash
+done
@@ -0,0 +1,341 @@
+/*
+ * emv-tools - a set of tools to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "openemv/config.h"
+#include "openemv/crypto.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* As in the test configuration */
+#define KEY_BITS 1024
+#define KEY_EXP 3
+#define POOL_DEPTH 2
+#define MAX_FILE 4096
+
+/* A 1024/3 key spooled under some other master key */
+static const unsigned char foreign_key[] = {
+	0x4f, 0x45, 0x4b, 0x31, 0x9a, 0xe8, 0xc2, 0x0b, 0x8c, 0x9c, 0xc9, 0xfe,
+	0xc2, 0x02, 0xbb, 0xf2, 0xb0, 0xa1, 0xc3, 0x64, 0x03, 0xff, 0xc1, 0xd3,
+	0xf3, 0xdd, 0x24, 0xfb, 0x0f, 0xe0, 0xf6, 0xb0, 0xfc, 0x8e, 0x8e, 0x23,
+	0x13, 0x0d, 0x1d, 0x4d, 0xb3, 0x4c, 0xfc, 0xd8, 0x59, 0x2f, 0x43, 0x79,
+	0x5f, 0x69, 0x65, 0x06, 0x22, 0x88, 0x91, 0x04, 0x8b, 0x19, 0xb9, 0x4e,
+	0x0e, 0xec, 0x78, 0x1d, 0x52, 0x65, 0x2b, 0xe8, 0xdc, 0x11, 0x0c, 0x17,
+	0xba, 0xe5, 0x0c, 0x5f, 0x39, 0x0b, 0x6a, 0x1e, 0x98, 0xf9, 0xdb, 0xc6,
+	0x2f, 0x65, 0x2a, 0x22, 0xb9, 0xc8, 0x34, 0xa8, 0x09, 0x08, 0x95, 0x22,
+	0x65, 0x0f, 0xc0, 0xbe, 0xbc, 0xaf, 0x9e, 0xc2, 0xa8, 0x29, 0xc8, 0x12,
+	0xab, 0x52, 0x30, 0x90, 0xf6, 0x02, 0x59, 0xec, 0x1f, 0x22, 0xf1, 0xff,
+	0x51, 0x3b, 0xa6, 0x45, 0xaa, 0xea, 0x89, 0x3d, 0xb1, 0x03, 0x64, 0x01,
+	0xa2, 0xe3, 0xce, 0x44, 0x76, 0x11, 0x86, 0x83, 0x4a, 0x1a, 0x43, 0x73,
+	0x3e, 0xcd, 0x6b, 0x1e, 0xd6, 0x34, 0x0d, 0x86, 0x5d, 0x6c, 0x3b, 0x9c,
+	0x62, 0x15, 0xca, 0xb2, 0x28, 0xde, 0x89, 0x8a, 0xee, 0x82, 0xfe, 0x1a,
+	0x56, 0x41, 0xf8, 0x94, 0xf9, 0xe5, 0x09, 0xe7, 0x50, 0x5f, 0xf6, 0xfb,
+	0x67, 0xe0, 0xc8, 0x90, 0x28, 0x2e, 0xcf, 0xb2, 0x58, 0xb5, 0x57, 0x4a,
+	0x39, 0x7e, 0xa4, 0xd2, 0x5d, 0x4a, 0x1a, 0x94, 0x4c, 0x80, 0xc3, 0xe2,
+	0xbc, 0xfb, 0x50, 0x6b, 0xc3, 0x7d, 0xbb, 0x3e, 0x8a, 0x11, 0x81, 0x07,
+	0x80, 0xf3, 0x51, 0xd7, 0x24, 0x98, 0x6a, 0x58, 0x8a, 0x06, 0xc0, 0x20,
+	0xfb, 0x98, 0x08, 0xa5, 0x6d, 0xe2, 0x7b, 0xc2, 0xf7, 0x97, 0xd9, 0x3a,
+	0xcb, 0x0f, 0x69, 0x86, 0x45, 0x8b, 0x23, 0x84, 0x42, 0x42, 0x84, 0xcd,
+	0xdf, 0x13, 0x93, 0x1c, 0x97, 0x2c, 0x1e, 0xc4, 0x1e, 0x9d, 0x26, 0xc2,
+	0xd9, 0x15, 0xbe, 0x41, 0x44, 0x57, 0xe2, 0xd5, 0x48, 0xaf, 0x37, 0xb4,
+	0xc8, 0xa6, 0x1c, 0xcb, 0xde, 0xdf, 0x40, 0xb7, 0x56, 0x15, 0x57, 0x47,
+	0x2c, 0x22, 0xee, 0x3d, 0x16, 0xdc, 0xe3, 0xef, 0x3b, 0x67, 0x54, 0x2d,
+	0x29, 0x91, 0xc5, 0x12, 0xa4, 0x8b, 0x29, 0x3d, 0xe1, 0xff, 0xa2, 0x8e,
+	0x5b, 0x43, 0xb7, 0xb5, 0x7e, 0xa0, 0x57, 0x61, 0xa9, 0xbd, 0x82, 0x24,
+	0x1b, 0x00, 0x97, 0x13, 0x4d, 0x53, 0x16, 0x69, 0xd3, 0x64, 0xb6, 0x4e,
+	0x05, 0xa4, 0x55, 0x63, 0x11, 0x3c, 0x9c, 0x83, 0xb0, 0x5f, 0xc3, 0xbb,
+	0x8d, 0x26, 0x72, 0x31, 0x65, 0x30, 0x19, 0x11, 0x2d, 0x1b, 0x46, 0xdb,
+	0x94, 0x4b, 0x59, 0x00, 0xac, 0xae, 0xbb, 0xe4, 0x4e, 0x97, 0x50, 0x5c,
+	0x99, 0xe5, 0x97, 0xb1, 0x17, 0xef, 0x0b, 0xba, 0xa4, 0xce, 0xdf, 0xa8,
+	0xfc, 0xaa, 0x20, 0x8d, 0xcc, 0xa3, 0xd8, 0x57, 0xf4, 0x17, 0x3e, 0xa4,
+	0xb9, 0x57, 0xbe, 0xf6, 0x1f, 0x24, 0xd2, 0x97, 0x3f, 0x97, 0xdd, 0x58,
+	0x1b, 0x50, 0x85, 0x57, 0xfa, 0x0a, 0x2b, 0xe3, 0xd5, 0x14, 0xbf, 0x9a,
+	0x26, 0x4a, 0x25, 0xb6, 0xfb, 0x03, 0x42, 0x0d, 0x83, 0xe3, 0x72, 0x40,
+	0x6f, 0xd7, 0xcd, 0x2b, 0xb6, 0x2f, 0xe3, 0x3f, 0x9d, 0x7e, 0xc4, 0x3c,
+	0x87, 0x37, 0x44, 0x40, 0xa7, 0x74, 0x65, 0x1a, 0x34, 0x99, 0x5f, 0xfa,
+	0xb9, 0x11, 0x92, 0x30, 0xd7, 0x7c, 0x77, 0x17, 0x28, 0x19, 0x48, 0x9d,
+	0xe5, 0x1d, 0x1d, 0x3b, 0xf9, 0xb8, 0xc7, 0x1a, 0xde, 0xe5, 0xd6, 0xf1,
+	0xf7, 0x8a, 0x73, 0x7e, 0x90, 0xed, 0x4a, 0x8a, 0x45, 0x85, 0xfe, 0xc3,
+	0xc9, 0xff, 0x45, 0x54, 0x61, 0x71, 0x15, 0x9a, 0xcc, 0x1b, 0x34, 0x0e,
+	0x18, 0x47, 0x73, 0xdd, 0x45, 0xf3, 0xea, 0x35, 0x7f, 0xaf, 0xc5, 0x78,
+	0x9e, 0xb5, 0x01, 0x6d, 0x5c, 0x89, 0x2f, 0x18, 0xcf, 0xd3, 0x6a, 0x18,
+	0x8d, 0xab, 0x19, 0x3c, 0x3e, 0x1a, 0x28, 0xb6, 0x36, 0xd2, 0xc5, 0xd3,
+	0xff, 0xc7, 0x29, 0x19, 0xd0, 0xcf, 0x71, 0x0d, 0x9f, 0xa0, 0xbd, 0x1b,
+	0x39, 0xb3, 0x67, 0x14, 0x6a, 0xde, 0x9c, 0x09, 0xbc, 0x65, 0x9f, 0x3d,
+	0x5d, 0x4a, 0x98, 0xfa, 0x20, 0x15, 0xd2, 0xdb, 0x8d, 0xda, 0xce, 0x9d,
+	0x91, 0xae, 0xc9, 0x41, 0x36, 0x13, 0x73, 0xfe, 0x70, 0x0f, 0xf3, 0x78,
+	0x72, 0x36, 0x8b, 0x26, 0x6c, 0xd4, 0x12, 0x4a, 0xc1, 0x31, 0x02, 0x98,
+	0x32, 0x72, 0xf3, 0xae, 0x2f, 0x2f, 0xc1, 0x83, 0x4b, 0x08, 0x31, 0xc1,
+	0x6f, 0x30, 0x38, 0x40, 0xcb, 0x48, 0xae, 0x09, 0x4c, 0x20, 0xe9, 0x33,
+	0xde, 0x80, 0x45, 0xa5, 0x93, 0x69, 0xc2, 0x2c, 0x64
+};
+
+struct spool_file {
+	char name[64];
+	unsigned char data[MAX_FILE];
+	size_t len;
+};
+
+static const char *spool;
+/* Spooled before the first key was taken, and that key's modulus */
+static struct spool_file saved[POOL_DEPTH];
+static unsigned nsaved;
+static struct spool_file *taken;
+static unsigned char *taken_mod;
+static size_t taken_mlen;
+
+/* Whichever way it was made, the key has to work */
+static int test_key(struct crypto_pk *cp, unsigned nbits)
+{
+	unsigned char msg[4096 / 8], sig[4096 / 8], res[4096 / 8];
+	size_t len = nbits / 8;
+	int ret;
+
+	if (!cp)
+		return 1;
+
+	memset(msg, 0x5a, len);
+	ret = crypto_pk_get_nbits(cp) != nbits ||
+		crypto_pk_decrypt_into(cp, msg, len, sig, sizeof(sig)) != len ||
+		crypto_pk_encrypt_into(cp, sig, len, res, sizeof(res)) != len ||
+		memcmp(msg, res, len);
+
+	crypto_pk_close(cp);
+
+	return ret;
+}
+
+static bool same_key(const struct crypto_pk *cp, const unsigned char *mod, size_t mlen)
+{
+	unsigned char *n;
+	size_t nlen;
+	bool same;
+
+	n = crypto_pk_get_parameter(cp, 0, &nlen);
+	if (!n)
+		return false;
+
+	same = nlen == mlen && !memcmp(n, mod, mlen);
+	free(n);
+
+	return same;
+}
+
+static char *spool_path(const char *name)
+{
+	static char path[1024];
+
+	snprintf(path, sizeof(path), "%s/%s", spool, name);
+
+	return path;
+}
+
+static bool spool_has(const char *name)
+{
+	return !access(spool_path(name), F_OK);
+}
+
+static int spool_write(const char *name, const unsigned char *data, size_t len)
+{
+	FILE *f = fopen(spool_path(name), "w");
+	int ret;
+
+	if (!f)
+		return 1;
+
+	ret = fwrite(data, 1, len, f) != len;
+	if (fclose(f))
+		ret = 1;
+
+	return ret;
+}
+
+/* Calls fn on each spooled key file, stopping at the first non-zero */
+static int spool_walk(int (*fn)(const char *name))
+{
+	struct dirent *de;
+	DIR *dir;
+	int ret = 0;
+
+	dir = opendir(spool);
+	if (!dir)
+		return 1;
+
+	while (!ret && (de = readdir(dir))) {
+		size_t nlen = strlen(de->d_name);
+
+		if (de->d_name[0] != '.' && nlen > 4 && !strcmp(de->d_name + nlen - 4, ".key"))
+			ret = fn(de->d_name);
+	}
+	closedir(dir);
+
+	return ret;
+}
+
+static int save_one(const char *name)
+{
+	struct spool_file *sf;
+	FILE *f;
+
+	if (nsaved == POOL_DEPTH || strlen(name) >= sizeof(sf->name))
+		return 1;
+
+	sf = &saved[nsaved++];
+	strcpy(sf->name, name);
+	f = fopen(spool_path(name), "r");
+	if (!f)
+		return 1;
+
+	sf->len = fread(sf->data, 1, sizeof(sf->data), f);
+	fclose(f);
+
+	return !sf->len;
+}
+
+static int remove_one(const char *name)
+{
+	return unlink(spool_path(name));
+}
+
+/* Spool holding just the given file */
+static int spool_only(const char *name, const unsigned char *data, size_t len)
+{
+	return spool_walk(remove_one) || spool_write(name, data, len);
+}
+
+static int wait_ready(unsigned count)
+{
+	int i;
+
+	for (i = 0; i < 600; i++) {
+		if (crypto_keypool_ready(PK_RSA, KEY_BITS, KEY_EXP) >= count)
+			return 0;
+		usleep(100000);
+	}
+
+	return 1;
+}
+
+/* Its file taken by someone else after loading, the key is not handed out */
+static int spooled_twice_test(void)
+{
+	struct crypto_pk *cp;
+	int ret;
+
+	if (spool_only(taken->name, taken->data, taken->len) ||
+	    !crypto_keypool_start())
+		return 1;
+
+	if (remove_one(taken->name))
+		return 1;
+
+	cp = crypto_keypool_get(PK_RSA, KEY_BITS, KEY_EXP);
+	ret = !cp || same_key(cp, taken_mod, taken_mlen) || test_key(cp, KEY_BITS);
+	crypto_keypool_stop();
+
+	return ret;
+}
+
+/* Files that do not authenticate are left alone */
+static int rejected_test(const char *name, const unsigned char *data, size_t len)
+{
+	struct crypto_pk *cp;
+	int ret;
+
+	if (spool_only(name, data, len) || !crypto_keypool_start())
+		return 1;
+
+	cp = crypto_keypool_get(PK_RSA, KEY_BITS, KEY_EXP);
+	ret = !cp || same_key(cp, taken_mod, taken_mlen) || test_key(cp, KEY_BITS) ||
+		!spool_has(name);
+	crypto_keypool_stop();
+
+	return ret;
+}
+
+static int tampered_test(void)
+{
+	unsigned char data[MAX_FILE];
+
+	/* The last byte of the encrypted parameters, away from the modulus */
+	memcpy(data, taken->data, taken->len);
+	data[taken->len - 21] ^= 1;
+
+	return rejected_test(taken->name, data, taken->len);
+}
+
+static int foreign_test(void)
+{
+	return rejected_test("1024-3-0123456789abcdef.key", foreign_key, sizeof(foreign_key));
+}
+
+int main(void)
+{
+	struct crypto_pk *cp;
+	unsigned i;
+
+	spool = openemv_config_get("crypto.keypool.spool");
+	if (!spool)
+		return 1;
+
+	/* Left over from an earlier run, if any */
+	spool_walk(remove_one);
+
+	if (!crypto_keypool_start())
+		return 1;
+
+	if (wait_ready(POOL_DEPTH))
+		return 1;
+
+	/* Spooled keys come back right away */
+	crypto_keypool_stop();
+	if (!crypto_keypool_start() ||
+	    crypto_keypool_ready(PK_RSA, KEY_BITS, KEY_EXP) != POOL_DEPTH)
+		return 1;
+
+	/* The key taken is the one whose file goes */
+	if (spool_walk(save_one) || nsaved != POOL_DEPTH)
+		return 1;
+
+	cp = crypto_keypool_get(PK_RSA, KEY_BITS, KEY_EXP);
+	if (!cp || crypto_keypool_ready(PK_RSA, KEY_BITS, KEY_EXP) > POOL_DEPTH - 1)
+		return 1;
+
+	for (i = 0; i < nsaved; i++)
+		if (!spool_has(saved[i].name))
+			taken = &saved[i];
+	taken_mod = crypto_pk_get_parameter(cp, 0, &taken_mlen);
+	if (!taken || !taken_mod || test_key(cp, KEY_BITS))
+		return 1;
+
+	/* Not pooled, generated on the spot */
+	if (test_key(crypto_keypool_get(PK_RSA, 1152, KEY_EXP), 1152))
+		return 1;
+
+	/* And the pool fills up again */
+	if (wait_ready(POOL_DEPTH))
+		return 1;
+
+	crypto_keypool_stop();
+
+	return spooled_twice_test() || tampered_test() || foreign_test();
+}
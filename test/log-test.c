@@ -0,0 +1,136 @@
+/*
+ * emv-tools - a set of tools to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "openemv/emv_log.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Date, time, amount, currency, merchant name, type, ATC, CID */
+static const unsigned char log_format[] = {
+	0x9a, 0x03, 0x9f, 0x21, 0x03, 0x9f, 0x02, 0x06, 0x5f, 0x2a, 0x02,
+	0x9f, 0x4e, 0x04, 0x9c, 0x01, 0x9f, 0x36, 0x02, 0x9f, 0x27, 0x01,
+};
+
+#define ENTRY_LEN 22
+
+static const unsigned char records[][ENTRY_LEN] = {
+	{
+		0x25, 0x12, 0x31, 0x23, 0x59, 0x58, 0x00, 0x00, 0x00, 0x01,
+		0x23, 0x45, 0x09, 0x78, 'S', 'H', 'O', 'P', 0x00, 0x01,
+		0x02, 0x40,
+	},
+	{
+		/* Amount with a digit above 9, decoded as zero */
+		0x26, 0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+		0x0a, 0x00, 0x06, 0x43, 'C', 'A', 'S', 'H', 0x01, 0xff,
+		0xfe, 0x80,
+	},
+};
+
+static int plan_test(const struct emv_log_plan *plan)
+{
+	size_t offset, len;
+
+	if (emv_log_plan_entry_len(plan) != ENTRY_LEN)
+		return 1;
+
+	if (!emv_log_plan_has(plan, EMV_LOG_AMOUNT) ||
+	    emv_log_plan_has(plan, EMV_LOG_AMOUNT_OTHER) ||
+	    emv_log_plan_has(plan, EMV_LOG_COUNTRY) ||
+	    !emv_log_plan_has(plan, EMV_LOG_CID))
+		return 1;
+
+	if (!emv_log_plan_field(plan, 0x9f4e, &offset, &len) || offset != 14 || len != 4)
+		return 1;
+
+	if (emv_log_plan_field(plan, 0x9f1a, &offset, &len))
+		return 1;
+
+	return 0;
+}
+
+static int decode_test(const struct emv_log_plan *plan)
+{
+	struct emv_log *log;
+	int ret = 1;
+
+	log = emv_log_new(plan, 2);
+	if (!log)
+		return 1;
+
+	if (emv_log_decode(log, records[0], ENTRY_LEN - 1))
+		goto out;
+
+	if (!emv_log_decode(log, records[0], ENTRY_LEN) ||
+	    !emv_log_decode(log, records[1], ENTRY_LEN))
+		goto out;
+
+	/* Full */
+	if (emv_log_decode(log, records[0], ENTRY_LEN) || log->count != 2)
+		goto out;
+
+	if (log->date[0] != 251231 || log->time[0] != 235958 ||
+	    log->amount[0] != 12345 || log->currency[0] != 978 ||
+	    log->type[0] != 0 || log->atc[0] != 0x0102 || log->cid[0] != 0x40 ||
+	    log->amount_other[0] != 0 || log->country[0] != 0)
+		goto out;
+
+	if (log->date[1] != 260101 || log->time[1] != 1 ||
+	    log->amount[1] != 0 || log->currency[1] != 643 ||
+	    log->type[1] != 1 || log->atc[1] != 0xfffe || log->cid[1] != 0x80)
+		goto out;
+
+	if (memcmp(log->raw, records, sizeof(records)))
+		goto out;
+
+	ret = 0;
+out:
+	emv_log_free(log);
+
+	return ret;
+}
+
+int main(void)
+{
+	struct tlv format = { .tag = 0x9f4f, .len = sizeof(log_format), .value = log_format };
+	struct emv_log_plan *plan;
+	int ret;
+
+	plan = emv_log_plan_compile(&format);
+	if (!plan)
+		return 1;
+
+	ret = plan_test(plan) || decode_test(plan);
+	emv_log_plan_free(plan);
+	if (ret)
+		return 1;
+
+	/* Every field of a fixed size record needs a length */
+	format.len = 4;
+	if (emv_log_plan_compile(&format))
+		return 1;
+
+	format.len = 0;
+	if (emv_log_plan_compile(&format))
+		return 1;
+
+	return 0;
+}
@@ -0,0 +1,15 @@
+#!/bin/sh
+# Crypto dependent tests once more, against the OpenSSL backend, hashing
+# with the built-in code and then with OpenSSL's
+
+for hash in native driver; do
+	OPENEMV_CONFIG="openssl-$hash.txt"
+	export OPENEMV_CONFIG
+
+	sed -e "s|hash = \"native\"|hash = \"$hash\"|" \
+		../data/notinst-openssl.txt > "$OPENEMV_CONFIG" || exit 1
+
+	for t in crypto-test sda-test dda-test cda-test keypool-test; do
+		./$t || exit 1
+	done
+done
@@ -235,6 +235,34 @@ static int sda_test_pk(void)
 	return 0;
 }
 
+static int sda_test_pk_cache(void)
+{
+	struct crypto_pk *cp1, *cp2;
+	unsigned char *data;
+	size_t data_len;
+
+	cp1 = emv_pk_crypto_open(&vsdc_01);
+	cp2 = emv_pk_crypto_open(&vsdc_01);
+	if (!cp1 || cp1 != cp2) {
+		fprintf(stderr, "Key handle was not cached!\n");
+		return 2;
+	}
+	crypto_pk_close(cp2);
+
+	/* A handle still held survives the cache */
+	emv_pk_cache_flush();
+	data = crypto_pk_encrypt(cp1, issuer_cert, sizeof(issuer_cert), &data_len);
+	crypto_pk_close(cp1);
+	if (!data || data_len != sizeof(issuer_cert) || data[0] != 0x6a) {
+		fprintf(stderr, "Flushed key handle is broken!\n");
+		free(data);
+		return 2;
+	}
+	free(data);
+
+	return 0;
+}
+
 int main(void)
 {
 	int ret;
@@ -249,5 +277,9 @@ int main(void)
 	if (ret)
 		return ret;
 
+	ret = sda_test_pk_cache();
+	if (ret)
+		return ret;
+
 	return 0;
 }
@@ -0,0 +1,156 @@
+/*
+ * emv-tools - a set of tools to work with EMV family of smart cards
+ * Copyright (C) 2015 Dmitry Eremin-Solenikov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "openemv/tlv.h"
+#include "openemv/emv_stats.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* 70 { 5f28 0840, 82 1980, 82 3900 } */
+static const unsigned char card1[] = {
+	0x70, 0x0d, 0x5f, 0x28, 0x02, 0x08, 0x40, 0x82, 0x02, 0x19, 0x80,
+	0x82, 0x02, 0x39, 0x00,
+};
+
+/* 70 { 5f28 0643, 82 1980 } */
+static const unsigned char card2[] = {
+	0x70, 0x09, 0x5f, 0x28, 0x02, 0x06, 0x43, 0x82, 0x02, 0x19, 0x80,
+};
+
+static const char expected[] =
+	"tag,name,count,cards,min_len,max_len,mean_len,values,other_values\n"
+	"0070,\"READ RECORD Response Message Template\",2,2,9,13,11.00,,0\n"
+	"0082,\"Application Interchange Profile\",3,2,2,2,2.00,1980=2 3900=1,0\n"
+	"5f28,\"Issuer Country Code\",2,2,2,2,2.00,0643=1 0840=1,0\n";
+
+/* More distinct ATC values than are written out */
+#define SPLIT_CARDS 60
+#define SPLIT_VALUES 20
+
+static bool add_card(struct emv_stats *stats, const unsigned char *buf, size_t len)
+{
+	struct tlvdb *db = tlvdb_parse(buf, len);
+	bool ret;
+
+	if (!db)
+		return false;
+
+	ret = emv_stats_add_tlvdb(stats, db);
+	tlvdb_free(db);
+
+	return ret;
+}
+
+static bool write_csv(const struct emv_stats *stats, char *out, size_t size)
+{
+	FILE *f = tmpfile();
+	size_t len;
+
+	if (!f)
+		return false;
+
+	if (!emv_stats_write_csv(stats, f)) {
+		fclose(f);
+		return false;
+	}
+
+	rewind(f);
+	len = fread(out, 1, size - 1, f);
+	out[len] = 0;
+	fclose(f);
+
+	return true;
+}
+
+/* Merging even and odd cards gives what one pass over all of them does */
+static int split_test(void)
+{
+	struct emv_stats *all = emv_stats_new(), *even = emv_stats_new(), *odd = emv_stats_new();
+	static char out_all[4096], out_merged[4096];
+	unsigned i;
+	int ret = 1;
+
+	if (!all || !even || !odd)
+		goto out;
+
+	for (i = 0; i < SPLIT_CARDS; i++) {
+		/* 70 { 9f36 <i % SPLIT_VALUES> } */
+		unsigned char card[] = { 0x70, 0x04, 0x9f, 0x36, 0x01, i % SPLIT_VALUES };
+
+		if (!add_card(all, card, sizeof(card)) ||
+		    !add_card(i % 2 ? odd : even, card, sizeof(card)))
+			goto out;
+	}
+
+	if (!emv_stats_merge(even, odd) ||
+	    !write_csv(all, out_all, sizeof(out_all)) ||
+	    !write_csv(even, out_merged, sizeof(out_merged)))
+		goto out;
+
+	/* The 16 most common, 00 to 0f, and the other 4 values 3 times each */
+	if (strcmp(out_all, out_merged) || !strstr(out_all, " 0f=3,12\n")) {
+		printf("Unexpected output:\n%s%s", out_all, out_merged);
+		goto out;
+	}
+
+	ret = 0;
+out:
+	emv_stats_free(all);
+	emv_stats_free(even);
+	emv_stats_free(odd);
+
+	return ret;
+}
+
+int main(void)
+{
+	struct emv_stats *a = emv_stats_new(), *b = emv_stats_new();
+	char out[sizeof(expected) + 64];
+	FILE *f = tmpfile();
+	size_t len;
+
+	if (!a || !b || !f)
+		return 1;
+
+	/* Two partial aggregates, as two threads would produce */
+	if (!add_card(a, card1, sizeof(card1)) || !add_card(b, card2, sizeof(card2)))
+		return 1;
+
+	if (!emv_stats_merge(a, b) || emv_stats_cards(a) != 2)
+		return 1;
+
+	if (!emv_stats_write_csv(a, f))
+		return 1;
+
+	rewind(f);
+	len = fread(out, 1, sizeof(out) - 1, f);
+	out[len] = 0;
+
+	if (strcmp(out, expected)) {
+		printf("Unexpected output:\n%s", out);
+		return 1;
+	}
+
+	fclose(f);
+	emv_stats_free(a);
+	emv_stats_free(b);
+
+	return split_test();
+}